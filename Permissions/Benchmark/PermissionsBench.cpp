@@ -0,0 +1,841 @@
+// Headless benchmark of the Permissions core. Builds Permissions.cpp and the SQLite backend against the stand-ins in
+// Stubs/, fills a local SQLite file with synthetic players, tribes and groups and reports per-call latency percentiles
+// and heap allocations of the exported API. See CMakeLists.txt for how to build and run it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Statement.h>
+#include <SQLiteCpp/Transaction.h>
+
+#include "Database/SqlLiteDB.h"
+#include "Main.h"
+#include "CallbackCache.h"
+#include "Compaction.h"
+#include "Snapshot.h"
+#include "Transfer.h"
+
+// Every global new goes through here so each workload can report allocations per call
+namespace
+{
+	std::atomic<uint64_t> allocations{ 0 };
+	std::atomic<uint64_t> allocatedBytes{ 0 };
+
+	void* CountedAlloc(std::size_t size)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+		if (void* ptr = std::malloc(size ? size : 1))
+			return ptr;
+		throw std::bad_alloc();
+	}
+}
+
+void* operator new(std::size_t size) { return CountedAlloc(size); }
+void* operator new[](std::size_t size) { return CountedAlloc(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace
+{
+	struct Options {
+		int Players = 10000;
+		int Groups = 50;
+		int Tribes = 0;
+		int Online = 70;
+		int Iterations = 20000;
+		int Callbacks = 2;
+		bool Normalized = false;
+		bool Lazy = false;
+		std::string DbPath = "PermissionsBench.db";
+		unsigned Seed = 42;
+	};
+
+	struct SyntheticTribe {
+		FTribeData Data;
+	};
+
+	Options options;
+	std::mt19937 rng;
+	std::vector<FString> players;
+	std::vector<FString> groups;
+	std::vector<FString> permissions;
+	std::vector<int> tribeIds;
+	std::vector<std::unique_ptr<SyntheticTribe>> onlineTribes;
+	std::vector<std::unique_ptr<AShooterPlayerController>> onlineControllers;
+	// Stands in for the presence map the plugin keeps from its login, logout and tribe hooks
+	std::unordered_map<FString, Permissions::OnlinePlayer, FStringNoCaseHash, FStringNoCaseEqual> presence;
+
+	int Random(int count)
+	{
+		return std::uniform_int_distribution<int>(0, count - 1)(rng);
+	}
+
+	bool Chance(double probability)
+	{
+		return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < probability;
+	}
+
+	std::string EosId(int index)
+	{
+		char buffer[33];
+		std::snprintf(buffer, sizeof(buffer), "%016llx%016llx", 0x0002a1b2c3d4e5f6ULL, static_cast<unsigned long long>(index));
+		return buffer;
+	}
+
+	/// <summary>
+	/// Writes the synthetic data set straight into the legacy columns, one transaction per table.
+	/// With --normalized the backend migrates it into the membership tables when it is opened.
+	/// </summary>
+	void Populate()
+	{
+		std::filesystem::remove(options.DbPath);
+		std::filesystem::remove(options.DbPath + "-wal");
+		std::filesystem::remove(options.DbPath + "-shm");
+
+		// Creates the schema the same way the plugin does
+		SqlLite(options.DbPath, false);
+
+		SQLite::Database db(options.DbPath, SQLite::OPEN_READWRITE);
+		SQLite::Transaction transaction(db);
+
+		// A few plugins worth of permissions, some groups also hold a whole namespace
+		for (int plugin = 0; plugin < 20; ++plugin)
+			for (int perm = 0; perm < 25; ++perm)
+				permissions.emplace_back(fmt::format("Plugin{}.Perm{}", plugin, perm));
+
+		// Some groups inherit from an earlier one, so loads flatten chains without cycles
+		SQLite::Statement insertGroup(db, "INSERT INTO Groups (GroupName, Permissions, Parents) VALUES (?, ?, ?);");
+		for (int i = 0; i < options.Groups; ++i)
+		{
+			groups.emplace_back(fmt::format("Group{}", i));
+
+			std::string groupPermissions;
+			const int count = 5 + Random(26);
+			for (int p = 0; p < count; ++p)
+				groupPermissions += permissions[Random(static_cast<int>(permissions.size()))].ToString() + ",";
+			if (Chance(0.1))
+				groupPermissions += fmt::format("Plugin{}.*,", Random(20));
+
+			std::string groupParents;
+			if (i > 0 && Chance(0.3))
+				groupParents = groups[Random(i)].ToString() + ",";
+
+			insertGroup.bind(1, groups.back().ToString());
+			insertGroup.bind(2, groupPermissions);
+			insertGroup.bind(3, groupParents);
+			insertGroup.exec();
+			insertGroup.reset();
+		}
+
+		const long long now = std::time(nullptr);
+		auto timedGroups = [&]()
+			{
+				std::string timed;
+				if (Chance(0.1))
+					timed += fmt::format("0;{};{},", now + 86400, groups[Random(options.Groups)].ToString());
+				if (Chance(0.02))
+					timed += fmt::format("{};{};{},", now + 3600, now + 86400, groups[Random(options.Groups)].ToString());
+				// Left behind by memberships that ran out, for the compaction to remove
+				if (Chance(0.2))
+					timed += fmt::format("0;{};{},", now - 86400, groups[Random(options.Groups)].ToString());
+				return timed;
+			};
+
+		SQLite::Statement insertPlayer(db, "INSERT INTO Players (EOS_Id, Groups, TimedGroups) VALUES (?, ?, ?);");
+		for (int i = 0; i < options.Players; ++i)
+		{
+			players.emplace_back(EosId(i));
+
+			std::string playerGroups = "Default,";
+			const int count = Random(4);
+			for (int g = 0; g < count; ++g)
+				playerGroups += groups[Random(options.Groups)].ToString() + ",";
+
+			insertPlayer.bind(1, players.back().ToString());
+			insertPlayer.bind(2, playerGroups);
+			insertPlayer.bind(3, timedGroups());
+			insertPlayer.exec();
+			insertPlayer.reset();
+		}
+
+		SQLite::Statement insertTribe(db, "INSERT INTO Tribes (TribeId, Groups, TimedGroups) VALUES (?, ?, ?);");
+		for (int i = 0; i < options.Tribes; ++i)
+		{
+			tribeIds.push_back(100000 + i);
+
+			std::string tribeGroups;
+			const int count = Random(3);
+			for (int g = 0; g < count; ++g)
+				tribeGroups += groups[Random(options.Groups)].ToString() + ",";
+
+			insertTribe.bind(1, tribeIds.back());
+			insertTribe.bind(2, tribeGroups);
+			insertTribe.bind(3, timedGroups());
+			insertTribe.exec();
+			insertTribe.reset();
+		}
+
+		transaction.commit();
+	}
+
+	// The first players are online, about half of them in a tribe
+	void Connect()
+	{
+		auto& utils = AsaApi::GetApiUtils();
+		for (int i = 0; i < std::min(options.Online, options.Players); ++i)
+		{
+			auto pc = std::make_unique<AShooterPlayerController>();
+			pc->EosId = players[i];
+			pc->LinkedPlayerId = 1000 + i;
+			if (!tribeIds.empty() && i % 2 == 0)
+			{
+				auto tribe = std::make_unique<SyntheticTribe>();
+				tribe->Data.TribeId = tribeIds[Random(static_cast<int>(tribeIds.size()))];
+				tribe->Data.Members.Add(pc->LinkedPlayerId);
+				pc->Tribe = &tribe->Data;
+				onlineTribes.push_back(std::move(tribe));
+			}
+			utils.online.push_back(pc.get());
+			presence.emplace(pc->EosId, Permissions::OnlinePlayer{ pc.get(), pc->LinkedPlayerId, pc->Tribe ? pc->Tribe->TribeId : 0 });
+			Permissions::database->SetPlayerOnline(pc->EosId, true);
+			onlineControllers.push_back(std::move(pc));
+		}
+	}
+
+	// Stand-ins for plugins like ArkShop that hand out groups through callbacks
+	void RegisterCallbacks()
+	{
+		for (int i = 0; i < options.Callbacks; ++i)
+		{
+			const FString group = FString::Format("Callback{}", i);
+			auto callback = [group](const FString& eos_id, int*)
+				{
+					TArray<FString> result;
+					if (FStringHash()(eos_id) % 10 == 0)
+						result.Add(group);
+					return result;
+				};
+
+			// Every other callback is left uncached, like plugins registered before callback caching existed
+			if (i % 2 == 0)
+				Permissions::AddPlayerPermissionCallback(group, true, true, false, Permissions::Cache::CallbackCacheMs, callback);
+			else
+				Permissions::AddPlayerPermissionCallback(group, false, false, false, 0, callback);
+		}
+	}
+
+	struct Result {
+		std::string Name;
+		std::vector<uint64_t> Nanos;
+		uint64_t Allocations;
+		uint64_t Bytes;
+	};
+
+	std::vector<Result> results;
+
+	// Times fn(i) call by call, the clock reads add a few tens of nanoseconds to each sample
+	template <typename Fn>
+	void Measure(const std::string& name, int iterations, Fn&& fn)
+	{
+		Result result{ name, {}, 0, 0 };
+		result.Nanos.reserve(iterations);
+
+		const uint64_t allocationsBefore = allocations.load();
+		const uint64_t bytesBefore = allocatedBytes.load();
+		for (int i = 0; i < iterations; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			fn(i);
+			const auto end = std::chrono::steady_clock::now();
+			result.Nanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+		// The samples vector was reserved up front, so everything counted here came from fn
+		result.Allocations = allocations.load() - allocationsBefore;
+		result.Bytes = allocatedBytes.load() - bytesBefore;
+
+		results.push_back(std::move(result));
+	}
+
+	// Middle sample of a workload measured earlier
+	uint64_t Median(const std::string& name)
+	{
+		const auto result = std::find_if(results.begin(), results.end(), [&name](const Result& result) { return result.Name == name; });
+		std::vector<uint64_t> nanos = result->Nanos;
+		std::nth_element(nanos.begin(), nanos.begin() + nanos.size() / 2, nanos.end());
+		return nanos[nanos.size() / 2];
+	}
+
+	void Report()
+	{
+		std::printf("\n%-36s %9s %10s %10s %10s %10s %12s %10s %12s\n", "workload", "calls", "mean us", "p50 us", "p90 us", "p99 us", "max us", "allocs", "bytes");
+		for (auto& result : results)
+		{
+			auto& nanos = result.Nanos;
+			std::sort(nanos.begin(), nanos.end());
+			const size_t count = nanos.size();
+			auto percentile = [&](double p) { return nanos[std::min(count - 1, static_cast<size_t>(p * count))] / 1000.0; };
+
+			double total = 0;
+			for (const uint64_t sample : nanos)
+				total += sample;
+
+			std::printf("%-36s %9zu %10.3f %10.3f %10.3f %10.3f %12.3f %10.2f %12.1f\n", result.Name.c_str(), count,
+				total / count / 1000.0, percentile(0.50), percentile(0.90), percentile(0.99), nanos.back() / 1000.0,
+				static_cast<double>(result.Allocations) / count, static_cast<double>(result.Bytes) / count);
+		}
+	}
+
+	// Stands in for the PlayerLoads tick
+	void LoadPlayers()
+	{
+		Permissions::database->LoadRequestedPlayers();
+		Permissions::database->RunDeferredChanges();
+	}
+
+	// A group removed and added again in other case is shown the new way
+	void CheckGroupSpelling()
+	{
+		Permissions::AddGroup("benchcase");
+		Permissions::AddPlayerToGroup(players[0], "benchcase");
+		LoadPlayers();
+		Permissions::RemoveGroup("benchcase");
+		Permissions::AddGroup("BenchCase");
+		Permissions::AddPlayerToGroup(players[0], "BenchCase");
+		LoadPlayers();
+
+		bool listed = false;
+		for (const auto& group : Permissions::database->GetAllGroups())
+			listed = listed || group.Equals(L"BenchCase", ESearchCase::CaseSensitive);
+		bool member = false;
+		for (const auto& group : Permissions::GetPlayerGroups(players[0]))
+			member = member || group.Equals(L"BenchCase", ESearchCase::CaseSensitive);
+		if (!listed || !member)
+			std::printf("Re-created group BenchCase kept its old spelling\n");
+		Permissions::RemoveGroup("BenchCase");
+	}
+
+	// A callback group without a row (e.g. a Discord role) still counts as a membership
+	void CheckCallbackGroupWithoutRow()
+	{
+		const FString eos_id = players[0];
+		Permissions::AddPlayerPermissionCallback("BenchRole", false, false, false, 0, [eos_id](const FString& player, int*)
+			{
+				TArray<FString> result;
+				if (player == eos_id)
+					result.Add("BenchRole");
+				return result;
+			});
+		Permissions::Cache::Invalidate();
+
+		bool listed = false;
+		for (const auto& group : Permissions::GetPlayerGroups(eos_id))
+			listed = listed || group == L"BenchRole";
+		if (!listed || !Permissions::IsPlayerInGroup(eos_id, "BenchRole"))
+			std::printf("Callback group BenchRole without a row was dropped\n");
+		if (Permissions::groupNames.find("BenchRole") != GroupNameTable::Invalid)
+			std::printf("Callback group BenchRole without a row was interned\n");
+		Permissions::RemovePlayerPermissionCallback("BenchRole");
+		Permissions::Cache::Invalidate();
+	}
+
+	// Removing one timed group keeps the others, in the cache and in the stored row
+	void CheckTimedRemoval()
+	{
+		Permissions::AddGroup("BenchTimedA");
+		Permissions::AddGroup("BenchTimedB");
+		Permissions::AddPlayerToTimedGroup(players[0], "BenchTimedA", 3600, 0);
+		Permissions::AddPlayerToTimedGroup(players[0], "BenchTimedB", 3600, 0);
+		Permissions::RemovePlayerFromTimedGroup(players[0], "BenchTimedA");
+		LoadPlayers();
+		Permissions::FlushPendingWrites();
+
+		const auto cached = Permissions::GetPlayerGroups(players[0]);
+		SQLite::Database db(options.DbPath, SQLite::OPEN_READONLY);
+		SQLite::Statement query(db, options.Normalized ? "SELECT GroupName FROM PlayerGroups WHERE EOS_Id = ? AND Timed = 1;"
+			: "SELECT TimedGroups FROM Players WHERE EOS_Id = ?;");
+		query.bind(1, players[0].ToString());
+		FString stored;
+		while (query.executeStep())
+			stored += FString(query.getColumn(0).getText()) + ",";
+		if (cached.Contains("BenchTimedA") || !cached.Contains("BenchTimedB") || stored.Contains("BenchTimedA") || !stored.Contains("BenchTimedB"))
+			std::printf("Removing timed group BenchTimedA didn't leave just BenchTimedB\n");
+		Permissions::RemoveGroup("BenchTimedA");
+		Permissions::RemoveGroup("BenchTimedB");
+	}
+
+	size_t StoredRows()
+	{
+		SQLite::Database db(options.DbPath, SQLite::OPEN_READONLY);
+		return static_cast<size_t>(db.execAndGet("SELECT (SELECT COUNT(*) FROM Groups) + (SELECT COUNT(*) FROM Players) + (SELECT COUNT(*) FROM Tribes);").getInt64());
+	}
+
+	// Players that weren't loaded lose the removed group in their stored rows too
+	void CheckRemovedGroup(const FString& group)
+	{
+		SQLite::Database db(options.DbPath, SQLite::OPEN_READONLY);
+		SQLite::Statement query(db, options.Normalized ? "SELECT EOS_Id FROM PlayerGroups WHERE GroupName = ?;"
+			: "SELECT EOS_Id, Groups, TimedGroups FROM Players WHERE Groups LIKE ? OR TimedGroups LIKE ?;");
+		if (options.Normalized)
+			query.bind(1, group.ToString());
+		else
+		{
+			query.bind(1, "%" + group.ToString() + "%");
+			query.bind(2, "%" + group.ToString() + "%");
+		}
+
+		int remaining = 0;
+		while (query.executeStep())
+		{
+			if (options.Normalized)
+				++remaining;
+			else
+			{
+				const CachedPermission stored(query.getColumn(1).getText(), query.getColumn(2).getText());
+				if (stored.Groups.Contains(group) || stored.TimedGroups.Contains(TimedGroup{ group, 0, 0 }))
+					++remaining;
+			}
+		}
+		if (remaining > 0)
+			std::printf("%d stored players still hold removed group %s\n", remaining, group.ToString().c_str());
+	}
+
+	// Another connection commits change id n after n + 1 was already synced, the sync after that still applies it
+	void CheckLateChange()
+	{
+		FString child;
+		for (auto group = groups.rbegin(); group != groups.rend() && child.IsEmpty(); ++group)
+		{
+			if (Permissions::database->IsGroupExists(*group) && *group != groups[0])
+				child = *group;
+		}
+		if (child.IsEmpty())
+			return;
+
+		SQLite::Database db(options.DbPath, SQLite::OPEN_READWRITE);
+		const long long next = db.execAndGet("SELECT IFNULL(MAX(Id), 0) FROM PermissionChanges;").getInt64() + 1;
+		auto logChange = [&](long long id, const FString& group)
+			{
+				SQLite::Statement insert(db, "INSERT INTO PermissionChanges (Id, Kind, RowKey, ChangedAt) VALUES (?, 2, ?, ?);");
+				insert.bind(1, static_cast<int64_t>(id));
+				insert.bind(2, group.ToString());
+				insert.bind(3, static_cast<int64_t>(std::time(nullptr)));
+				insert.exec();
+			};
+
+		logChange(next + 1, groups[0]);
+		Permissions::database->SyncChanges();
+
+		const std::string parents = Permissions::GetGroupParents(child).Num() > 0 ? "" : groups[0].ToString() + ",";
+		SQLite::Statement update(db, "UPDATE Groups SET Parents = ? WHERE GroupName = ?;");
+		update.bind(1, parents);
+		update.bind(2, child.ToString());
+		update.exec();
+		logChange(next, child);
+		if (!Permissions::database->HasNewChanges())
+			std::printf("Late change %lld isn't reported as new\n", next);
+		Permissions::database->SyncChanges();
+
+		if ((Permissions::GetGroupParents(child).Num() > 0) != !parents.empty())
+			std::printf("Late change %lld to %s was skipped\n", next, child.ToString().c_str());
+	}
+
+	void Run()
+	{
+		const int iterations = options.Iterations;
+		auto randomPlayer = [&]() -> const FString& { return players[Random(options.Players)]; };
+		auto onlinePlayer = [&]() -> const FString& { return players[Random(static_cast<int>(onlineControllers.size()))]; };
+		auto randomGroup = [&]() -> const FString& { return groups[Random(options.Groups)]; };
+		auto randomPermission = [&]() -> const FString& { return permissions[Random(static_cast<int>(permissions.size()))]; };
+
+		Measure("SqlLite (open)", 1, [&](int)
+			{
+				Permissions::database = std::make_unique<SqlLite>(options.DbPath, options.Normalized);
+			});
+		Measure("SqlLite::Init", 5, [&](int)
+			{
+				Permissions::database->Init();
+			});
+
+		Connect();
+		RegisterCallbacks();
+		// Stands in for the tick that hands the players logging in to the pool
+		if (options.Lazy)
+		{
+			Measure("LoadRequestedPlayers (online)", 1, [&](int)
+				{
+					Permissions::database->LoadRequestedPlayers();
+				});
+		}
+
+		// Online players hit the resolved cache, random players are mostly resolved from scratch past its 4096 entries
+		Measure("IsPlayerHasPermission (online)", iterations, [&](int)
+			{
+				Permissions::IsPlayerHasPermission(onlinePlayer(), randomPermission());
+			});
+		Measure("IsPlayerHasPermission (random)", iterations, [&](int)
+			{
+				Permissions::IsPlayerHasPermission(randomPlayer(), randomPermission());
+			});
+		Measure("IsPlayerHasPermission (cold)", iterations / 10, [&](int)
+			{
+				Permissions::Cache::Invalidate();
+				Permissions::IsPlayerHasPermission(onlinePlayer(), randomPermission());
+			});
+		if (options.Lazy)
+		{
+			Measure("LoadRequestedPlayers (random)", 1, [&](int)
+				{
+					Permissions::database->LoadRequestedPlayers();
+				});
+		}
+		Measure("IsPlayerInGroup", iterations, [&](int)
+			{
+				Permissions::IsPlayerInGroup(randomPlayer(), randomGroup());
+			});
+		Measure("GetPlayerGroups", iterations, [&](int)
+			{
+				Permissions::GetPlayerGroups(randomPlayer());
+			});
+		// The timer that drops stale resolved players, everything cached above is stale after this
+		Permissions::Cache::Invalidate();
+		Measure("SweepResolvedPlayers", 2, [&](int)
+			{
+				Permissions::SweepResolvedPlayers();
+			});
+
+		TArray<FString> batch;
+		for (int i = 0; i < 8; ++i)
+			batch.Add(randomPermission());
+		Measure("IsPlayerHasPermissions (8)", iterations, [&](int)
+			{
+				Permissions::IsPlayerHasPermissions(onlinePlayer(), batch);
+			});
+
+		if (!tribeIds.empty())
+		{
+			Measure("IsTribeHasPermission", iterations, [&](int)
+				{
+					Permissions::IsTribeHasPermission(tribeIds[Random(static_cast<int>(tribeIds.size()))], randomPermission());
+				});
+		}
+
+		// Copies the group's member list, so fewer calls than the point lookups
+		Measure("GetGroupMembers", std::max(1, iterations / 100), [&](int)
+			{
+				Permissions::GetGroupMembers(randomGroup());
+			});
+		if (options.Lazy && options.Normalized)
+		{
+			// Players that aren't loaded are listed once the background read of the groups asked for above is in
+			LoadPlayers();
+			int unloaded = 0;
+			for (const auto& group : groups)
+			{
+				for (const auto& eos_id : Permissions::GetGroupMembers(group))
+					unloaded += Permissions::database->IsPlayerLoaded(eos_id) ? 0 : 1;
+			}
+			if (unloaded == 0)
+				std::printf("GetGroupMembers listed no player that isn't loaded\n");
+		}
+		Measure("GetOnlinePlayersWithPermission", std::max(1, iterations / 100), [&](int)
+			{
+				Permissions::GetOnlinePlayersWithPermission(randomPermission());
+			});
+
+		// Each parent added re-flattens the group and the ones below it, checks then cost the same at any depth
+		const int chain = std::min(options.Groups - 1, 16);
+		Measure("AddGroupParent", chain, [&](int i)
+			{
+				Permissions::AddGroupParent(groups[chain - i], groups[chain - i - 1]);
+			});
+		Measure("IsGroupHasPermission (inherited)", iterations, [&](int)
+			{
+				Permissions::IsGroupHasPermission(groups[chain], randomPermission());
+			});
+		for (const auto& permission : Permissions::GetGroupPermissions(groups[0]))
+		{
+			if (!Permissions::IsGroupHasPermission(groups[chain], permission))
+				std::printf("%s doesn't inherit %s from %s\n", groups[chain].ToString().c_str(), permission.ToString().c_str(), groups[0].ToString().c_str());
+		}
+		if (chain > 0 && !Permissions::AddGroupParent(groups[0], groups[chain]))
+			std::printf("Cycle through %s wasn't refused\n", groups[0].ToString().c_str());
+
+		// Mutations return once the caches are updated, the SQL is measured by the flush and the delta sync after it
+		const int mutations = std::max(1, iterations / 100);
+		Permissions::AddGroup("BenchGroup");
+		// Stands in for a plugin that re-reads the groups of whoever changed
+		Permissions::SubscribePermissionGroupUpdatedCallback("Bench", [](const FString& eos_id, int)
+			{
+				if (!eos_id.IsEmpty())
+					Permissions::GetPlayerGroups(eos_id);
+			});
+		Measure("AddPlayerToGroup", mutations, [&](int i)
+			{
+				Permissions::AddPlayerToGroup(players[i % options.Players], "BenchGroup");
+			});
+		Measure("AddPlayerToTimedGroup", mutations, [&](int i)
+			{
+				Permissions::AddPlayerToTimedGroup(players[i % options.Players], randomGroup(), 3600, 0);
+			});
+		Measure("RemovePlayerFromGroup", mutations, [&](int i)
+			{
+				Permissions::RemovePlayerFromGroup(players[i % options.Players], "BenchGroup");
+			});
+		// Lazy mode holds the changes to players that weren't loaded until the PlayerLoads tick brings them in
+		if (options.Lazy)
+		{
+			Measure("LoadRequestedPlayers (changes)", 1, [&](int)
+				{
+					Permissions::database->LoadRequestedPlayers();
+				});
+			Measure("RunDeferredChanges", 1, [&](int)
+				{
+					Permissions::database->RunDeferredChanges();
+				});
+		}
+		// Everything above lands in one tick, each player is reported once
+		Measure("DispatchGroupChanges", 1, [&](int)
+			{
+				Permissions::DispatchGroupChanges();
+			});
+		Permissions::UnSubscribePermissionGroupUpdatedCallback("Bench");
+		const FString removedGroup = randomGroup();
+		Measure("RemoveGroup", 1, [&](int)
+			{
+				Permissions::RemoveGroup(removedGroup);
+			});
+		Measure("FlushPendingWrites", 1, [&](int)
+			{
+				Permissions::FlushPendingWrites();
+			});
+		CheckRemovedGroup(removedGroup);
+		CheckGroupSpelling();
+		CheckCallbackGroupWithoutRow();
+		CheckTimedRemoval();
+		Measure("SyncChanges", 1, [&](int)
+			{
+				Permissions::database->SyncChanges();
+			});
+		Measure("HasNewChanges", 100, [&](int)
+			{
+				Permissions::database->HasNewChanges();
+			});
+		CheckLateChange();
+
+		// Parents have to survive the snapshot and the export round trips below
+		std::unordered_map<FString, TArray<FString>, FStringNoCaseHash, FStringNoCaseEqual> expectedParents;
+		auto parentsChanged = [&](const char* step)
+			{
+				for (const auto& group : groups)
+				{
+					auto before = expectedParents.find(group);
+					const TArray<FString> parents = Permissions::GetGroupParents(group);
+					if (before == expectedParents.end() ? parents.Num() != 0 : parents != before->second)
+						std::printf("%s changed the parents of %s\n", step, group.ToString().c_str());
+				}
+			};
+		for (const auto& group : groups)
+		{
+			const TArray<FString> parents = Permissions::GetGroupParents(group);
+			if (parents.Num() > 0)
+				expectedParents.emplace(group, parents);
+		}
+
+		// Warm start: what a restart costs when it can serve from the snapshot instead of reading every table
+		const std::string snapshotPath = options.DbPath + ".snapshot";
+		// The cold start on the same data, for the snapshot to beat
+		Measure("SqlLite::Init (again)", 5, [&](int)
+			{
+				Permissions::database->Init();
+			});
+		Measure("SaveSnapshot", 3, [&](int)
+			{
+				Permissions::Snapshot::Save(*Permissions::database, snapshotPath);
+			});
+		Measure("LoadSnapshot", 5, [&](int)
+			{
+				Permissions::Snapshot::Load(*Permissions::database, snapshotPath);
+			});
+		if (Median("LoadSnapshot") >= Median("SqlLite::Init (again)"))
+			std::printf("LoadSnapshot took %.1f ms, not faster than SqlLite::Init at %.1f ms\n", Median("LoadSnapshot") / 1e6,
+				Median("SqlLite::Init (again)") / 1e6);
+		Measure("Reconcile", 1, [&](int)
+			{
+				Permissions::Snapshot::Reconcile(*Permissions::database);
+			});
+		std::remove(snapshotPath.c_str());
+		parentsChanged("Snapshot");
+
+		size_t compactedPlayers = 0, compactedTribes = 0, compactedGroups = 0;
+		Measure("CompactTimedGroups", 1, [&](int)
+			{
+				Permissions::Compaction::CompactTimedGroups(*Permissions::database, compactedPlayers, compactedTribes, compactedGroups);
+			});
+		std::printf("Compaction removed %zu expired timed groups from %zu players and %zu tribes\n", compactedGroups, compactedPlayers, compactedTribes);
+
+		// Migration: everything out to a file and back in, each format once
+		for (const std::string extension : { ".jsonl", ".csv" })
+		{
+			const std::string transferPath = options.DbPath + ".export" + extension;
+			size_t exported = 0, imported = 0, skipped = 0;
+			Measure("Export (" + extension.substr(1) + ")", 1, [&](int)
+				{
+					Permissions::Transfer::Export(*Permissions::database, transferPath, exported);
+				});
+			Measure("Import (" + extension.substr(1) + ")", 1, [&](int)
+				{
+					Permissions::Transfer::Import(*Permissions::database, transferPath, imported, skipped);
+				});
+			if (exported != StoredRows())
+				std::printf("%s export wrote %zu of %zu stored rows\n", extension.c_str(), exported, StoredRows());
+			if (imported != exported || skipped != 0)
+				std::printf("%s round trip: exported %zu, imported %zu, skipped %zu\n", extension.c_str(), exported, imported, skipped);
+			parentsChanged(extension.c_str());
+			std::remove(transferPath.c_str());
+		}
+	}
+
+	void ParseArgs(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string arg = argv[i];
+			auto value = [&]() -> std::string
+				{
+					if (i + 1 >= argc)
+					{
+						std::fprintf(stderr, "%s needs a value\n", arg.c_str());
+						std::exit(1);
+					}
+					return argv[++i];
+				};
+
+			if (arg == "--players")
+				options.Players = std::stoi(value());
+			else if (arg == "--groups")
+				options.Groups = std::stoi(value());
+			else if (arg == "--tribes")
+				options.Tribes = std::stoi(value());
+			else if (arg == "--online")
+				options.Online = std::stoi(value());
+			else if (arg == "--iterations")
+				options.Iterations = std::stoi(value());
+			else if (arg == "--callbacks")
+				options.Callbacks = std::stoi(value());
+			else if (arg == "--db")
+				options.DbPath = value();
+			else if (arg == "--seed")
+				options.Seed = static_cast<unsigned>(std::stoul(value()));
+			else if (arg == "--normalized")
+				options.Normalized = true;
+			else if (arg == "--lazy")
+				options.Lazy = true;
+			else
+			{
+				std::fprintf(stderr, "Usage: PermissionsBench [--players N] [--groups N] [--tribes N] [--online N] [--iterations N] "
+					"[--callbacks N] [--db path] [--seed N] [--normalized] [--lazy]\n");
+				std::exit(arg == "--help" ? 0 : 1);
+			}
+		}
+
+		options.Players = std::max(options.Players, 1);
+		options.Groups = std::max(options.Groups, 1);
+		options.Iterations = std::max(options.Iterations, 10);
+		if (options.Tribes == 0)
+			options.Tribes = options.Players / 5;
+	}
+}
+
+// Provided by Main.cpp in the plugin, which needs the game
+namespace Permissions
+{
+	std::string GetDbPath()
+	{
+		return options.DbPath;
+	}
+
+	FTribeData* GetTribeData(AShooterPlayerController* playerController)
+	{
+		return playerController ? playerController->Tribe : nullptr;
+	}
+
+	TArray<FString> GetTribeDefaultGroups(FTribeData* tribeData)
+	{
+		TArray<FString> groups;
+		if (tribeData)
+		{
+			groups.Add(FString::Format("TribeSize:{}", tribeData->MembersPlayerDataIDField().Num()));
+			groups.Add(FString::Format("TribeOnline:{}", 1));
+		}
+		return groups;
+	}
+
+	void AddTribeDefaultGroups(FTribeData* tribeData, GroupSet& groups)
+	{
+		if (!tribeData)
+			return;
+
+		thread_local std::vector<GroupId> sizeGroups;
+		const int size = tribeData->MembersPlayerDataIDField().Num();
+		if (static_cast<size_t>(size) >= sizeGroups.size())
+			sizeGroups.resize(size + 1, GroupNameTable::Invalid);
+		if (sizeGroups[size] == GroupNameTable::Invalid)
+			sizeGroups[size] = Permissions::groupNames.intern(FString::Format("TribeSize:{}", size));
+		groups.AddUnique(sizeGroups[size]);
+		static const GroupId online = Permissions::groupNames.intern("TribeOnline:1");
+		groups.AddUnique(online);
+	}
+
+	bool FindOnlinePlayer(const FString& eos_id, OnlinePlayer& player)
+	{
+		auto iter = presence.find(eos_id);
+		if (iter == presence.end())
+			return false;
+
+		player = iter->second;
+		return true;
+	}
+
+	void GetOnlinePlayers(TArray<FString>& eos_ids, TArray<int>& tribe_ids)
+	{
+		for (const auto& player : presence)
+		{
+			eos_ids.Add(player.first);
+			tribe_ids.Add(player.second.TribeId);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	ParseArgs(argc, argv);
+	Permissions::Players::Lazy = options.Lazy;
+	rng.seed(options.Seed);
+	spdlog::set_level(spdlog::level::warn);
+
+	std::printf("players %d, groups %d, tribes %d, online %d, callbacks %d, %s schema, %s loading, %s\n", options.Players, options.Groups,
+		options.Tribes, options.Online, options.Callbacks, options.Normalized ? "normalized" : "legacy", options.Lazy ? "lazy" : "eager",
+		options.DbPath.c_str());
+
+	const auto start = std::chrono::steady_clock::now();
+	Populate();
+	std::printf("populated in %.1f ms\n", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	Run();
+	Report();
+
+	Permissions::database.reset();
+	return 0;
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+// Stand-ins for the parts of AsaApi the Permissions core uses, so it can be built and benchmarked without the game.
+// They behave like the real types where the plugin relies on it (FString compares case-insensitively, TArray lookups
+// are linear scans) and are not meant to be used for anything else.
+
+#ifndef _MSC_VER
+#define __declspec(x)
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cwctype>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/xchar.h>
+#include <spdlog/spdlog.h>
+
+using int32 = int32_t;
+using int64 = int64_t;
+using uint8 = uint8_t;
+using uint32 = uint32_t;
+using uint64 = uint64_t;
+using TCHAR = wchar_t;
+#define TEXT(x) L##x
+
+constexpr int32 INDEX_NONE = -1;
+
+namespace ESearchCase
+{
+	enum Type { CaseSensitive, IgnoreCase };
+}
+
+template <typename T>
+class TArray
+{
+public:
+	TArray() = default;
+	TArray(std::initializer_list<T> init) : data_(init) {}
+
+	int32 Num() const { return static_cast<int32>(data_.size()); }
+	bool IsEmpty() const { return data_.empty(); }
+	bool IsValidIndex(int32 index) const { return index >= 0 && index < Num(); }
+
+	int32 Add(const T& item) { data_.push_back(item); return Num() - 1; }
+	int32 Add(T&& item) { data_.push_back(std::move(item)); return Num() - 1; }
+	template <typename... Args>
+	int32 Emplace(Args&&... args) { data_.emplace_back(std::forward<Args>(args)...); return Num() - 1; }
+	int32 AddUnique(const T& item)
+	{
+		for (int32 i = 0; i < Num(); ++i)
+			if (data_[i] == item)
+				return i;
+		return Add(item);
+	}
+	void Append(const TArray& other) { data_.insert(data_.end(), other.data_.begin(), other.data_.end()); }
+	bool operator==(const TArray& other) const { return data_ == other.data_; }
+	bool operator!=(const TArray& other) const { return data_ != other.data_; }
+
+	template <typename K>
+	bool Contains(const K& item) const
+	{
+		for (const auto& e : data_)
+			if (e == item)
+				return true;
+		return false;
+	}
+	template <typename K>
+	T* FindByKey(const K& key)
+	{
+		for (auto& e : data_)
+			if (e == key)
+				return &e;
+		return nullptr;
+	}
+	template <typename K>
+	int32 Find(const K& key) const
+	{
+		for (int32 i = 0; i < Num(); ++i)
+			if (data_[i] == key)
+				return i;
+		return INDEX_NONE;
+	}
+	int32 Remove(const T& item)
+	{
+		const auto before = data_.size();
+		data_.erase(std::remove(data_.begin(), data_.end(), item), data_.end());
+		return static_cast<int32>(before - data_.size());
+	}
+	template <typename Pred>
+	int32 RemoveAll(Pred pred)
+	{
+		const auto before = data_.size();
+		data_.erase(std::remove_if(data_.begin(), data_.end(), pred), data_.end());
+		return static_cast<int32>(before - data_.size());
+	}
+	void RemoveAt(int32 index) { data_.erase(data_.begin() + index); }
+	void RemoveAtSwap(int32 index) { std::swap(data_[index], data_.back()); data_.pop_back(); }
+	void Reset() { data_.clear(); }
+	void Empty() { data_.clear(); }
+	void Reserve(int32 n) { data_.reserve(n); }
+
+	T& operator[](int32 i) { return data_[i]; }
+	const T& operator[](int32 i) const { return data_[i]; }
+	T* GetData() { return data_.data(); }
+	const T* GetData() const { return data_.data(); }
+
+	auto begin() { return data_.begin(); }
+	auto end() { return data_.end(); }
+	auto begin() const { return data_.begin(); }
+	auto end() const { return data_.end(); }
+
+private:
+	std::vector<T> data_;
+};
+
+class FString
+{
+public:
+	FString() = default;
+	FString(const wchar_t* s) : str_(s ? s : L"") {}
+	FString(const char* s) : FString(std::string(s ? s : "")) {}
+	FString(const std::string& s) : str_(s.begin(), s.end()) {}
+	explicit FString(std::wstring s) : str_(std::move(s)) {}
+
+	const wchar_t* operator*() const { return str_.c_str(); }
+	int32 Len() const { return static_cast<int32>(str_.size()); }
+	bool IsEmpty() const { return str_.empty(); }
+	std::string ToString() const { return std::string(str_.begin(), str_.end()); }
+
+	bool Equals(const FString& other, ESearchCase::Type search_case = ESearchCase::CaseSensitive) const
+	{
+		if (search_case == ESearchCase::CaseSensitive)
+			return str_ == other.str_;
+		if (str_.size() != other.str_.size())
+			return false;
+		for (size_t i = 0; i < str_.size(); ++i)
+			if (std::towlower(str_[i]) != std::towlower(other.str_[i]))
+				return false;
+		return true;
+	}
+	bool operator==(const FString& other) const { return Equals(other, ESearchCase::IgnoreCase); }
+	bool operator!=(const FString& other) const { return !(*this == other); }
+	bool operator==(const wchar_t* other) const { return *this == FString(other); }
+	bool operator==(const char* other) const { return *this == FString(other); }
+
+	FString& operator+=(const FString& other) { str_ += other.str_; return *this; }
+	FString& operator+=(const wchar_t* other) { str_ += other; return *this; }
+	FString& operator+=(const char* other) { return *this += FString(other); }
+	friend FString operator+(const FString& a, const FString& b) { return FString(a.str_ + b.str_); }
+	friend FString operator+(const FString& a, const wchar_t* b) { return FString(a.str_ + b); }
+	friend FString operator+(const FString& a, const char* b) { return a + FString(b); }
+	friend FString operator+(const char* a, const FString& b) { return FString(a) + b; }
+
+	TCHAR& operator[](int32 i) { return str_[i]; }
+	const TCHAR& operator[](int32 i) const { return str_[i]; }
+
+	bool Contains(const FString& sub) const { return str_.find(sub.str_) != std::wstring::npos; }
+	bool StartsWith(const FString& prefix) const { return str_.rfind(prefix.str_, 0) == 0; }
+	FString Mid(int32 start, int32 count = INT32_MAX) const { return FString(str_.substr(start, count)); }
+	FString Left(int32 count) const { return FString(str_.substr(0, count)); }
+	FString LeftChop(int32 count) const { return FString(str_.substr(0, str_.size() > (size_t)count ? str_.size() - count : 0)); }
+	bool EndsWith(const FString& suffix) const { return str_.size() >= suffix.str_.size() && FString(str_.substr(str_.size() - suffix.str_.size())) == suffix; }
+	FString ToLower() const
+	{
+		std::wstring s = str_;
+		for (auto& c : s)
+			c = static_cast<wchar_t>(std::towlower(c));
+		return FString(std::move(s));
+	}
+	void RemoveAt(int32 index, int32 count = 1) { str_.erase(index, count); }
+
+	int32 ParseIntoArray(TArray<FString>& out, const wchar_t* delim, bool cull_empty) const
+	{
+		out.Reset();
+		const std::wstring d(delim);
+		size_t start = 0;
+		while (true)
+		{
+			const size_t pos = str_.find(d, start);
+			std::wstring part = str_.substr(start, pos == std::wstring::npos ? std::wstring::npos : pos - start);
+			if (!cull_empty || !part.empty())
+				out.Add(FString(std::move(part)));
+			if (pos == std::wstring::npos)
+				break;
+			start = pos + d.size();
+		}
+		return out.Num();
+	}
+
+	template <typename... Args>
+	static FString Format(const char* format, Args&&... args)
+	{
+		return FString(fmt::format(fmt::runtime(format), std::forward<Args>(args)...));
+	}
+	template <typename... Args>
+	static FString Format(const wchar_t* format, Args&&... args)
+	{
+		return FString(fmt::format(fmt::runtime(format), std::forward<Args>(args)...));
+	}
+
+	const std::wstring& Native() const { return str_; }
+
+private:
+	std::wstring str_;
+};
+
+template <>
+struct fmt::formatter<FString> : fmt::formatter<std::string>
+{
+	auto format(const FString& s, format_context& ctx) const { return fmt::formatter<std::string>::format(s.ToString(), ctx); }
+};
+
+struct FStringHash
+{
+	std::size_t operator()(const FString& s) const { return std::hash<std::wstring>()(s.Native()); }
+};
+
+struct FStringEqual
+{
+	bool operator()(const FString& a, const FString& b) const { return a.Equals(b, ESearchCase::CaseSensitive); }
+};
+
+class Log
+{
+public:
+	static Log& Get() { static Log instance; return instance; }
+	static std::shared_ptr<spdlog::logger>& GetLog()
+	{
+		static std::shared_ptr<spdlog::logger> logger = spdlog::default_logger();
+		return logger;
+	}
+	void Init(const std::string&) {}
+};
+
+struct FTribeData
+{
+	int TribeId = 0;
+	TArray<uint64> Members;
+	int& TribeIDField() { return TribeId; }
+	TArray<uint64>& MembersPlayerDataIDField() { return Members; }
+};
+
+struct APlayerController {};
+struct AController {};
+struct AShooterPlayerController : APlayerController
+{
+	FString EosId;
+	uint64 LinkedPlayerId = 0;
+	FTribeData* Tribe = nullptr;
+	uint64 GetLinkedPlayerID() const { return LinkedPlayerId; }
+	void GetUniqueNetIdAsString(FString* out) const { *out = EosId; }
+};
+
+namespace AsaApi
+{
+	class IApiUtils
+	{
+	public:
+		// Controllers of the players the benchmark treats as online
+		std::vector<AShooterPlayerController*> online;
+
+		// Linear scan over the controllers like the engine's lookup
+		AShooterPlayerController* FindPlayerFromEOSID(const FString& eos_id) const
+		{
+			for (AShooterPlayerController* pc : online)
+				if (pc->EosId == eos_id)
+					return pc;
+			return nullptr;
+		}
+	};
+
+	inline IApiUtils& GetApiUtils()
+	{
+		static IApiUtils utils;
+		return utils;
+	}
+
+	namespace Tools
+	{
+		inline std::string GetCurrentDir() { return "."; }
+	}
+}
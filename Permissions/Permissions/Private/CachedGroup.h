@@ -0,0 +1,211 @@
+#pragma once
+#include "../Public/Permissions.h"
+
+inline std::size_t NoCaseHash(const TCHAR* chars, std::size_t len) noexcept {
+	std::size_t hash = 14695981039346656037ULL;
+	for (std::size_t i = 0; i < len; ++i) {
+		hash ^= static_cast<std::size_t>(towlower(chars[i]));
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Case-insensitive hashing/equality so lookups match FString::operator== (and the NOCASE columns) without allocating
+struct FStringNoCaseHash {
+	std::size_t operator()(const FString& str) const noexcept {
+		return NoCaseHash(*str, str.Len());
+	}
+};
+
+struct FStringNoCaseEqual {
+	bool operator()(const FString& a, const FString& b) const {
+		return a.Equals(b, ESearchCase::IgnoreCase);
+	}
+};
+
+// Same for string views, transparent so trie segments can be looked up without copying them out of the permission
+struct NoCaseViewHash {
+	using is_transparent = void;
+	std::size_t operator()(std::basic_string_view<TCHAR> str) const noexcept {
+		return NoCaseHash(str.data(), str.size());
+	}
+};
+
+struct NoCaseViewEqual {
+	using is_transparent = void;
+	bool operator()(std::basic_string_view<TCHAR> a, std::basic_string_view<TCHAR> b) const {
+		if (a.size() != b.size())
+			return false;
+		for (std::size_t i = 0; i < a.size(); ++i) {
+			if (towlower(a[i]) != towlower(b[i]))
+				return false;
+		}
+		return true;
+	}
+};
+
+/// <summary>
+/// Trie of dotted namespaces granted with a trailing wildcard ("Cheat.*", "ArkShop.Kits.*").
+/// A lookup walks one node per segment of the permission, independent of how many permissions the group has.
+/// </summary>
+class PermissionTrie {
+public:
+	// prefix is the namespace without the trailing ".*"
+	void add(const FString& prefix)
+	{
+		if (nodes.empty())
+			nodes.emplace_back();
+
+		const std::basic_string_view<TCHAR> path(*prefix, prefix.Len());
+		int node = 0;
+		std::size_t start = 0;
+		while (start <= path.size()) {
+			std::size_t end = path.find(TEXT('.'), start);
+			if (end == std::basic_string_view<TCHAR>::npos)
+				end = path.size();
+
+			const auto segment = path.substr(start, end - start);
+			auto child = nodes[node].Children.find(segment);
+			if (child == nodes[node].Children.end()) {
+				nodes.emplace_back();
+				child = nodes[node].Children.emplace(std::basic_string<TCHAR>(segment), static_cast<int>(nodes.size() - 1)).first;
+			}
+			node = child->second;
+			start = end + 1;
+		}
+		nodes[node].Wildcard = true;
+	}
+
+	bool matches(const FString& permission) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const std::basic_string_view<TCHAR> path(*permission, permission.Len());
+		int node = 0;
+		std::size_t start = 0;
+		while (start < path.size()) {
+			std::size_t end = path.find(TEXT('.'), start);
+			if (end == std::basic_string_view<TCHAR>::npos)
+				return false;
+
+			const auto child = nodes[node].Children.find(path.substr(start, end - start));
+			if (child == nodes[node].Children.end())
+				return false;
+
+			node = child->second;
+			// Only the namespace is granted, "Cheat.*" matches "Cheat.God" but not "Cheat"
+			if (nodes[node].Wildcard)
+				return true;
+			start = end + 1;
+		}
+		return false;
+	}
+
+	void clear()
+	{
+		nodes.clear();
+	}
+
+private:
+	struct Node {
+		bool Wildcard = false;
+		std::unordered_map<std::basic_string<TCHAR>, int, NoCaseViewHash, NoCaseViewEqual> Children;
+	};
+
+	// Index based so groups stay copyable, nodes[0] is the root
+	std::vector<Node> nodes;
+};
+
+class CachedGroup {
+public:
+	explicit CachedGroup() {}
+	CachedGroup(FString Permissions, FString Parents = "") {
+		TArray<FString> PermissionStrs;
+		Permissions.ParseIntoArray(PermissionStrs, L",", true);
+		for (const auto& permission : PermissionStrs)
+			addPermission(permission);
+		TArray<FString> ParentStrs;
+		Parents.ParseIntoArray(ParentStrs, L",", true);
+		for (const auto& parent : ParentStrs)
+			ParentList.AddUnique(parent);
+	}
+
+	// Kept in grant order for display and for writing the row back, only the group's own permissions
+	TArray<FString> PermissionList;
+	// Groups whose permissions this one inherits, in the order they were added
+	TArray<FString> ParentList;
+	// Own and inherited permissions, flattened so a check costs the same however deep the inheritance goes
+	std::unordered_set<FString, FStringNoCaseHash, FStringNoCaseEqual> PermissionIndex;
+	PermissionTrie NamespaceWildcards;
+	bool HasWildcard = false;
+
+	bool hasPermission(const FString& permission, bool allowWildcard) const
+	{
+		if (allowWildcard && HasWildcard)
+			return true;
+		if (PermissionIndex.find(permission) != PermissionIndex.end())
+			return true;
+		return allowWildcard && NamespaceWildcards.matches(permission);
+	}
+
+	bool hasOwnPermission(const FString& permission) const
+	{
+		// Not in the index means neither own nor inherited, the list is only scanned for the rest
+		return PermissionIndex.find(permission) != PermissionIndex.end() && PermissionList.Contains(permission);
+	}
+
+	void addPermission(const FString& permission)
+	{
+		if (hasOwnPermission(permission))
+			return;
+		PermissionList.Add(permission);
+		indexPermission(permission);
+	}
+
+	// Leaves the inherited permissions out until the group is flattened again
+	void removePermission(const FString& permission)
+	{
+		if (PermissionList.Remove(permission) == 0)
+			return;
+		flatten({});
+	}
+
+	// Rebuilds the effective permissions from the own ones and those of ancestors
+	void flatten(const std::vector<const CachedGroup*>& ancestors)
+	{
+		PermissionIndex.clear();
+		NamespaceWildcards.clear();
+		HasWildcard = false;
+		for (const auto& permission : PermissionList)
+			indexPermission(permission);
+		for (const CachedGroup* ancestor : ancestors) {
+			for (const auto& permission : ancestor->PermissionList)
+				indexPermission(permission);
+		}
+	}
+
+	static bool isNamespaceWildcard(const FString& permission)
+	{
+		return permission.Len() > 2 && permission.EndsWith(".*");
+	}
+
+	FString getPermissionsStr() const
+	{
+		FString result;
+		for (const auto& permission : PermissionList)
+			result += permission + ",";
+		return result;
+	}
+
+private:
+	void indexPermission(const FString& permission)
+	{
+		if (!PermissionIndex.insert(permission).second)
+			return;
+		if (permission == "*")
+			HasWildcard = true;
+		else if (isNamespaceWildcard(permission))
+			NamespaceWildcards.add(permission.LeftChop(2));
+	}
+};
@@ -1,64 +1,118 @@
 #pragma once
 #include "../Public/Permissions.h"
+#include "GroupNames.h"
 
 struct TimedGroup {
-	FString GroupName;
-	long long DelayUntilTime, ExpireAtTime;
+	TimedGroup() = default;
+	TimedGroup(const FString& groupName, long long delayUntilTime, long long expireAtTime)
+		: Group(Permissions::groupNames.intern(groupName)), DelayUntilTime(delayUntilTime), ExpireAtTime(expireAtTime)
+	{
+	}
+
+	TimedGroup(GroupId group, long long delayUntilTime, long long expireAtTime)
+		: Group(group), DelayUntilTime(delayUntilTime), ExpireAtTime(expireAtTime)
+	{
+	}
+
+	GroupId Group = GroupNameTable::Invalid;
+	long long DelayUntilTime = 0, ExpireAtTime = 0;
+
+	const FString& GroupName() const {
+		return Permissions::groupNames.name(Group);
+	}
 
 	bool operator==(const TimedGroup& other) const {
-		return GroupName == other.GroupName;
+		return Group == other.Group;
 	}
 
 	bool operator==(const FString& groupName) const {
-		return GroupName == groupName;
+		return Group == Permissions::groupNames.find(groupName);
 	}
 };
 class CachedPermission {
 public:
 	explicit CachedPermission() {}
 	CachedPermission(FString Permissions, FString TimedPermissions) {
-		Permissions.ParseIntoArray(Groups, L",", true);
+		TArray<FString> GroupStrs;
+		Permissions.ParseIntoArray(GroupStrs, L",", true);
+		for (const auto& GroupStr : GroupStrs)
+			Groups.Add(GroupStr);
 		TArray<FString> TimedGroupStrs;
 		TimedPermissions.ParseIntoArray(TimedGroupStrs, L",", true);
 		for (auto GroupStr : TimedGroupStrs) {
 			TArray<FString> GroupParts;
 			GroupStr.ParseIntoArray(GroupParts, L";", true);
-			TimedGroup Group;
-			Group.GroupName = GroupParts[2];
+			long long DelayUntilTime = 0, ExpireAtTime = 0;
 			try
 			{
-				Group.DelayUntilTime = std::stoull(*GroupParts[0]);
-				Group.ExpireAtTime = std::stoull(*GroupParts[1]);
+				DelayUntilTime = std::stoull(*GroupParts[0]);
+				ExpireAtTime = std::stoull(*GroupParts[1]);
 			}
 			catch (const std::exception& exception)
 			{
 				Log::GetLog()->error("({} {}) Parsing error {}", __FILE__, __FUNCTION__, exception.what());
 			}
-			TimedGroups.Add(Group);
+			TimedGroups.Add(TimedGroup(GroupParts[2], DelayUntilTime, ExpireAtTime));
 		}
 	}
-	TArray<FString> Groups;
+	// Interned, see GroupNameTable
+	GroupSet Groups;
 	TArray<TimedGroup> TimedGroups;
-	TArray<FString> CallbackGroups;
-	bool hasCheckedCallbacks;
 
-	TArray<FString> getGroups(long long now) 
+	// Default, the permanent groups and the timed groups active at now, without duplicates
+	GroupSet getGroupIds(long long now) const
+	{
+		GroupSet result;
+		addGroupIds(now, result);
+		return result;
+	}
+
+	// getGroupIds() into a set the caller reuses, groups it already holds aren't added twice
+	void addGroupIds(long long now, GroupSet& result) const
 	{
-		TArray<FString> result{ "Default" };
-		for (auto group : Groups) result.AddUnique(group);
-		for (auto group : TimedGroups) {
+		static const GroupId defaultGroup = Permissions::groupNames.intern("Default");
+		result.AddUnique(defaultGroup);
+		for (const auto group : Groups.Ids()) result.AddUnique(group);
+		for (const auto& group : TimedGroups) {
 			if (group.DelayUntilTime > 0 && now < group.DelayUntilTime) {
 				continue;
 			}
 			if (group.ExpireAtTime > 0 && now < group.ExpireAtTime) {
-				result.AddUnique(group.GroupName);
+				result.AddUnique(group.Group);
 			}
 		}
+	}
 
-		return result;
+	TArray<FString> getGroups(long long now) const
+	{
+		return getGroupIds(now).ToArray();
+	}
+
+	void addMembership(const FString& group, bool timed, long long delayUntil, long long expireAt)
+	{
+		if (timed)
+			TimedGroups.Add(TimedGroup(group, delayUntil, expireAt));
+		else
+			Groups.AddUnique(group);
+	}
+
+	// Earliest future activation or expiry of a timed group, 0 if nothing is pending
+	long long getNextBoundary(long long now) const
+	{
+		long long next = 0;
+		for (const auto& group : TimedGroups) {
+			long long boundary = 0;
+			if (group.DelayUntilTime > now)
+				boundary = group.DelayUntilTime;
+			else if (group.ExpireAtTime > now)
+				boundary = group.ExpireAtTime;
+			if (boundary > 0 && (next == 0 || boundary < next))
+				next = boundary;
+		}
+		return next;
 	}
 
-	FString getGroupsStr(long long now) 
+	FString getGroupsStr(long long now) const
 	{
 		FString result;
 		auto groups = getGroups(now);
@@ -0,0 +1,119 @@
+#pragma once
+#include "../Public/Permissions.h"
+#include "GroupNames.h"
+
+namespace Permissions::Cache
+{
+	// TTL used for callbacks registered without one
+	inline int CallbackCacheMs = 60000;
+}
+
+// Names the group table knows go into groups by id, the rest are kept as names. Callbacks may tag players with groups
+// that have no row (e.g. Discord roles), interning those would take table slots for good
+inline void AddCallbackGroup(const FString& group, GroupSet& groups, TArray<FString>& names)
+{
+	const GroupId id = Permissions::groupNames.find(group);
+	if (id != GroupNameTable::Invalid)
+		groups.AddUnique(id);
+	else if (!names.Contains(group))
+		names.Add(group);
+}
+
+/// <summary>
+/// Groups returned by one permission callback, cached per player and per tribe until the callback's TTL runs out
+/// or the owning plugin invalidates them. Known groups are kept as ids, a hit adds them to the resolved set without
+/// copying names. Unknown ones are looked up again on each hit, a group created meanwhile then resolves by id.
+/// </summary>
+class CallbackResultCache {
+public:
+	bool findPlayer(const FString& eos_id, std::chrono::steady_clock::time_point now, GroupSet& groups, TArray<FString>& names)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return find(playerResults, eos_id, now, groups, names);
+	}
+
+	bool findTribe(int tribeId, std::chrono::steady_clock::time_point now, GroupSet& groups, TArray<FString>& names)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return find(tribeResults, tribeId, now, groups, names);
+	}
+
+	void storePlayer(const FString& eos_id, const TArray<FString>& groups, std::chrono::steady_clock::time_point expiresAt)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		playerResults[eos_id] = MakeEntry(groups, expiresAt);
+	}
+
+	void storeTribe(int tribeId, const TArray<FString>& groups, std::chrono::steady_clock::time_point expiresAt)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		tribeResults[tribeId] = MakeEntry(groups, expiresAt);
+	}
+
+	void invalidatePlayer(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		playerResults.erase(eos_id);
+	}
+
+	void invalidateTribe(int tribeId)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		tribeResults.erase(tribeId);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		playerResults.clear();
+		tribeResults.clear();
+	}
+
+	// Drops expired entries so players that left don't accumulate
+	void prune(std::chrono::steady_clock::time_point now)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		std::erase_if(playerResults, [now](const auto& entry) { return entry.second.ExpiresAt <= now; });
+		std::erase_if(tribeResults, [now](const auto& entry) { return entry.second.ExpiresAt <= now; });
+	}
+
+private:
+	struct Entry {
+		GroupSet Groups;
+		TArray<FString> Names;
+		std::chrono::steady_clock::time_point ExpiresAt;
+	};
+
+	static Entry MakeEntry(const TArray<FString>& groups, std::chrono::steady_clock::time_point expiresAt)
+	{
+		Entry entry;
+		for (const auto& group : groups)
+			AddCallbackGroup(group, entry.Groups, entry.Names);
+		entry.ExpiresAt = expiresAt;
+		return entry;
+	}
+
+	// Adds the cached groups to groups and names
+	template <typename Map, typename Key>
+	static bool find(Map& results, const Key& key, std::chrono::steady_clock::time_point now, GroupSet& groups, TArray<FString>& names)
+	{
+		auto iter = results.find(key);
+		if (iter == results.end())
+			return false;
+
+		if (iter->second.ExpiresAt <= now) {
+			results.erase(iter);
+			return false;
+		}
+
+		for (const auto group : iter->second.Groups.Ids())
+			groups.AddUnique(group);
+		for (const auto& name : iter->second.Names)
+			AddCallbackGroup(name, groups, names);
+		return true;
+	}
+
+	std::mutex mutex;
+	std::unordered_map<FString, Entry, FStringHash, FStringEqual> playerResults;
+	std::unordered_map<int, Entry> tribeResults;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <algorithm>
+#include <ctime>
+#include <map>
+
+/// <summary>
+/// Position in the change log. Change ids are handed out when a row is inserted but become visible when its
+/// transaction commits, so with pooled connections, batched flushes and several servers on one database a higher id
+/// can show up before a lower one. Ids skipped over are kept as gaps and looked for again on every sync until they
+/// appear or GapTimeoutSecs pass (an id of a rolled back transaction never appears).
+/// </summary>
+class ChangeCursor {
+public:
+	// Longer than any write transaction runs, a change committed later than that is only seen by a full reload
+	static constexpr long long GapTimeoutSecs = 120;
+	// Ids below the highest one that a fresh cursor treats as possibly uncommitted, see Init
+	static constexpr long long RecentIds = 1000;
+
+	ChangeCursor() = default;
+
+	explicit ChangeCursor(long long watermark)
+		: watermark(watermark)
+	{
+	}
+
+	// Highest id seen
+	long long Watermark() const
+	{
+		return watermark;
+	}
+
+	// Syncs read the ids above this, it is below the oldest gap while there are any
+	long long ScanFrom() const
+	{
+		return gaps.empty() ? watermark : gaps.begin()->first - 1;
+	}
+
+	bool HasGaps() const
+	{
+		return !gaps.empty();
+	}
+
+	/// <summary>
+	/// Called for each id read from ScanFrom() on, in ascending order. True if the change hasn't been applied yet,
+	/// either past the watermark or filling a gap.
+	/// </summary>
+	bool See(long long id, time_t now)
+	{
+		if (id <= watermark)
+			return gaps.erase(id) > 0;
+
+		// A jump of more than MaxGaps is a reset sequence or an increment step, not transactions in flight
+		for (long long missing = std::max(watermark + 1, id - MaxGaps); missing < id; ++missing)
+			gaps.emplace(missing, now);
+		watermark = id;
+		while (gaps.size() > static_cast<size_t>(MaxGaps))
+			gaps.erase(gaps.begin());
+		return true;
+	}
+
+	// Gives up on the ids missing for longer than GapTimeoutSecs
+	void Expire(time_t now)
+	{
+		std::erase_if(gaps, [now](const auto& gap)
+			{
+				return now - gap.second > GapTimeoutSecs;
+			});
+	}
+
+private:
+	static constexpr long long MaxGaps = 10000;
+
+	long long watermark = 0;
+	// Missing id and when it was first missed
+	std::map<long long, time_t> gaps;
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Database/IDatabase.h"
+#include "Stats.h"
+
+namespace Permissions::Compaction
+{
+	// Seconds between removals of expired timed memberships from the database and the caches, 0 turns it off
+	inline int IntervalSecs = 3600;
+	// Rows written per transaction
+	constexpr size_t BatchRows = 500;
+	// Only memberships that expired at least this long ago are removed, their expiry has been reported by then
+	constexpr long long GraceSecs = 300;
+
+	// Queues the deletes for one batch of rows and flushes them together, then drops the same entries from the caches
+	inline std::optional<std::string> CompactTimedGroupBatch(IDatabase& database, ChangeKind kind, const std::vector<std::string>& keys, long long expiredBefore)
+	{
+		std::vector<IDatabase::PendingWrite> writes;
+		writes.reserve(keys.size());
+		for (const auto& key : keys)
+		{
+			// A slot of its own, a queued membership change of the row must not be superseded by it
+			writes.push_back(IDatabase::PendingWrite{ kind, key, "CompactTimedGroups", [&database, kind, key, expiredBefore]()
+				{
+					database.DeleteExpiredTimedGroups(kind, key, expiredBefore);
+				} });
+		}
+		auto error = database.QueueWrites(std::move(writes));
+		if (!error && Permissions::Writes::Async)
+			error = database.FlushWrites();
+		if (error)
+			return error;
+
+		const long long now = std::time(nullptr);
+		if (kind == ChangeKind::Player)
+		{
+			std::vector<FString> players;
+			players.reserve(keys.size());
+			for (const auto& key : keys)
+				players.emplace_back(key.c_str());
+
+			// Players evicted meanwhile (lazy mode) stay evicted
+			database.permissionPlayers.updateExisting(players, [&database, expiredBefore, now](const FString& eos_id, CachedPermission& cached)
+				{
+					if (IDatabase::RemoveExpiredTimedGroups(cached.TimedGroups, expiredBefore) == 0)
+						return;
+					database.groupMembers.setPlayer(eos_id, cached);
+					database.timedScheduler.SchedulePlayer(eos_id, cached.TimedGroups, now);
+				});
+		}
+		else
+		{
+			std::vector<int> tribes;
+			tribes.reserve(keys.size());
+			for (const auto& key : keys)
+				tribes.push_back(std::stoi(key));
+
+			database.permissionTribes.updateExisting(tribes, [&database, expiredBefore, now](int tribeId, CachedPermission& cached)
+				{
+					if (IDatabase::RemoveExpiredTimedGroups(cached.TimedGroups, expiredBefore) > 0)
+						database.timedScheduler.ScheduleTribe(tribeId, cached.TimedGroups, now);
+				});
+		}
+		// Expired memberships don't count towards the resolved groups, the resolved cache stays valid
+		return {};
+	}
+
+	/// <summary>
+	/// Removes timed memberships that expired more than GraceSecs ago from the database and the caches,
+	/// getGroups skips them already so nothing resolves differently. Rows are written through the write queue in
+	/// transactions of BatchRows. Lazy mode pages through the stored players, only some of them are cached.
+	/// </summary>
+	inline std::optional<std::string> CompactTimedGroups(IDatabase& database, size_t& players, size_t& tribes, size_t& removed)
+	{
+		static auto& compactStat = Stats::Timer("TimedGroups.Compact");
+		static auto& removedGroups = Stats::Counter("TimedGroups.Compact removed");
+		Stats::ScopedTimer timer(compactStat);
+
+		const long long expiredBefore = std::time(nullptr) - GraceSecs;
+		try
+		{
+			// Keeps a sync from replacing the caches between the scan and the update
+			std::lock_guard<std::mutex> syncLock(database.syncMutex);
+
+			// Key and number of expired memberships of each row to compact
+			std::vector<std::pair<std::string, int>> expiredPlayers, expiredTribes;
+			auto collect = [expiredBefore](std::vector<std::pair<std::string, int>>& rows, std::string key, const CachedPermission& permission)
+				{
+					if (const int count = IDatabase::CountExpiredTimedGroups(permission.TimedGroups, expiredBefore); count > 0)
+						rows.emplace_back(std::move(key), count);
+				};
+
+			auto compact = [&](ChangeKind kind, const std::vector<std::pair<std::string, int>>& rows, size_t& compacted) -> std::optional<std::string>
+				{
+					for (size_t start = 0; start < rows.size(); start += BatchRows)
+					{
+						std::vector<std::string> batch;
+						size_t batchRemoved = 0;
+						for (size_t i = start; i < std::min(rows.size(), start + BatchRows); ++i)
+						{
+							batch.push_back(rows[i].first);
+							batchRemoved += rows[i].second;
+						}
+
+						if (auto error = CompactTimedGroupBatch(database, kind, batch, expiredBefore))
+							return error;
+						compacted += batch.size();
+						removed += batchRemoved;
+						removedGroups.add(batchRemoved);
+					}
+					return {};
+				};
+
+			if (Permissions::Players::Lazy)
+			{
+				// A page of stored rows at a time, most players aren't cached and the table can be large
+				std::string after;
+				bool more = true;
+				while (more)
+				{
+					expiredPlayers.clear();
+					{
+						std::lock_guard<std::mutex> flushLock(database.flushMutex);
+						database.FlushWritesLocked();
+						more = database.ReadExpiredPlayers(after, BatchRows, expiredBefore, expiredPlayers);
+					}
+					if (auto error = compact(ChangeKind::Player, expiredPlayers, players))
+						return error;
+				}
+			}
+			else
+			{
+				database.permissionPlayers.forEach([&](const FString& eos_id, const CachedPermission& permission)
+					{
+						collect(expiredPlayers, eos_id.ToString(), permission);
+					});
+				if (auto error = compact(ChangeKind::Player, expiredPlayers, players))
+					return error;
+			}
+
+			database.permissionTribes.forEach([&](int tribeId, const CachedPermission& permission)
+				{
+					collect(expiredTribes, std::to_string(tribeId), permission);
+				});
+			if (auto error = compact(ChangeKind::Tribe, expiredTribes, tribes))
+				return error;
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return exception.what();
+		}
+
+		return {};
+	}
+}
@@ -1,16 +1,799 @@
 #pragma once
 
 #include "../CachedPermission.h"
+#include "../CachedGroup.h"
+#include "../ChangeCursor.h"
+#include "../GroupInheritance.h"
+#include "../ResolvedCache.h"
+#include "../TimedGroupScheduler.h"
+#include "../SnapshotMap.h"
+#include "../GroupMemberIndex.h"
+#include "../PlayerResidency.h"
+#include "../WriteBehindQueue.h"
+#include "../Stats.h"
 #include "../Public/Permissions.h"
 #include "API/ARK/Other.h"
 
+// Row types recorded in the change log so other servers can reload just what changed
+enum class ChangeKind
+{
+	Player = 0,
+	Tribe = 1,
+	Group = 2
+};
+
+class IDatabase;
+
+// Snapshot files of the caches, see Snapshot.h
+namespace Permissions::Snapshot
+{
+	inline bool Save(IDatabase& database, const std::string& path);
+	inline bool Load(IDatabase& database, const std::string& path);
+	inline void Reconcile(IDatabase& database);
+}
+
+// Export and import files, see Transfer.h
+namespace Permissions::Transfer
+{
+	struct Record;
+	inline std::optional<std::string> Export(IDatabase& database, const std::string& path, size_t& exported);
+	inline void ImportChunk(IDatabase& database, const std::vector<Record>& chunk);
+	inline std::optional<std::string> Import(IDatabase& database, const std::string& path, size_t& imported, size_t& skipped);
+}
+
+// Removal of expired timed memberships, see Compaction.h
+namespace Permissions::Compaction
+{
+	inline std::optional<std::string> CompactTimedGroupBatch(IDatabase& database, ChangeKind kind, const std::vector<std::string>& keys, long long expiredBefore);
+	inline std::optional<std::string> CompactTimedGroups(IDatabase& database, size_t& players, size_t& tribes, size_t& removed);
+}
+
 class IDatabase
 {
+	friend bool Permissions::Snapshot::Save(IDatabase& database, const std::string& path);
+	friend bool Permissions::Snapshot::Load(IDatabase& database, const std::string& path);
+	friend void Permissions::Snapshot::Reconcile(IDatabase& database);
+	friend std::optional<std::string> Permissions::Transfer::Export(IDatabase& database, const std::string& path, size_t& exported);
+	friend void Permissions::Transfer::ImportChunk(IDatabase& database, const std::vector<Permissions::Transfer::Record>& chunk);
+	friend std::optional<std::string> Permissions::Transfer::Import(IDatabase& database, const std::string& path, size_t& imported, size_t& skipped);
+	friend std::optional<std::string> Permissions::Compaction::CompactTimedGroupBatch(IDatabase& database, ChangeKind kind, const std::vector<std::string>& keys, long long expiredBefore);
+	friend std::optional<std::string> Permissions::Compaction::CompactTimedGroups(IDatabase& database, size_t& players, size_t& tribes, size_t& removed);
+
 protected:
-	std::unordered_map<std::string, std::string> permissionGroups;
-	std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> permissionPlayers;
-	std::unordered_map<int, CachedPermission> permissionTribes;
-	std::mutex playersMutex, groupsMutex, tribesMutex;
+	// Read from the game thread without waiting on writers, they publish a new version (see SnapshotMap). Groups are
+	// written through SetGroup/UpdateGroup/EraseGroup/AssignGroups, which keep the inherited permissions flattened
+	SnapshotMap<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> permissionGroups;
+	// The same entries by interned name (see GroupNameTable), checks resolve players to ids and look groups up by them
+	SnapshotMap<GroupId, CachedGroup> groupsById;
+	SnapshotMap<FString, CachedPermission, FStringHash, FStringEqual> permissionPlayers;
+	SnapshotMap<int, CachedPermission> permissionTribes;
+	// Written through SetPlayer/UpdatePlayer/ErasePlayer/AssignPlayers together with permissionPlayers
+	GroupMemberIndex groupMembers;
+	// Loaded player rows in lazy mode (Permissions::Players::Lazy)
+	PlayerResidency residency;
+
+	// Change log ids already applied to the caches, guarded by syncMutex
+	ChangeCursor changeCursor;
+	time_t lastChangePrune = 0;
+	std::mutex syncMutex;
+	// Lazy mode, players checks asked for that LoadRequestedPlayers hasn't read yet, and the ones it is reading
+	std::mutex loadRequestMutex;
+	std::unordered_set<FString, FStringHash, FStringEqual> requestedPlayers;
+	std::unordered_set<FString, FStringHash, FStringEqual> loadingPlayers;
+	// Lazy mode, stored members of the groups GetGroupMembers was asked for and the groups to read again. Read by
+	// LoadRequestedGroupMembers on the pool, so listing members never queries from the game thread
+	struct StoredMembers {
+		// Empty with the legacy schema, it has no index to read them from
+		std::shared_ptr<const TArray<FString>> EosIds;
+		long long ReadAt = 0;
+	};
+	std::unordered_map<FString, StoredMembers, FStringNoCaseHash, FStringNoCaseEqual> storedMembers;
+	std::unordered_set<FString, FStringNoCaseHash, FStringNoCaseEqual> requestedMemberGroups;
+	// Lazy mode, changes to players that weren't loaded yet in the order they were made, see DeferPlayerChange
+	std::unordered_map<FString, std::vector<std::function<void()>>, FStringHash, FStringEqual> deferredChanges;
+	// Held while loaded rows are put into the cache, see AdoptPlayers
+	std::mutex playerLoadMutex;
+	// Guards flushing the write queue, taken after syncMutex when both are needed
+	std::mutex flushMutex;
+	// Serializes the group cache writes, taken last and never held while queueing writes
+	std::mutex groupMutex;
+
+	// Above this many pending changes a full reload is cheaper than row-by-row refetching
+	static constexpr int MaxDeltaChanges = 5000;
+	static constexpr int ChangeLogRetentionSecs = 86400;
+	// Stored members older than this are read again the next time the group is listed
+	static constexpr int StoredMembersSecs = 30;
+
+	// Activation/expiry boundaries of every cached timed group, kept in step with the player and tribe caches
+	TimedGroupScheduler timedScheduler;
+
+	// Mutations update the caches right away and leave the SQL to the background writer
+	WriteBehindQueue writeQueue;
+
+	using PlayerRows = std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual>;
+	using GroupRows = std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual>;
+
+	// Runs in the transaction of the write it records and throws on failure, so the write is rolled back and retried
+	// rather than stored without other servers hearing about it
+	virtual void LogChange(ChangeKind kind, const std::string& key) = 0;
+	// Lazy mode, called without syncMutex or flushMutex held
+	virtual PlayerRows LoadPlayerRows(const std::unordered_set<std::string>& players) = 0;
+	// Lazy mode, players whose stored row holds group permanently or through a timed membership active at now, read
+	// from the PlayerGroups index without loading their rows. Nothing with the legacy schema, it has no such index.
+	// Runs on the pool, see LoadRequestedGroupMembers
+	virtual std::optional<TArray<FString>> LoadGroupMemberIds(const FString& group, long long now) = 0;
+	// Lazy mode, RemoveGroup drops group from the stored row of every player, also those not loaded, and logs a change
+	// for each row it changed. Runs from the write queue
+	virtual void DeleteGroupMemberships(const FString& group) = 0;
+	// Runs body in one transaction, rolls back and rethrows if it throws
+	virtual void RunInTransaction(const std::function<void()>& body) = 0;
+	// Highest change log id stored in the database
+	virtual long long GetChangeWatermark() = 0;
+	// Calls fn(id, kind, key) for every change log entry with an id above after, in id order
+	virtual void ReadChanges(long long after, const std::function<void(long long, ChangeKind, const std::string&)>& fn) = 0;
+	// Names the database the caches come from, a snapshot of another database is ignored
+	virtual std::string GetSnapshotIdentity() = 0;
+	// Bulk import, replace the stored row and its memberships or permissions. Run inside RunInTransaction with
+	// flushMutex held, the caches are left alone and reloaded once the import is done
+	virtual void ImportGroupRow(const FString& group, const TArray<FString>& permissions, const TArray<FString>& parents) = 0;
+	virtual void ImportPlayerRow(const FString& eos_id, const CachedPermission& permission) = 0;
+	virtual void ImportTribeRow(int tribeId, const CachedPermission& permission) = 0;
+	// Compaction, drops the timed memberships of a player or tribe row that expired at or before expiredBefore. Runs
+	// from the write queue after the writes queued ahead of it and checks the stored row, not the cached one
+	virtual void DeleteExpiredTimedGroups(ChangeKind kind, const std::string& key, long long expiredBefore) = 0;
+	// Compaction in lazy mode, reads up to limit stored players with timed memberships whose key comes after after, in
+	// key order, and adds the ones holding memberships expired at or before expiredBefore to expired with their count.
+	// Moves after to the last player read, false once none were left. Run with flushMutex held
+	virtual bool ReadExpiredPlayers(std::string& after, size_t limit, long long expiredBefore, std::vector<std::pair<std::string, int>>& expired) = 0;
+	// Export in lazy mode, reads the rows of up to limit stored players whose key comes after after, in key order, into
+	// rows. Moves after to the last player read, false once none were left. Run with flushMutex held
+	virtual bool ReadPlayerPage(std::string& after, size_t limit, PlayerRows& rows) = 0;
+	// Replaces the Parents column of the group row, both schemas keep the (short) parent list there
+	virtual void WriteGroupParents(const FString& group, const TArray<FString>& parents) = 0;
+
+	struct PendingWrite {
+		ChangeKind Kind;
+		std::string Key;
+		std::string Slot;
+		std::function<void()> Write;
+	};
+
+	/// <summary>
+	/// Queues the database side of a mutation. slot names what part of the row the write replaces, a queued write
+	/// to the same slot is superseded. With async writes off the write is flushed before returning.
+	/// </summary>
+	std::optional<std::string> QueueWrite(ChangeKind kind, const std::string& key, const std::string& slot, std::function<void()> write)
+	{
+		std::vector<PendingWrite> writes;
+		writes.push_back(PendingWrite{ kind, key, slot, std::move(write) });
+		return QueueWrites(std::move(writes));
+	}
+
+	// Queues the writes of a mutation touching many rows, they are flushed together in one transaction
+	std::optional<std::string> QueueWrites(std::vector<PendingWrite>&& writes)
+	{
+		std::vector<WriteBehindQueue::Write> batch;
+		batch.reserve(writes.size());
+		for (auto& pending : writes)
+		{
+			batch.push_back(WriteBehindQueue::Write{ static_cast<int>(pending.Kind), pending.Key, pending.Slot,
+				[this, kind = pending.Kind, key = pending.Key, write = std::move(pending.Write)]()
+				{
+					write();
+					LogChange(kind, key);
+				} });
+		}
+		writeQueue.pushAll(std::move(batch));
+
+		if (Permissions::Writes::Async)
+			return {};
+		return FlushWrites();
+	}
+
+	void SetPlayer(const FString& eos_id, CachedPermission permission)
+	{
+		permissionPlayers.update(eos_id, [&](CachedPermission& cached)
+			{
+				// Inside the map's write lock, so the index sees changes to a player in the same order
+				groupMembers.setPlayer(eos_id, permission);
+				cached = std::move(permission);
+			});
+		if (Permissions::Players::Lazy)
+			residency.touch(eos_id, true);
+	}
+
+	template <typename Fn>
+	void UpdatePlayer(const FString& eos_id, Fn&& fn)
+	{
+		permissionPlayers.update(eos_id, [&](CachedPermission& cached)
+			{
+				fn(cached);
+				groupMembers.setPlayer(eos_id, cached);
+			});
+	}
+
+	// One publish for all of them, fn(const FString&, CachedPermission&)
+	template <typename Keys, typename Fn>
+	void UpdatePlayers(const Keys& eos_ids, Fn&& fn)
+	{
+		permissionPlayers.updateEach(eos_ids, [&](const FString& eos_id, CachedPermission& cached)
+			{
+				fn(eos_id, cached);
+				groupMembers.setPlayer(eos_id, cached);
+			});
+	}
+
+	void ErasePlayer(const FString& eos_id)
+	{
+		permissionPlayers.erase(eos_id);
+		groupMembers.erasePlayer(eos_id);
+		if (Permissions::Players::Lazy)
+			residency.touch(eos_id, false);
+	}
+
+	/// <summary>
+	/// SetPlayer/ErasePlayer for a batch of loaded rows with one publish. Each of eos_ids is set from rows, or erased
+	/// if it isn't there, and rescheduled for its timed groups.
+	/// </summary>
+	template <typename Keys>
+	void SetPlayers(const Keys& eos_ids, PlayerRows& rows)
+	{
+		const long long now = std::time(nullptr);
+		std::vector<std::pair<FString, std::shared_ptr<const CachedPermission>>> entries;
+		for (const FString& eos_id : eos_ids)
+		{
+			auto row = rows.find(eos_id);
+			timedScheduler.SchedulePlayer(eos_id, row != rows.end() ? row->second.TimedGroups : TArray<TimedGroup>(), now);
+			entries.emplace_back(eos_id, row != rows.end() ? std::make_shared<const CachedPermission>(std::move(row->second)) : nullptr);
+		}
+
+		permissionPlayers.setEach(std::move(entries), [this](const FString& eos_id, const CachedPermission* permission)
+			{
+				if (permission)
+					groupMembers.setPlayer(eos_id, *permission);
+				else
+					groupMembers.erasePlayer(eos_id);
+				if (Permissions::Players::Lazy)
+					residency.touch(eos_id, permission != nullptr);
+			});
+	}
+
+	// Same for tribes
+	template <typename Keys>
+	void SetTribes(const Keys& tribeIds, std::unordered_map<int, CachedPermission>& rows)
+	{
+		const long long now = std::time(nullptr);
+		std::vector<std::pair<int, std::shared_ptr<const CachedPermission>>> entries;
+		for (const int tribeId : tribeIds)
+		{
+			auto row = rows.find(tribeId);
+			timedScheduler.ScheduleTribe(tribeId, row != rows.end() ? row->second.TimedGroups : TArray<TimedGroup>(), now);
+			entries.emplace_back(tribeId, row != rows.end() ? std::make_shared<const CachedPermission>(std::move(row->second)) : nullptr);
+		}
+		permissionTribes.setEach(std::move(entries));
+	}
+
+	template <typename Map>
+	void AssignPlayers(Map&& players)
+	{
+		groupMembers.assign(players);
+		if (Permissions::Players::Lazy)
+			residency.refresh(players);
+		permissionPlayers.assign(std::forward<Map>(players));
+	}
+
+	// Rebuilds the effective permissions of group from its own and those of its ancestors, find(name) returns a group or nullptr
+	template <typename Find>
+	static void FlattenGroup(const FString& name, CachedGroup& group, Find&& find)
+	{
+		bool cycle = false;
+		std::vector<const CachedGroup*> ancestors;
+		for (const auto& ancestor : Permissions::Inheritance::Ancestors(name, group, find, &cycle))
+		{
+			if (ancestor.Group)
+				ancestors.push_back(ancestor.Group);
+		}
+		if (cycle)
+			Log::GetLog()->warn("Group {} inherits from itself through its parents, the cycle is ignored", name.ToString());
+		group.flatten(ancestors);
+	}
+
+	/// <summary>
+	/// Caller holds groupMutex. Publishes the changed groups (nullptr erases one) together with every group inheriting
+	/// from them, all flattened against the changed parents and permissions.
+	/// </summary>
+	void PublishGroups(std::unordered_map<FString, std::shared_ptr<CachedGroup>, FStringNoCaseHash, FStringNoCaseEqual>&& changed)
+	{
+		std::vector<std::shared_ptr<const CachedGroup>> held;
+		auto find = [this, &changed, &held](const FString& name) -> const CachedGroup*
+			{
+				auto iter = changed.find(name);
+				if (iter != changed.end())
+					return iter->second.get();
+				held.push_back(permissionGroups.find(name));
+				return held.back().get();
+			};
+
+		GroupRows flattened;
+		permissionGroups.forEach([&](const FString& name, const CachedGroup& group)
+			{
+				if (changed.contains(name))
+					return;
+				for (const auto& ancestor : Permissions::Inheritance::Ancestors(name, group, find))
+				{
+					if (changed.contains(ancestor.Name))
+					{
+						flattened.emplace(name, group);
+						break;
+					}
+				}
+			});
+		for (const auto& [name, group] : changed)
+		{
+			if (group)
+				flattened.emplace(name, *group);
+		}
+		for (auto& [name, group] : flattened)
+			FlattenGroup(name, group, find);
+
+		std::vector<FString> names;
+		names.reserve(flattened.size());
+		for (const auto& entry : flattened)
+			names.push_back(entry.first);
+		permissionGroups.updateEach(names, [&flattened](const FString& name, CachedGroup& group)
+			{
+				group = std::move(flattened.at(name));
+			});
+		for (const auto& [name, group] : changed)
+		{
+			if (!group)
+			{
+				permissionGroups.erase(name);
+				names.push_back(name);
+			}
+		}
+		IndexGroups(names);
+	}
+
+	// Caller holds groupMutex. Points groupsById at the current entries of names, or drops the ones that are gone
+	void IndexGroups(const std::vector<FString>& names)
+	{
+		std::vector<std::pair<GroupId, std::shared_ptr<const CachedGroup>>> entries;
+		entries.reserve(names.size());
+		for (const auto& name : names)
+		{
+			const GroupId id = Permissions::groupNames.intern(name);
+			if (id != GroupNameTable::Invalid)
+				entries.emplace_back(id, permissionGroups.find(name));
+		}
+		groupsById.setEach(std::move(entries));
+	}
+
+	// group is spelled as in the group row
+	void SetGroup(const FString& group, CachedGroup value)
+	{
+		Permissions::groupNames.setCanonical(group);
+		std::lock_guard<std::mutex> groupLock(groupMutex);
+		PublishGroups({ { group, std::make_shared<CachedGroup>(std::move(value)) } });
+	}
+
+	// fn(CachedGroup&) edits the own permissions or parents
+	template <typename Fn>
+	void UpdateGroup(const FString& group, Fn&& fn)
+	{
+		std::lock_guard<std::mutex> groupLock(groupMutex);
+		auto existing = permissionGroups.find(group);
+		auto updated = existing ? std::make_shared<CachedGroup>(*existing) : std::make_shared<CachedGroup>();
+		fn(*updated);
+		PublishGroups({ { group, std::move(updated) } });
+	}
+
+	// Also takes the group out of the parents of the groups inheriting from it, their rows are the caller's to write
+	void EraseGroup(const FString& group)
+	{
+		std::lock_guard<std::mutex> groupLock(groupMutex);
+		std::unordered_map<FString, std::shared_ptr<CachedGroup>, FStringNoCaseHash, FStringNoCaseEqual> changed;
+		changed.emplace(group, nullptr);
+		permissionGroups.forEach([&changed, &group](const FString& name, const CachedGroup& cached)
+			{
+				if (!cached.ParentList.Contains(group))
+					return;
+				auto child = std::make_shared<CachedGroup>(cached);
+				child->ParentList.Remove(group);
+				changed.emplace(name, std::move(child));
+			});
+		PublishGroups(std::move(changed));
+	}
+
+	void AssignGroups(GroupRows&& groups)
+	{
+		std::lock_guard<std::mutex> groupLock(groupMutex);
+		for (auto& [name, group] : groups)
+		{
+			Permissions::groupNames.setCanonical(name);
+			FlattenGroup(name, group, [&groups](const FString& parent) -> const CachedGroup*
+				{
+					auto iter = groups.find(parent);
+					return iter != groups.end() ? &iter->second : nullptr;
+				});
+		}
+		permissionGroups.assign(std::move(groups));
+
+		std::vector<FString> names;
+		groupsById.forEach([&names](GroupId id, const CachedGroup&)
+			{
+				names.push_back(Permissions::groupNames.name(id));
+			});
+		permissionGroups.forEach([&names](const FString& name, const CachedGroup&)
+			{
+				names.push_back(name);
+			});
+		IndexGroups(names);
+	}
+
+	// Groups listing group among their parents, for RemoveGroup
+	std::vector<std::pair<FString, TArray<FString>>> GetChildGroups(const FString& group)
+	{
+		std::vector<std::pair<FString, TArray<FString>>> children;
+		permissionGroups.forEach([&children, &group](const FString& name, const CachedGroup& cached)
+			{
+				if (!cached.ParentList.Contains(group))
+					return;
+				TArray<FString> parents = cached.ParentList;
+				parents.Remove(group);
+				// Spelled as in the group row, the row is updated by name
+				children.emplace_back(Permissions::groupNames.canonical(name), std::move(parents));
+			});
+		return children;
+	}
+
+	/// <summary>
+	/// Cached row of the player for mutations and commands, never waits on the database. In lazy mode a player that
+	/// isn't loaded yet reads as missing and is handed to LoadRequestedPlayers, mutations wait for the row with
+	/// DeferPlayerChange first. The least recently used offline players beyond OfflineCacheSize are dropped, only on
+	/// the thread asking, so a mutation never sees the row it just looked up disappear.
+	/// </summary>
+	std::shared_ptr<const CachedPermission> FindPlayer(const FString& eos_id)
+	{
+		auto permission = permissionPlayers.find(eos_id);
+		if (!Permissions::Players::Lazy)
+			return permission;
+
+		if (permission || residency.isAbsent(eos_id))
+			residency.touch(eos_id, permission != nullptr);
+		else
+			RequestPlayerLoad(eos_id);
+
+		EvictPlayers(eos_id);
+		return permission;
+	}
+
+	/// <summary>
+	/// Cached row of the player for permission checks, never waits on the database. In lazy mode a player that isn't
+	/// loaded yet is handed to LoadRequestedPlayers and has just the Default group until the row arrives.
+	/// </summary>
+	std::shared_ptr<const CachedPermission> PeekPlayer(const FString& eos_id)
+	{
+		auto permission = permissionPlayers.find(eos_id);
+		if (!Permissions::Players::Lazy)
+			return permission;
+
+		if (permission || residency.isAbsent(eos_id))
+		{
+			residency.touch(eos_id, permission != nullptr);
+		}
+		else
+		{
+			static const auto loading = std::make_shared<const CachedPermission>("Default,", "");
+			RequestPlayerLoad(eos_id);
+			permission = loading;
+		}
+
+		EvictPlayers(eos_id);
+		return permission;
+	}
+
+	void RequestPlayerLoad(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(loadRequestMutex);
+		if (!loadingPlayers.contains(eos_id))
+			requestedPlayers.insert(eos_id);
+	}
+
+	/// <summary>
+	/// Lazy mode, puts rows read from the database into the cache. A player set since the rows were read (by a
+	/// mutation or another load) keeps the cached row, requested players missing from rows are remembered as absent.
+	/// </summary>
+	template <typename Keys>
+	void AdoptPlayers(const Keys& requested, PlayerRows& rows)
+	{
+		std::lock_guard<std::mutex> lg(playerLoadMutex);
+		std::vector<FString> found;
+		for (const FString& eos_id : requested)
+		{
+			if (permissionPlayers.contains(eos_id))
+				continue;
+
+			if (rows.contains(eos_id))
+				found.push_back(eos_id);
+			else
+				residency.touch(eos_id, false);
+		}
+		SetPlayers(found, rows);
+	}
+
+	void EvictPlayers(const FString& keep)
+	{
+		const auto evicted = residency.evict(std::max(Permissions::Players::OfflineCacheSize, 0), [this, &keep](const FString& eos_id)
+			{
+				// Rows with writes pending would be read back stale
+				return eos_id == keep || IsReloadBlocked(ChangeKind::Player, eos_id.ToString());
+			});
+		if (evicted.empty())
+			return;
+
+		std::vector<std::pair<FString, std::shared_ptr<const CachedPermission>>> entries;
+		for (const auto& eos_id : evicted)
+		{
+			entries.emplace_back(eos_id, nullptr);
+			timedScheduler.SchedulePlayer(eos_id, {}, 0);
+		}
+		permissionPlayers.setEach(std::move(entries), [this](const FString& eos_id, const CachedPermission*)
+			{
+				groupMembers.erasePlayer(eos_id);
+			});
+	}
+
+	// Lazy mode only refreshes players that are loaded (or known missing), the others are read when next needed
+	void DropUntrackedPlayers(std::unordered_set<std::string>& players)
+	{
+		if (!Permissions::Players::Lazy)
+			return;
+
+		std::erase_if(players, [this](const std::string& eos_id)
+			{
+				return !residency.contains(FString(eos_id.c_str()));
+			});
+	}
+
+	// Caller holds flushMutex
+	std::optional<std::string> FlushWritesLocked()
+	{
+		auto batch = writeQueue.take();
+		if (batch.empty())
+			return {};
+
+		static auto& flushStat = Permissions::Stats::Timer("Database.FlushWrites");
+		static auto& flushedWrites = Permissions::Stats::Counter("Database.FlushWrites writes");
+		Permissions::Stats::ScopedTimer timer(flushStat);
+		flushedWrites.add(batch.size());
+
+		try
+		{
+			RunInTransaction([&batch]()
+				{
+					for (const auto& write : batch)
+						write.Run();
+				});
+			for (const auto& write : batch)
+				writeQueue.complete(write);
+			return {};
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->warn("({} {}) Batch of {} writes failed, retrying them one by one: {}", __FILE__, __FUNCTION__, batch.size(), exception.what());
+		}
+
+		// One bad write shouldn't hold back the rest of the batch
+		std::optional<std::string> error;
+		for (auto& write : batch)
+		{
+			try
+			{
+				RunInTransaction(write.Run);
+				writeQueue.complete(write);
+			}
+			catch (const std::exception& exception)
+			{
+				error = "Unexpected DB error";
+				Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+				// Without async writes the caller gets the error back and leaves the caches alone, nothing to retry
+				if (Permissions::Writes::Async)
+					writeQueue.retry(std::move(write), exception.what());
+				else
+					writeQueue.complete(write);
+			}
+		}
+		return error;
+	}
+
+	// A membership is its own row in the normalized schema and part of the Groups/TimedGroups column otherwise
+	static std::string MembershipSlot(bool normalized, const FString& group, bool timed)
+	{
+		if (normalized)
+			return fmt::format("{}:{}", timed ? "Timed" : "Group", group.ToString());
+		return timed ? "TimedGroups" : "Groups";
+	}
+
+	static std::string PermissionSlot(bool normalized, const FString& permission)
+	{
+		return normalized ? "Permission:" + permission.ToString() : "Permissions";
+	}
+
+	/// <summary>
+	/// Caller holds syncMutex. Cursor for a full load that is about to read the tables: the changes committed so far
+	/// are part of the load, the ids missing among the recent ones may still commit and are kept as gaps. Ids missing
+	/// below the oldest entry read were pruned, not skipped.
+	/// </summary>
+	ChangeCursor StartChangeCursor()
+	{
+		const long long stored = GetChangeWatermark();
+		const time_t now = std::time(nullptr);
+		std::optional<ChangeCursor> cursor;
+		try
+		{
+			ReadChanges(std::max(0LL, stored - ChangeCursor::RecentIds), [&cursor, now](long long id, ChangeKind, const std::string&)
+				{
+					if (!cursor)
+						cursor.emplace(id - 1);
+					cursor->See(id, now);
+				});
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return ChangeCursor(stored);
+		}
+		return cursor ? *cursor : ChangeCursor(stored);
+	}
+
+	/// <summary>
+	/// Caller holds syncMutex. Adds the rows of the changes not applied yet to the sets and returns how many changes
+	/// there were. next is the cursor to keep once they are reloaded.
+	/// </summary>
+	int CollectChanges(ChangeCursor& next, std::unordered_set<std::string>& players, std::unordered_set<std::string>& tribes,
+		std::unordered_set<std::string>& groups)
+	{
+		next = changeCursor;
+		const time_t now = std::time(nullptr);
+		int changes = 0;
+		ReadChanges(next.ScanFrom(), [&](long long id, ChangeKind kind, const std::string& key)
+			{
+				if (!next.See(id, now))
+					return;
+				switch (kind)
+				{
+				case ChangeKind::Player:
+					players.insert(key);
+					break;
+				case ChangeKind::Tribe:
+					tribes.insert(key);
+					break;
+				case ChangeKind::Group:
+					groups.insert(key);
+					break;
+				}
+				++changes;
+			});
+		next.Expire(now);
+		return changes;
+	}
+
+	bool IsReloadBlocked(ChangeKind kind, const std::string& key)
+	{
+		return writeQueue.isPending(static_cast<int>(kind), key);
+	}
+
+	/// <summary>
+	/// IsReloadBlocked for a full load: rows with writes queued or in flight keep their cached state (or stay away if
+	/// they aren't cached), the rows just read may predate those writes. Call right before assigning the rows.
+	/// </summary>
+	void KeepPendingRows(GroupRows& groups, PlayerRows& players, std::unordered_map<int, CachedPermission>& tribes)
+	{
+		for (const auto& key : writeQueue.pendingKeys(static_cast<int>(ChangeKind::Group)))
+			KeepPendingRow(permissionGroups, groups, FString(key.c_str()));
+		for (const auto& key : writeQueue.pendingKeys(static_cast<int>(ChangeKind::Player)))
+			KeepPendingRow(permissionPlayers, players, FString(key.c_str()));
+		for (const auto& key : writeQueue.pendingKeys(static_cast<int>(ChangeKind::Tribe)))
+			KeepPendingRow(permissionTribes, tribes, std::stoi(key));
+	}
+
+	template <typename Cache, typename Rows, typename Key>
+	static void KeepPendingRow(const Cache& cache, Rows& rows, const Key& key)
+	{
+		if (auto cached = cache.find(key))
+			rows.insert_or_assign(key, *cached);
+		else
+			rows.erase(key);
+	}
+
+	// Adds the rows whose writes were given up to a reload so the caches fall back to what is stored
+	void TakeFailedRows(std::unordered_set<std::string>& players, std::unordered_set<std::string>& tribes, std::unordered_set<std::string>& groups)
+	{
+		for (const auto& row : writeQueue.takeFailedRows())
+		{
+			switch (static_cast<ChangeKind>(row.first))
+			{
+			case ChangeKind::Player:
+				players.insert(row.second);
+				break;
+			case ChangeKind::Tribe:
+				tribes.insert(row.second);
+				break;
+			case ChangeKind::Group:
+				groups.insert(row.second);
+				break;
+			}
+		}
+	}
+
+	// Legacy column format, "Default,Vip,"
+	template <typename Names>
+	static FString JoinNames(const Names& names)
+	{
+		FString joined;
+		for (const FString& name : names)
+			joined += name + ",";
+		return joined;
+	}
+
+	// Legacy column format, "delayUntil;expireAt;group,"
+	static FString JoinTimedGroups(const TArray<TimedGroup>& groups)
+	{
+		FString joined;
+		for (const TimedGroup& group : groups)
+			joined += FString::Format("{};{};{},", group.DelayUntilTime, group.ExpireAtTime, group.GroupName().ToString());
+		return joined;
+	}
+
+	// Takes the memberships of group out of groups by name, so a reordered or reloaded array can't shift the wrong one out
+	static TArray<TimedGroup> TakeTimedGroup(TArray<TimedGroup>& groups, const FString& group)
+	{
+		TArray<TimedGroup> taken;
+		groups.RemoveAll([&](const TimedGroup& timedGroup)
+			{
+				if (timedGroup.GroupName() != group)
+					return false;
+				taken.Add(timedGroup);
+				return true;
+			});
+		return taken;
+	}
+
+	// Removes the memberships that expired at or before expiredBefore, returns how many
+	static int RemoveExpiredTimedGroups(TArray<TimedGroup>& groups, long long expiredBefore)
+	{
+		return groups.RemoveAll([expiredBefore](const TimedGroup& group)
+			{
+				return group.ExpireAtTime > 0 && group.ExpireAtTime <= expiredBefore;
+			});
+	}
+
+	static int CountExpiredTimedGroups(const TArray<TimedGroup>& groups, long long expiredBefore)
+	{
+		int expired = 0;
+		for (const TimedGroup& group : groups)
+		{
+			if (group.ExpireAtTime > 0 && group.ExpireAtTime <= expiredBefore)
+				++expired;
+		}
+		return expired;
+	}
+
+	void RescheduleTimedGroups()
+	{
+		const long long now = std::time(nullptr);
+		timedScheduler.Reset();
+
+		permissionPlayers.forEach([this, now](const FString& eos_id, const CachedPermission& permission)
+			{
+				timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, now);
+			});
+		permissionTribes.forEach([this, now](int tribeId, const CachedPermission& permission)
+			{
+				timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, now);
+			});
+	}
 
 public:
 	virtual ~IDatabase() = default;
@@ -22,9 +805,57 @@ public:
 	virtual bool IsGroupExists(const FString& group) = 0;
 	virtual TArray<FString> GetPlayerGroups(const FString& eos_id, bool includeTimed = true) = 0;
 	virtual CachedPermission HydratePlayerGroups(const FString& eos_id) = 0;
+	virtual long long GetNextTimedBoundary(const FString& eos_id, long long now) = 0;
 	virtual TArray<FString> GetGroupPermissions(const FString& group) = 0;
+	virtual bool IsGroupHasPermission(const FString& group, const FString& permission, bool allowWildcard) = 0;
 	virtual TArray<FString> GetAllGroups() = 0;
-	virtual TArray<FString> GetGroupMembers(const FString& group) = 0;
+	/// <summary>
+	/// Players holding the group themselves (permanently or through an active timed membership). Never waits on the
+	/// database. In lazy mode players that aren't loaded come from the last read of the PlayerGroups index, which is
+	/// asked for on the pool when missing or older than StoredMembersSecs, so until it is in only loaded players are
+	/// listed. The same with the legacy schema and for Default, they have no such index.
+	/// </summary>
+	TArray<FString> GetGroupMembers(const FString& group)
+	{
+		TArray<FString> members;
+		if (group == L"Default")
+		{
+			permissionPlayers.forEach([&members](const FString& eos_id, const CachedPermission&)
+				{
+					members.Add(eos_id);
+				});
+			return members;
+		}
+
+		const long long now = std::time(nullptr);
+		groupMembers.forEach(group, [&members, now](const FString& eos_id, const GroupMemberIndex::Membership& membership)
+			{
+				if (membership.isActive(now))
+					members.Add(eos_id);
+			});
+
+		// Only groups with a row are read, so listing made up names doesn't grow storedMembers
+		if (Permissions::Players::Lazy && permissionGroups.contains(group))
+		{
+			std::shared_ptr<const TArray<FString>> stored;
+			{
+				std::lock_guard<std::mutex> lg(loadRequestMutex);
+				auto iter = storedMembers.find(group);
+				if (iter != storedMembers.end())
+					stored = iter->second.EosIds;
+				if (iter == storedMembers.end() || now - iter->second.ReadAt >= StoredMembersSecs)
+					requestedMemberGroups.insert(group);
+			}
+
+			for (const auto& eos_id : stored ? *stored : TArray<FString>())
+			{
+				if (!permissionPlayers.contains(eos_id))
+					members.Add(eos_id);
+			}
+		}
+		return members;
+	}
+
 	virtual std::optional<std::string> AddPlayerToGroup(const FString& eos_id, const FString& group) = 0;
 	virtual std::optional<std::string> RemovePlayerFromGroup(const FString& eos_id, const FString& group) = 0;
 	virtual std::optional<std::string> AddGroup(const FString& group) = 0;
@@ -33,20 +864,342 @@ public:
 	virtual std::optional<std::string> GroupRevokePermission(const FString& group, const FString& permission) = 0;
 	virtual std::optional<std::string> AddPlayerToTimedGroup(const FString& eos_id, const FString& group, int secs, int delaySecs) = 0;
 	virtual std::optional<std::string> RemovePlayerFromTimedGroup(const FString& eos_id, const FString& group) = 0;
-	virtual void UpdatePlayerGroupCallbacks(const FString& eos_id, TArray<FString> groups) = 0;
 
 	virtual bool IsTribeExists(int tribeId) = 0;
 	virtual bool AddTribe(int tribeId) = 0;
 	virtual TArray<FString> GetTribeGroups(int tribeId, bool includeTimed = true) = 0;
 	virtual CachedPermission HydrateTribeGroups(int tribeId) = 0;
+	virtual long long GetTribeNextTimedBoundary(int tribeId, long long now) = 0;
 	virtual std::optional<std::string> AddTribeToGroup(int tribeId, const FString& group) = 0;
 	virtual std::optional<std::string> RemoveTribeFromGroup(int tribeId, const FString& group) = 0;
 	virtual std::optional<std::string> AddTribeToTimedGroup(int tribeId, const FString& group, int secs, int delaySecs) = 0;
 	virtual std::optional<std::string> RemoveTribeFromTimedGroup(int tribeId, const FString& group) = 0;
-	virtual void UpdateTribeGroupCallbacks(int tribeId, TArray<FString> groups) = 0;
+
+	// Default, permanent and active timed groups of the player as ids, added to groups. Nothing if the player doesn't exist
+	void AddPlayerGroupIds(const FString& eos_id, long long now, GroupSet& groups)
+	{
+		if (auto permission = PeekPlayer(eos_id))
+			permission->addGroupIds(now, groups);
+	}
+
+	void AddTribeGroupIds(int tribeId, long long now, GroupSet& groups)
+	{
+		if (auto permission = permissionTribes.find(tribeId))
+			permission->addGroupIds(now, groups);
+	}
+
+	GroupSet GetTribeGroupIds(int tribeId, long long now)
+	{
+		GroupSet groups;
+		AddTribeGroupIds(tribeId, now, groups);
+		return groups;
+	}
+
+	// Snapshot of one group, lets batch checks look each group up once
+	std::shared_ptr<const CachedGroup> FindGroup(const FString& group) const
+	{
+		return permissionGroups.find(group);
+	}
+
+	// Same by interned id, for checks that already hold the ids of the player's groups
+	std::shared_ptr<const CachedGroup> FindGroup(GroupId group) const
+	{
+		return groupsById.find(group);
+	}
+
+	TArray<FString> GetGroupParents(const FString& group) const
+	{
+		auto cachedGroup = permissionGroups.find(group);
+		return cachedGroup ? cachedGroup->ParentList : TArray<FString>();
+	}
+
+	/// <summary>
+	/// group inherits every permission of parent and of parent's own ancestors. Refused if it would make a group its
+	/// own ancestor. The effective permissions of group and the groups inheriting from it are rebuilt right away.
+	/// </summary>
+	std::optional<std::string> AddGroupParent(const FString& group, const FString& parent)
+	{
+		auto cachedGroup = permissionGroups.find(group);
+		auto parentGroup = permissionGroups.find(parent);
+		if (!cachedGroup || !parentGroup)
+			return "Group does not exist";
+
+		if (cachedGroup->ParentList.Contains(parent))
+			return "Group already inherits from this group";
+
+		std::vector<std::shared_ptr<const CachedGroup>> held;
+		auto find = [this, &held](const FString& name) -> const CachedGroup*
+			{
+				held.push_back(permissionGroups.find(name));
+				return held.back().get();
+			};
+		if (FStringNoCaseEqual()(parent, group) || Permissions::Inheritance::InheritsFrom(parent, *parentGroup, group, find))
+			return "Parent group inherits from this group, that would be a cycle";
+
+		TArray<FString> parents = cachedGroup->ParentList;
+		parents.Add(parent);
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), "Parents", [this, group, parents]()
+			{
+				WriteGroupParents(group, parents);
+			});
+		if (error)
+			return error;
+
+		UpdateGroup(group, [&parent](CachedGroup& updated)
+			{
+				updated.ParentList.AddUnique(parent);
+			});
+		Permissions::Cache::Invalidate();
+
+		return {};
+	}
+
+	std::optional<std::string> RemoveGroupParent(const FString& group, const FString& parent)
+	{
+		auto cachedGroup = permissionGroups.find(group);
+		if (!cachedGroup)
+			return "Group does not exist";
+
+		if (!cachedGroup->ParentList.Contains(parent))
+			return "Group does not inherit from this group";
+
+		TArray<FString> parents = cachedGroup->ParentList;
+		parents.Remove(parent);
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), "Parents", [this, group, parents]()
+			{
+				WriteGroupParents(group, parents);
+			});
+		if (error)
+			return error;
+
+		UpdateGroup(group, [&parent](CachedGroup& updated)
+			{
+				updated.ParentList.Remove(parent);
+			});
+		Permissions::Cache::Invalidate();
+
+		return {};
+	}
+
+	// Writes every queued mutation now, returns the error if any of them failed
+	std::optional<std::string> FlushWrites()
+	{
+		std::lock_guard<std::mutex> flushLock(flushMutex);
+		return FlushWritesLocked();
+	}
+
+	bool IsWriteDue()
+	{
+		return writeQueue.isDue();
+	}
+
+	size_t GetPendingWrites()
+	{
+		return writeQueue.size();
+	}
+
+	size_t GetCachedPlayers() const
+	{
+		return permissionPlayers.size();
+	}
+
+	// Lazy mode, online players are always kept loaded. A player logging in is read in the background
+	void SetPlayerOnline(const FString& eos_id, bool online)
+	{
+		if (!Permissions::Players::Lazy)
+			return;
+
+		residency.setOnline(eos_id, online);
+		if (online && !permissionPlayers.contains(eos_id))
+			RequestPlayerLoad(eos_id);
+	}
+
+	// Whether checks already see the stored groups of the player, never waits on the database
+	bool IsPlayerLoaded(const FString& eos_id) const
+	{
+		return permissionPlayers.contains(eos_id);
+	}
+
+	// Whether FindPlayer knows the player, loaded or known to be missing. Always true outside lazy mode
+	bool IsPlayerKnown(const FString& eos_id)
+	{
+		return !Permissions::Players::Lazy || permissionPlayers.contains(eos_id) || residency.isAbsent(eos_id);
+	}
+
+	bool HasPlayerLoads()
+	{
+		std::lock_guard<std::mutex> lg(loadRequestMutex);
+		return !requestedPlayers.empty() || !requestedMemberGroups.empty();
+	}
+
+	/// <summary>
+	/// Lazy mode, reads the players PeekPlayer and SetPlayerOnline asked for. Runs on the thread pool one at a time,
+	/// so checks never wait on the database. An online player without a row is added, as the login hook does otherwise.
+	/// </summary>
+	void LoadRequestedPlayers()
+	{
+		std::vector<FString> loading;
+		std::unordered_set<std::string> keys;
+		{
+			std::lock_guard<std::mutex> lg(loadRequestMutex);
+			loadingPlayers.swap(requestedPlayers);
+			for (const auto& eos_id : loadingPlayers)
+			{
+				loading.push_back(eos_id);
+				keys.insert(eos_id.ToString());
+			}
+		}
+
+		static auto& loadStat = Permissions::Stats::Timer("Database.LoadRequestedPlayers");
+		Permissions::Stats::ScopedTimer timer(loadStat);
+		try
+		{
+			auto rows = LoadPlayerRows(keys);
+			AdoptPlayers(loading, rows);
+
+			for (const auto& eos_id : loading)
+			{
+				if (residency.isAbsent(eos_id) && residency.isOnline(eos_id) && !AddPlayer(eos_id))
+					Log::GetLog()->error("({} {}) Couldn't add player", __FILE__, __FUNCTION__);
+			}
+		}
+		catch (const std::exception& exception)
+		{
+			// Checks ask for the players again
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		{
+			std::lock_guard<std::mutex> lg(loadRequestMutex);
+			loadingPlayers.clear();
+		}
+		Permissions::Cache::Invalidate();
+
+		LoadRequestedGroupMembers();
+	}
+
+	// Lazy mode, reads the stored members of the groups GetGroupMembers asked for, runs with LoadRequestedPlayers
+	void LoadRequestedGroupMembers()
+	{
+		std::vector<FString> groups;
+		{
+			std::lock_guard<std::mutex> lg(loadRequestMutex);
+			groups.assign(requestedMemberGroups.begin(), requestedMemberGroups.end());
+			requestedMemberGroups.clear();
+		}
+
+		const long long now = std::time(nullptr);
+		for (const auto& group : groups)
+		{
+			try
+			{
+				auto stored = LoadGroupMemberIds(group, now);
+				std::lock_guard<std::mutex> lg(loadRequestMutex);
+				storedMembers[group] = StoredMembers{ stored ? std::make_shared<const TArray<FString>>(std::move(*stored)) : nullptr, now };
+			}
+			catch (const std::exception& exception)
+			{
+				// Asked for again by the next listing
+				Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			}
+		}
+	}
+
+	/// <summary>
+	/// Lazy mode, holds on to a change to a player that isn't loaded yet and asks LoadRequestedPlayers for the row,
+	/// RunDeferredChanges makes it on the game thread once the row is in. Changes to the same player stay in order.
+	/// False when the change can be made right away.
+	/// </summary>
+	bool DeferPlayerChange(const FString& eos_id, std::function<void()> change)
+	{
+		if (!Permissions::Players::Lazy)
+			return false;
+
+		{
+			std::lock_guard<std::mutex> lg(loadRequestMutex);
+			auto iter = deferredChanges.find(eos_id);
+			if (iter == deferredChanges.end() && IsPlayerKnown(eos_id))
+				return false;
+			if (iter == deferredChanges.end())
+				iter = deferredChanges.emplace(eos_id, std::vector<std::function<void()>>()).first;
+			iter->second.push_back(std::move(change));
+		}
+		RequestPlayerLoad(eos_id);
+		return true;
+	}
+
+	/// <summary>
+	/// Makes the deferred changes of the players LoadRequestedPlayers brought in, runs on the game thread. Each player
+	/// is checked right before its changes run, an earlier one may have evicted it, and asked for again if it's gone.
+	/// </summary>
+	void RunDeferredChanges()
+	{
+		std::vector<FString> players;
+		{
+			std::lock_guard<std::mutex> lg(loadRequestMutex);
+			for (const auto& [eos_id, changes] : deferredChanges)
+				players.push_back(eos_id);
+		}
+
+		for (const auto& eos_id : players)
+		{
+			std::vector<std::function<void()>> changes;
+			{
+				std::lock_guard<std::mutex> lg(loadRequestMutex);
+				auto iter = deferredChanges.find(eos_id);
+				if (iter == deferredChanges.end() || !IsPlayerKnown(eos_id))
+				{
+					if (iter != deferredChanges.end() && !loadingPlayers.contains(eos_id))
+						requestedPlayers.insert(eos_id);
+					continue;
+				}
+				changes = std::move(iter->second);
+				deferredChanges.erase(iter);
+			}
+
+			for (const auto& change : changes)
+				change();
+		}
+	}
+
+	size_t GetCachedTribes() const
+	{
+		return permissionTribes.size();
+	}
+
+	size_t GetCachedGroups() const
+	{
+		return permissionGroups.size();
+	}
+
+	std::vector<WriteBehindQueue::Failure> TakeWriteFailures()
+	{
+		return writeQueue.takeFailures();
+	}
+
+	std::vector<TimedGroupScheduler::Event> PopDueTimedGroups(long long now)
+	{
+		return timedScheduler.PopDue(now);
+	}
+
+	/// <summary>
+	/// Whether the change log has entries past the last sync, e.g. from another server. A single MAX(Id) query, cheap
+	/// enough to run every second. False while a sync is running, it picks them up anyway. True while ids below the
+	/// last sync are missing, they can't be told apart from a commit that is still on its way.
+	/// </summary>
+	bool HasNewChanges()
+	{
+		std::unique_lock<std::mutex> syncLock(syncMutex, std::try_to_lock);
+		if (!syncLock.owns_lock())
+			return false;
+
+		std::lock_guard<std::mutex> flushLock(flushMutex);
+		return changeCursor.HasGaps() || GetChangeWatermark() > changeCursor.Watermark();
+	}
 
 	virtual void Init() = 0;
-	virtual std::unordered_map<std::string, std::string> InitGroups() = 0;
+	virtual void SyncChanges() = 0;
+	virtual std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> InitGroups() = 0;
 	virtual std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> InitPlayers() = 0;
 	virtual std::unordered_map<int, CachedPermission> InitTribes() = 0;
 };
@@ -1,17 +1,26 @@
 #pragma once
 
-#include <mysql++11.h>
+#include <array>
+#include <tuple>
 
 #include "IDatabase.h"
+#include "MysqlPool.h"
 
 class MySql : public IDatabase
 {
 public:
 	explicit MySql(std::string server, std::string username, std::string password, std::string db_name, const unsigned int port,
-		std::string table_players, std::string table_groups, std::string table_tribes)
+		std::string table_players, std::string table_groups, std::string table_tribes, std::string table_changes,
+		bool normalized, std::string table_player_groups, std::string table_tribe_groups, std::string table_group_permissions,
+		const unsigned int pool_size)
 		: table_players_(move(table_players)), table_tribes_(move(table_tribes)),
-		  table_groups_(move(table_groups))
+		  table_groups_(move(table_groups)), table_changes_(move(table_changes)),
+		  table_player_groups_(move(table_player_groups)), table_tribe_groups_(move(table_tribe_groups)),
+		  table_group_permissions_(move(table_group_permissions)), normalized_(normalized)
 	{
+		identity_ = fmt::format("mysql:{}:{}/{}:{},{},{},{},{},{},{}", server, port, db_name, table_players_, table_tribes_,
+			table_groups_, table_changes_, table_player_groups_, table_tribe_groups_, table_group_permissions_);
+
 		try
 		{
 			daotk::mysql::connect_options options;
@@ -25,41 +34,49 @@ public:
 			options.ssl_enforce = true;
 			options.ssl_verify_server_cert = false;
 
-			bool result = db_.open(options);
-			if (!result)
+			if (!pool_.open(options, pool_size))
 			{
 				Log::GetLog()->critical("Failed to open connection!");
 				return;
 			}
 
-			result = db_.query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
+			auto db = pool_.acquire();
+			bool result = db->query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
 			                               "Id INT NOT NULL AUTO_INCREMENT,"
 			                               "EOS_Id VARCHAR(50) NOT NULL,"
 			                               "PermissionGroups VARCHAR(256) NOT NULL DEFAULT 'Default,',"
 				"TimedPermissionGroups VARCHAR(256) NOT NULL DEFAULT '',"
 			                               "PRIMARY KEY(Id),"
 			                               "UNIQUE INDEX EOS_Id_UNIQUE (EOS_Id ASC));", table_players_));
-			result = db_.query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
+			result = db->query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
 				"Id INT NOT NULL AUTO_INCREMENT,"
 				"TribeId BIGINT(11) NOT NULL,"
 				"PermissionGroups VARCHAR(256) NOT NULL DEFAULT '',"
 				"TimedPermissionGroups VARCHAR(256) NOT NULL DEFAULT '',"
 				"PRIMARY KEY(Id),"
 				"UNIQUE INDEX TribeId_UNIQUE (TribeId ASC));", table_tribes_));
-			result |= db_.query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
+			result |= db->query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
 			                                "Id INT NOT NULL AUTO_INCREMENT,"
 			                                "GroupName VARCHAR(128) NOT NULL,"
 			                                "Permissions VARCHAR(768) NOT NULL DEFAULT '',"
+			                                "Parents VARCHAR(768) NOT NULL DEFAULT '',"
 			                                "PRIMARY KEY(Id),"
 			                                "UNIQUE INDEX GroupName_UNIQUE (GroupName ASC));", table_groups_));
+			result |= db->query(fmt::format("CREATE TABLE IF NOT EXISTS {} ("
+				"Id BIGINT NOT NULL AUTO_INCREMENT,"
+				"Kind TINYINT NOT NULL,"
+				"RowKey VARCHAR(128) NOT NULL,"
+				"ChangedAt BIGINT NOT NULL,"
+				"PRIMARY KEY(Id),"
+				"INDEX ChangedAt_INDEX (ChangedAt ASC));", table_changes_));
 
 			// Add default groups
-			result |= db_.query(fmt::format("INSERT INTO {} (GroupName, Permissions)"
+			result |= db->query(fmt::format("INSERT INTO {} (GroupName, Permissions)"
 			                                "SELECT 'Admins', '*,'"
 			                                "WHERE NOT EXISTS(SELECT 1 FROM {} WHERE GroupName = 'Admins');",
 			                                table_groups_,
 			                                table_groups_));
-			result |= db_.query(fmt::format("INSERT INTO {} (GroupName)"
+			result |= db->query(fmt::format("INSERT INTO {} (GroupName)"
 			                                "SELECT 'Default'"
 			                                "WHERE NOT EXISTS(SELECT 1 FROM {} WHERE GroupName = 'Default');",
 			                                table_groups_,
@@ -67,6 +84,9 @@ public:
 
 			upgradeDatabase(db_name);
 
+			if (normalized_)
+				normalized_ = PrepareNormalizedSchema();
+
 			if (!result)
 			{
 				Log::GetLog()->critical("({} {}) Failed to create table!", __FILE__, __FUNCTION__);
@@ -82,7 +102,8 @@ public:
 	{
 		try
 		{
-			auto result = db_.query(fmt::format(
+			auto db = pool_.acquire();
+			auto result = db->query(fmt::format(
 				"SHOW COLUMNS FROM {} LIKE '{}';",
 				tableName, fieldName)).count();
 			return result > 0;
@@ -96,57 +117,44 @@ public:
 	
 	bool IsPlayerExists(const FString& eos_id) override
 	{
-		std::lock_guard<std::mutex> lg(playersMutex);
-		if (permissionPlayers.find(eos_id) == permissionPlayers.end())
-			return false;
-
-		return true;
+		return FindPlayer(eos_id) != nullptr;
 	}
 	
 	bool AddPlayer(const FString& eos_id) override
 	{
-		try
-		{
-			if (db_.query(fmt::format("INSERT INTO {} (EOS_Id, PermissionGroups) VALUES ('{}', '{}');", table_players_, eos_id.ToString(), "Default,")))
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), "Row", [this, eos_id]()
 			{
-				std::lock_guard<std::mutex> lg(playersMutex);
-				permissionPlayers[eos_id] = CachedPermission("Default,", "");
-				return true;
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+				Execute(fmt::format("INSERT INTO {} (EOS_Id, PermissionGroups) VALUES (?, 'Default,');", table_players_), eos_id.ToString());
+				if (normalized_)
+					WritePlayerMembership(eos_id, "Default");
+			});
+		if (error)
 			return false;
-		}
 
-		return false;
+		SetPlayer(eos_id, CachedPermission("Default,", ""));
+		Permissions::Cache::Invalidate();
+		return true;
 	}
 
 	bool IsGroupExists(const FString& group) override
 	{
-		std::lock_guard<std::mutex> lg(groupsMutex);
-		if (permissionGroups.find(group.ToString()) == permissionGroups.end())
-			return false;
-
-		return true;
-		}
+		return permissionGroups.contains(group);
+	}
 
 	TArray<FString> GetPlayerGroups(const FString& eos_id, bool includeTimed = true) override
 	{
 		TArray<FString> groups;
 
-		if (IsPlayerExists(eos_id))
+		if (auto permission = PeekPlayer(eos_id))
 		{
-			std::lock_guard<std::mutex> lg(playersMutex);
 			if (includeTimed)
 			{
 				auto nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-				groups = permissionPlayers[eos_id].getGroups(nowSecs);
+				groups = permission->getGroups(nowSecs);
 			}
 			else
 			{
-				groups = permissionPlayers[eos_id].Groups;
+				groups = permission->Groups.ToArray();
 			}
 		}
 
@@ -155,8 +163,14 @@ public:
 
 	CachedPermission HydratePlayerGroups(const FString& eos_id) override
 	{
-		std::lock_guard<std::mutex> lg(playersMutex);
-		return permissionPlayers[eos_id];
+		auto permission = FindPlayer(eos_id);
+		return permission ? *permission : CachedPermission();
+	}
+
+	long long GetNextTimedBoundary(const FString& eos_id, long long now) override
+	{
+		auto permission = PeekPlayer(eos_id);
+		return permission ? permission->getNextBoundary(now) : 0;
 	}
 
 	TArray<FString> GetGroupPermissions(const FString& group) override
@@ -166,49 +180,29 @@ public:
 
 		TArray<FString> permissions;
 
-		if (IsGroupExists(group))
-		{
-			std::lock_guard<std::mutex> lg(groupsMutex);
-			FString permissions_fstr(permissionGroups[group.ToString()].c_str());
-			permissions_fstr.ParseIntoArray(permissions, L",", true);
-		}
+		if (auto cachedGroup = permissionGroups.find(group))
+			permissions = cachedGroup->PermissionList;
 
 		return permissions;
 	}
 
-	TArray<FString> GetAllGroups() override
+	bool IsGroupHasPermission(const FString& group, const FString& permission, bool allowWildcard) override
 	{
-		TArray<FString> all_groups;
-		std::unordered_map<std::string, std::string> localGroups;
-
-		groupsMutex.lock();
-		localGroups = permissionGroups;
-		groupsMutex.unlock();
-
-		for (auto& group : localGroups)
-			   {
-			all_groups.Add(group.first.c_str());
-		}
-
-		return all_groups;
+		auto cachedGroup = permissionGroups.find(group);
+		return cachedGroup && cachedGroup->hasPermission(permission, allowWildcard);
 	}
 
-	TArray<FString> GetGroupMembers(const FString& group) override
+	TArray<FString> GetAllGroups() override
 	{
-		TArray<FString> members;
-		std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> localPlayers;
-
-		playersMutex.lock();
-		localPlayers = permissionPlayers;
-		playersMutex.unlock();
+		TArray<FString> all_groups;
 
-		for (auto& players : localPlayers)
-		{
-			if (Permissions::IsPlayerInGroup(players.first, group))
-				members.Add(players.first);
-		}
+		// The map keeps the spelling the group was first cached with
+		permissionGroups.forEach([&all_groups](const FString& group, const CachedGroup&)
+			{
+				all_groups.Add(Permissions::groupNames.canonical(group));
+			});
 
-		return members;
+		return all_groups;
 	}
 
 	std::optional<std::string> AddPlayerToGroup(const FString& eos_id, const FString& group) override
@@ -224,31 +218,28 @@ public:
 		if (groups.Contains(group))
 			return "Player was already added";
 
-		try
-		{
-			groups.AddUnique(group);
+		groups.AddUnique(group);
 
-			FString query_groups("");
+		FString query_groups("");
 
-			for (const FString& f : groups)
-				query_groups += f + ",";
+		for (const FString& f : groups)
+			query_groups += f + ",";
 
-			const bool res = db_.query(fmt::format("UPDATE {} SET PermissionGroups = '{}' WHERE EOS_Id = '{}';", table_players_, query_groups.ToString(), eos_id.ToString()));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, false), [this, eos_id, group, query_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					WritePlayerMembership(eos_id, group);
+				else
+					Execute(fmt::format("UPDATE {} SET PermissionGroups = ? WHERE EOS_Id = ?;", table_players_), query_groups.ToString(), eos_id.ToString());
+			});
+		if (error)
+			return error;
+
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
 			{
-				std::lock_guard<std::mutex> lg(playersMutex);
-				permissionPlayers[eos_id].Groups.AddUnique(group);
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				permission.Groups.AddUnique(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -271,24 +262,21 @@ public:
 				new_groups += current_group + ",";
 		}
 
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET PermissionGroups = '{}' WHERE EOS_Id = '{}';", table_players_, new_groups.ToString(), eos_id.ToString()));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, false), [this, eos_id, group, new_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					DeletePlayerMembership(eos_id, group, false);
+				else
+					Execute(fmt::format("UPDATE {} SET PermissionGroups = ? WHERE EOS_Id = ?;", table_players_), new_groups.ToString(), eos_id.ToString());
+			});
+		if (error)
+			return error;
+
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
 			{
-				std::lock_guard<std::mutex> lg(playersMutex);
-				permissionPlayers[eos_id].Groups.Remove(group);
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				permission.Groups.Remove(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -298,24 +286,19 @@ public:
 		if (IsGroupExists(group))
 			return "Group already exists";
 
-		try
-		{
-			const bool res = db_.query(fmt::format("INSERT INTO {} (GroupName) VALUES ('{}');", table_groups_, group.ToString()));
-			if (!res)
-			{
-				return "Unexpected DB error";
-			}
-			else
+		// Shares its slot with RemoveGroup, so leftovers of a removed group that is re-added before the flush are cleared first
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), "Row", [this, group]()
 			{
-				std::lock_guard<std::mutex> lg(groupsMutex);
-				permissionGroups[group.ToString()] = "";
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				Execute(fmt::format("DELETE FROM {} WHERE GroupName = ?;", table_groups_), group.ToString());
+				if (normalized_)
+					Execute(fmt::format("DELETE FROM {} WHERE GroupName = ?;", table_group_permissions_), group.ToString());
+				Execute(fmt::format("INSERT INTO {} (GroupName) VALUES (?);", table_groups_), group.ToString());
+			});
+		if (error)
+			return error;
+
+		SetGroup(group, CachedGroup());
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -325,77 +308,143 @@ public:
 		if (!IsGroupExists(group))
 			return "Group does not exist";
 
-		// Remove all players from this group
-
-		TArray<FString> group_members = GetGroupMembers(group);
-
-		for (FString player : group_members)
+		// Every member's rows are queued together with the group row, so the whole removal is stored in one transaction
+		std::vector<PendingWrite> writes;
+		std::vector<FString> members, indexed;
+		groupMembers.forEach(group, [&indexed](const FString& eos_id, const GroupMemberIndex::Membership&)
+			{
+				indexed.push_back(eos_id);
+			});
+		for (const auto& eos_id : indexed)
 		{
-			RemovePlayerFromGroup(player, group);
-		}
-
-		// Delete group
+			auto permission = permissionPlayers.find(eos_id);
+			if (!permission)
+				continue;
+			members.push_back(eos_id);
 
-		try
-		{
-			const bool res = db_.query(fmt::format("DELETE FROM {} WHERE GroupName = '{}';", table_groups_, group.ToString()));
-			if (!res)
+			if (permission->Groups.Contains(group))
 			{
-				return "Unexpected DB error";
+				FString new_groups;
+				for (const FString& current_group : permission->Groups)
+				{
+					if (current_group != group)
+						new_groups += current_group + ",";
+				}
+
+				writes.push_back(PendingWrite{ ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, false), [this, eos_id, group, new_groups]()
+					{
+						if (normalized_)
+							DeletePlayerMembership(eos_id, group, false);
+						else
+							Execute(fmt::format("UPDATE {} SET PermissionGroups = ? WHERE EOS_Id = ?;", table_players_), new_groups.ToString(), eos_id.ToString());
+					} });
 			}
-			else
+
+			if (permission->TimedGroups.Contains(group))
 			{
-				std::lock_guard<std::mutex> lg(groupsMutex);
-				permissionGroups.erase(group.ToString());
+				FString new_groups;
+				for (const TimedGroup& current_group : permission->TimedGroups)
+				{
+					if (current_group.GroupName() != group)
+						new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName().ToString());
+				}
+
+				writes.push_back(PendingWrite{ ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, true), [this, eos_id, group, new_groups]()
+					{
+						if (normalized_)
+							DeletePlayerMembership(eos_id, group, true);
+						else
+							Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE EOS_Id = ?;", table_players_), new_groups.ToString(), eos_id.ToString());
+					} });
 			}
 		}
-		catch (const std::exception& exception)
+
+		// Groups inheriting from it lose it as a parent, a group added later under the same name isn't inherited
+		for (auto& [child, parents] : GetChildGroups(group))
 		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
+			writes.push_back(PendingWrite{ ChangeKind::Group, child.ToString(), "Parents", [this, child, parents]()
+				{
+					WriteGroupParents(child, parents);
+				} });
+		}
+
+		// Lazy mode, the players that aren't loaded hold it only in their stored rows
+		if (Permissions::Players::Lazy)
+		{
+			writes.push_back(PendingWrite{ ChangeKind::Group, group.ToString(), "Members", [this, group]()
+				{
+					DeleteGroupMemberships(group);
+				} });
 		}
 
+		writes.push_back(PendingWrite{ ChangeKind::Group, group.ToString(), "Row", [this, group]()
+			{
+				Execute(fmt::format("DELETE FROM {} WHERE GroupName = ?;", table_groups_), group.ToString());
+				if (normalized_)
+					Execute(fmt::format("DELETE FROM {} WHERE GroupName = ?;", table_group_permissions_), group.ToString());
+			} });
+
+		auto error = QueueWrites(std::move(writes));
+		if (error)
+			return error;
+
+		const long long now = std::time(nullptr);
+		UpdatePlayers(members, [&](const FString& eos_id, CachedPermission& permission)
+			{
+				permission.Groups.Remove(group);
+				if (permission.TimedGroups.Remove(TimedGroup{ group, 0, 0 }) > 0)
+					timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, now);
+			});
+		EraseGroup(group);
+		Permissions::Cache::Invalidate();
+
 		return {};
 	}
 
 	std::optional<std::string> GroupGrantPermission(const FString& group, const FString& permission) override
 	{
-		if (!IsGroupExists(group))
+		auto cachedGroup = permissionGroups.find(group);
+		if (!cachedGroup)
 			return "Group does not exist";
 
-		if (Permissions::IsGroupHasPermission(group, permission))
+		// An inherited permission can still be granted, the group then keeps it without the parent
+		if (cachedGroup->hasOwnPermission(permission))
 			return "Group already has this permission";
 
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET Permissions = concat(Permissions, '{},') WHERE GroupName = '{}';", table_groups_, permission.ToString(), group.ToString()));
-			if (!res)
+		// The whole column is written so queued grants to the same group can be coalesced
+		FString new_permissions;
+
+		for (const FString& current_perm : GetGroupPermissions(group))
+			new_permissions += current_perm + ",";
+		new_permissions += permission + ",";
+
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), PermissionSlot(normalized_, permission), [this, group, permission, new_permissions]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					WriteGroupPermission(group, permission);
+				else
+					Execute(fmt::format("UPDATE {} SET Permissions = ? WHERE GroupName = ?;", table_groups_), new_permissions.ToString(), group.ToString());
+			});
+		if (error)
+			return error;
+
+		UpdateGroup(group, [&](CachedGroup& cachedGroup)
 			{
-				std::lock_guard<std::mutex> lg(groupsMutex);
-				std::string groupPermissions = fmt::format("{},{}", permission.ToString(), permissionGroups[group.ToString()]);
-				permissionGroups[group.ToString()] = groupPermissions;
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				cachedGroup.addPermission(permission);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
 
 	std::optional<std::string> GroupRevokePermission(const FString& group, const FString& permission) override
 	{
-		if (!IsGroupExists(group))
+		auto cachedGroup = permissionGroups.find(group);
+		if (!cachedGroup)
 			return "Group does not exist";
 
-		if (!Permissions::IsGroupHasPermission(group, permission))
-			return "Group does not have this permission";
+		if (!cachedGroup->hasOwnPermission(permission))
+			return cachedGroup->hasPermission(permission, false) ? "Permission is inherited from a parent group" : "Group does not have this permission";
 
 		TArray<FString> permissions = GetGroupPermissions(group);
 
@@ -407,24 +456,21 @@ public:
 				new_permissions += current_perm + ",";
 		}
 
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET Permissions = '{}' WHERE GroupName = '{}';", table_groups_, new_permissions.ToString(), group.ToString()));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), PermissionSlot(normalized_, permission), [this, group, permission, new_permissions]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					DeleteGroupPermission(group, permission);
+				else
+					Execute(fmt::format("UPDATE {} SET Permissions = ? WHERE GroupName = ?;", table_groups_), new_permissions.ToString(), group.ToString());
+			});
+		if (error)
+			return error;
+
+		UpdateGroup(group, [&](CachedGroup& cachedGroup)
 			{
-				std::lock_guard<std::mutex> lg(groupsMutex);
-				permissionGroups[group.ToString()] = new_permissions.ToString();
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				cachedGroup.removePermission(permission);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -440,9 +486,7 @@ public:
 		TArray<TimedGroup> groups;
 		if (IsPlayerExists(eos_id))
 		{
-			playersMutex.lock();
-			groups = permissionPlayers[eos_id].TimedGroups;
-			playersMutex.unlock();
+			groups = HydratePlayerGroups(eos_id).TimedGroups;
 		}
 
 		// Pelayori 29-07-2025: Existing timed permissions timer extension
@@ -485,26 +529,24 @@ public:
 		FString new_groups;
 		for (const TimedGroup& current_group : groups)
 		{
-			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
+			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName().ToString());
 		}
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET TimedPermissionGroups = '{}' WHERE EOS_Id = '{}';", table_players_, new_groups.ToString(), eos_id.ToString()));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, true), [this, eos_id, timedGroup = *groups.FindByKey(group), new_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					WritePlayerMembership(eos_id, timedGroup);
+				else
+					Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE EOS_Id = ?;", table_players_), new_groups.ToString(), eos_id.ToString());
+			});
+		if (error)
+			return error;
+
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
 			{
-				std::lock_guard<std::mutex> lg(playersMutex);
-				permissionPlayers[eos_id].TimedGroups = groups;
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				permission.TimedGroups = groups;
+				timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, std::time(nullptr));
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -514,100 +556,73 @@ public:
 		if (!IsPlayerExists(eos_id) || !IsGroupExists(group))
 			return "Player or group does not exist";
 
-		playersMutex.lock();
-		TArray<TimedGroup> groups = permissionPlayers[eos_id].TimedGroups;
-		playersMutex.unlock();
-
+		// Removed by name from the entry the cache holds now, the legacy column is written from that same state
+		TArray<TimedGroup> removed;
 		FString new_groups;
-
-		int32 groupIndex = INDEX_NONE;
-		for (int32 Index = 0; Index != groups.Num(); ++Index)
-		{
-			const TimedGroup& current_group = groups[Index];
-			if (current_group.GroupName != group)
-				new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
-			else
-				groupIndex = Index;
-		}
-		if (groupIndex == INDEX_NONE)
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
+			{
+				removed = TakeTimedGroup(permission.TimedGroups, group);
+				new_groups = JoinTimedGroups(permission.TimedGroups);
+				if (!removed.IsEmpty())
+					timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, std::time(nullptr));
+			});
+		if (removed.IsEmpty())
 			return "Player is not in timed group";
 
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET TimedPermissionGroups = '{}' WHERE EOS_Id = '{}';", table_players_, new_groups.ToString(), eos_id.ToString()));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, true), [this, eos_id, group, new_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
-			{
-				std::lock_guard<std::mutex> lg(playersMutex);
-				permissionPlayers[eos_id].TimedGroups.RemoveAt(groupIndex);
-			}
-		}
-		catch (const std::exception& exception)
+				if (normalized_)
+					DeletePlayerMembership(eos_id, group, true);
+				else
+					Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE EOS_Id = ?;", table_players_), new_groups.ToString(), eos_id.ToString());
+			});
+		if (error)
 		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
+			UpdatePlayer(eos_id, [&](CachedPermission& permission)
+				{
+					permission.TimedGroups.Append(removed);
+					timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, std::time(nullptr));
+				});
+			return error;
 		}
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
 
-	void UpdatePlayerGroupCallbacks(const FString& eos_id, TArray<FString> groups) override
-	{
-		std::lock_guard<std::mutex> lg(playersMutex);
-		permissionPlayers[eos_id].CallbackGroups = groups;
-	}
-
 	bool IsTribeExists(int tribeId) override
 	{
-		bool found = false;
-
-		std::lock_guard<std::mutex> lg(tribesMutex);
-		if (permissionTribes.find(tribeId) == permissionTribes.end())
-			found = false;
-		else
-			found = true;
-
-		return found;
+		return permissionTribes.contains(tribeId);
 	}
 
 	bool AddTribe(int tribeId) override
 	{
-		try
-		{
-			if (db_.query(fmt::format("INSERT INTO {} (TribeId) VALUES ({});", table_tribes_, tribeId)))
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), "Row", [this, tribeId]()
 			{
-				std::lock_guard<std::mutex> lg(tribesMutex);
-				permissionTribes[tribeId] = CachedPermission("", "");
-				return true;
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+				Execute(fmt::format("INSERT INTO {} (TribeId) VALUES (?);", table_tribes_), static_cast<int64_t>(tribeId));
+			});
+		if (error)
 			return false;
-		}
 
-		return false;
+		permissionTribes.set(tribeId, CachedPermission("", ""));
+		Permissions::Cache::Invalidate();
+		return true;
 	}
 
 	TArray<FString> GetTribeGroups(int tribeId, bool includeTimed = true) override
 	{
 		TArray<FString> groups;
 
-		if (IsTribeExists(tribeId))
+		if (auto permission = permissionTribes.find(tribeId))
 		{
-			std::lock_guard<std::mutex> lg(tribesMutex);
 			if (includeTimed)
 			{
 				auto nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-				groups = permissionTribes[tribeId].getGroups(nowSecs);
+				groups = permission->getGroups(nowSecs);
 			}
 			else
 			{
-				groups = permissionTribes[tribeId].Groups;
+				groups = permission->Groups.ToArray();
 			}
 		}
 
@@ -616,8 +631,14 @@ public:
 
 	CachedPermission HydrateTribeGroups(int tribeId) override
 	{
-		std::lock_guard<std::mutex> lg(tribesMutex);
-		return permissionTribes[tribeId];
+		auto permission = permissionTribes.find(tribeId);
+		return permission ? *permission : CachedPermission();
+	}
+
+	long long GetTribeNextTimedBoundary(int tribeId, long long now) override
+	{
+		auto permission = permissionTribes.find(tribeId);
+		return permission ? permission->getNextBoundary(now) : 0;
 	}
 
 	std::optional<std::string> AddTribeToGroup(int tribeId, const FString& group) override
@@ -633,31 +654,28 @@ public:
 		if (groups.Contains(group))
 			return "Tribe was already added";
 
-		try
-		{
-			groups.AddUnique(group);
+		groups.AddUnique(group);
 
-			FString query_groups("");
+		FString query_groups("");
 
-			for (const FString& f : groups)
-				query_groups += f + ",";
+		for (const FString& f : groups)
+			query_groups += f + ",";
 
-			const bool res = db_.query(fmt::format("UPDATE {} SET PermissionGroups = '{}' WHERE TribeId = {};", table_tribes_, query_groups.ToString(), tribeId));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, false), [this, tribeId, group, query_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					WriteTribeMembership(tribeId, group);
+				else
+					Execute(fmt::format("UPDATE {} SET PermissionGroups = ? WHERE TribeId = ?;", table_tribes_), query_groups.ToString(), static_cast<int64_t>(tribeId));
+			});
+		if (error)
+			return error;
+
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
 			{
-				std::lock_guard<std::mutex> lg(tribesMutex);
-				permissionTribes[tribeId].Groups.Add(group);
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				permission.Groups.Add(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -680,24 +698,21 @@ public:
 				new_groups += current_group + ",";
 		}
 
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET PermissionGroups = '{}' WHERE TribeId = {};", table_tribes_, new_groups.ToString(), tribeId));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, false), [this, tribeId, group, new_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					DeleteTribeMembership(tribeId, group, false);
+				else
+					Execute(fmt::format("UPDATE {} SET PermissionGroups = ? WHERE TribeId = ?;", table_tribes_), new_groups.ToString(), static_cast<int64_t>(tribeId));
+			});
+		if (error)
+			return error;
+
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
 			{
-				std::lock_guard<std::mutex> lg(tribesMutex);
-				permissionTribes[tribeId].Groups.Remove(group);
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				permission.Groups.Remove(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -713,9 +728,7 @@ public:
 		TArray<TimedGroup> groups;
 		if (IsTribeExists(tribeId))
 		{
-			tribesMutex.lock();
-			groups = permissionTribes[tribeId].TimedGroups;
-			tribesMutex.unlock();
+			groups = HydrateTribeGroups(tribeId).TimedGroups;
 		}
 
 		// Pelayori 29-07-2025: Existing timed permissions timer extension
@@ -758,26 +771,24 @@ public:
 		FString new_groups;
 		for (const TimedGroup& current_group : groups)
 		{
-			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
+			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName().ToString());
 		}
-		try
-		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET TimedPermissionGroups = '{}' WHERE TribeId = {};", table_tribes_, new_groups.ToString(), tribeId));
-			if (!res)
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, true), [this, tribeId, timedGroup = *groups.FindByKey(group), new_groups]()
 			{
-				return "Unexpected DB error";
-			}
-			else
+				if (normalized_)
+					WriteTribeMembership(tribeId, timedGroup);
+				else
+					Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE TribeId = ?;", table_tribes_), new_groups.ToString(), static_cast<int64_t>(tribeId));
+			});
+		if (error)
+			return error;
+
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
 			{
-				std::lock_guard<std::mutex> lg(tribesMutex);
-				permissionTribes[tribeId].TimedGroups = groups;
-			}
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				permission.TimedGroups = groups;
+				timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, std::time(nullptr));
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -787,90 +798,163 @@ public:
 		if (!IsTribeExists(tribeId) || !IsGroupExists(group))
 			return "Tribe or group does not exist";
 
-		tribesMutex.lock();
-		TArray<TimedGroup> groups = permissionTribes[tribeId].TimedGroups;
-		tribesMutex.unlock();
-
+		// Removed by name from the entry the cache holds now, the legacy column is written from that same state
+		TArray<TimedGroup> removed;
 		FString new_groups;
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
+			{
+				removed = TakeTimedGroup(permission.TimedGroups, group);
+				new_groups = JoinTimedGroups(permission.TimedGroups);
+				if (!removed.IsEmpty())
+					timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, std::time(nullptr));
+			});
+		if (removed.IsEmpty())
+			return "Tribe is not in timed group";
 
-		int32 groupIndex = INDEX_NONE;
-		for (int32 Index = 0; Index != groups.Num(); ++Index)
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, true), [this, tribeId, group, new_groups]()
+			{
+				if (normalized_)
+					DeleteTribeMembership(tribeId, group, true);
+				else
+					Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE TribeId = ?;", table_tribes_), new_groups.ToString(), static_cast<int64_t>(tribeId));
+			});
+		if (error)
 		{
-			const TimedGroup& current_group = groups[Index];
-			if (current_group.GroupName != group)
-				new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
-			else
-				groupIndex = Index;
+			permissionTribes.update(tribeId, [&](CachedPermission& permission)
+				{
+					permission.TimedGroups.Append(removed);
+					timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, std::time(nullptr));
+				});
+			return error;
 		}
-		if (groupIndex == INDEX_NONE)
-			return "Tribe is not in timed group";
+		Permissions::Cache::Invalidate();
+
+		return {};
+	}
+
+	void Init() override
+	{
+		static auto& initStat = Permissions::Stats::Timer("Database.Init");
+		static auto& initRows = Permissions::Stats::Counter("Database.Init rows");
+		Permissions::Stats::ScopedTimer timer(initStat);
+
+		std::lock_guard<std::mutex> syncLock(syncMutex);
+		// Held until the rows are assigned, a flush finishing midway would leave its rows neither pending nor loaded
+		std::lock_guard<std::mutex> flushLock(flushMutex);
 
+		// Queued writes go in first, otherwise the reload would bring back the rows they change
+		FlushWritesLocked();
+
+		GroupRows groups;
+		PlayerRows players;
+		std::unordered_map<int, CachedPermission> tribes;
 		try
 		{
-			const bool res = db_.query(fmt::format("UPDATE {} SET TimedPermissionGroups = '{}' WHERE TribeId = {};", table_tribes_, new_groups.ToString(), tribeId));
-			if (!res)
-			{
-				return "Unexpected DB error";
-			}
-			else
-			{
-				std::lock_guard<std::mutex> lg(tribesMutex);
-				permissionTribes[tribeId].TimedGroups.RemoveAt(groupIndex);
-			}
+			// One transaction so every table is read at the same point, the loaders log their own errors
+			RunInTransaction([&]()
+				{
+					// Read the change log first, anything written while loading gets re-applied by the next delta sync
+					changeCursor = StartChangeCursor();
+
+					// Each map is loaded off to the side and swapped in at once, readers keep the previous version until then
+					groups = InitGroups();
+					players = Permissions::Players::Lazy ? InitTrackedPlayers() : InitPlayers();
+					tribes = InitTribes();
+				});
 		}
 		catch (const std::exception& exception)
 		{
 			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
 		}
+		initRows.add(groups.size() + players.size() + tribes.size());
 
-		return {};
-	}
+		KeepPendingRows(groups, players, tribes);
+		AssignGroups(std::move(groups));
+		AssignPlayers(std::move(players));
+		permissionTribes.assign(std::move(tribes));
 
-	void UpdateTribeGroupCallbacks(int tribeId, TArray<FString> groups) override
-	{
-		std::lock_guard<std::mutex> lg(tribesMutex);
-		permissionTribes[tribeId].CallbackGroups = groups;
+		RescheduleTimedGroups();
+		Permissions::Cache::Invalidate();
 	}
 
-	void Init() override
+	void SyncChanges() override
 	{
-		auto pGroups = InitGroups();
-		groupsMutex.lock();
-		permissionGroups = pGroups;
-		groupsMutex.unlock();
+		static auto& syncStat = Permissions::Stats::Timer("Database.SyncChanges");
+		static auto& syncRows = Permissions::Stats::Counter("Database.SyncChanges rows");
+		Permissions::Stats::ScopedTimer timer(syncStat);
 
-		auto pPlayers = InitPlayers();
-		playersMutex.lock();
-		permissionPlayers = pPlayers;
-		playersMutex.unlock();
+		std::unique_lock<std::mutex> syncLock(syncMutex);
 
-		auto pTribes = InitTribes();
-		tribesMutex.lock();
-		permissionTribes = pTribes;
-		tribesMutex.unlock();
-	}
+		// Later writes are flushed on another pooled connection while the reload runs
+		FlushWrites();
 
-	std::unordered_map<std::string, std::string> InitGroups() override
-	{
-		std::unordered_map<std::string, std::string> pGroups;
+		std::unordered_set<std::string> players, tribes, groups;
+		ChangeCursor next;
+		int changes = 0;
 
 		try
 		{
-			db_.query(fmt::format("SELECT GroupName, Permissions FROM {};", table_groups_))
-				.each([&pGroups](std::string groupName, std::string groupPermissions)
-					{
-						pGroups[groupName] = groupPermissions;
-						return true;
-					});
+			changes = CollectChanges(next, players, tribes, groups);
 		}
 		catch (const std::exception& exception)
 		{
 			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return;
 		}
 
-		return pGroups;
-	}
+		if (changes > MaxDeltaChanges)
+		{
+			syncLock.unlock();
+			Init();
+			return;
+		}
+
+		TakeFailedRows(players, tribes, groups);
+		DropUntrackedPlayers(players);
+
+		if (changes > 0 || !players.empty() || !tribes.empty() || !groups.empty())
+		{
+			// Rows changed again since the flush keep their cached state, their write logs another change
+			std::erase_if(groups, [this](const std::string& key) { return IsReloadBlocked(ChangeKind::Group, key); });
+			std::erase_if(players, [this](const std::string& key) { return IsReloadBlocked(ChangeKind::Player, key); });
+			std::erase_if(tribes, [this](const std::string& key) { return IsReloadBlocked(ChangeKind::Tribe, key); });
+			syncRows.add(groups.size() + players.size() + tribes.size());
+
+			try
+			{
+				ReloadGroups(groups);
+				ReloadPlayers(players);
+				ReloadTribes(tribes);
+			}
+			catch (const std::exception& exception)
+			{
+				// Keep the old cursor so the same changes are retried next sync
+				Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+				return;
+			}
+
+			Permissions::Cache::Invalidate();
+		}
+		changeCursor = std::move(next);
+
+		PruneChanges();
+	}
+
+	std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> InitGroups() override
+	{
+		std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> pGroups;
+
+		try
+		{
+			LoadGroups("", pGroups);
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		return pGroups;
+	}
 
 	std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> InitPlayers() override
 	{
@@ -878,12 +962,7 @@ public:
 
 		try
 		{
-			db_.query(fmt::format("SELECT EOS_Id, PermissionGroups, TimedPermissionGroups FROM {};", table_players_))
-				.each([&pPlayers](std::string eos_id, std::string groups, std::string timedGroups)
-					{
-						pPlayers[FString(eos_id.c_str())] = CachedPermission(FString(groups.c_str()), FString(timedGroups.c_str()));
-						return true;
-					});
+			LoadPlayers("", pPlayers);
 		}
 		catch (const std::exception& exception)
 		{
@@ -893,18 +972,33 @@ public:
 		return pPlayers;
 	}
 
+	// Lazy mode reloads only the players being tracked, what is cached stays if that fails
+	PlayerRows InitTrackedPlayers()
+	{
+		try
+		{
+			return LoadPlayerRows(residency.keys());
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		PlayerRows cached;
+		permissionPlayers.forEach([&cached](const FString& eos_id, const CachedPermission& permission)
+			{
+				cached.emplace(eos_id, permission);
+			});
+		return cached;
+	}
+
 	std::unordered_map<int, CachedPermission> InitTribes() override
 	{
 		std::unordered_map<int, CachedPermission> pTribes;
 
 		try
 		{
-			db_.query(fmt::format("SELECT TribeId, PermissionGroups, TimedPermissionGroups FROM {};", table_tribes_))
-				.each([&pTribes](int tribeId, std::string groups, std::string timedGroups)
-					{
-						pTribes[tribeId] = CachedPermission(groups.c_str(), timedGroups.c_str());
-						return true;
-					});
+			LoadTribes("", pTribes);
 		}
 		catch (const std::exception& exception)
 		{
@@ -916,12 +1010,657 @@ public:
 
 	void upgradeDatabase(std::string db_name)
 	{
+		if (!IsFieldExists(table_groups_, "Parents"))
+		{
+			try
+			{
+				auto db = pool_.acquire();
+				db->exec(fmt::format("ALTER TABLE {} ADD COLUMN Parents VARCHAR(768) NOT NULL DEFAULT '';", table_groups_));
+			}
+			catch (const std::exception& exception)
+			{
+				Log::GetLog()->critical("({} {}) Failed to update Permissions groups table! {}", __FILE__, __FUNCTION__, exception.what());
+			}
+		}
+	}
+
+	std::string GetSnapshotIdentity() override
+	{
+		return identity_ + (normalized_ ? ":normalized" : "");
+	}
+
+	long long GetChangeWatermark() override
+	{
+		long long watermark = 0;
+
+		try
+		{
+			Select<int64_t>(fmt::format("SELECT IFNULL(MAX(Id), 0) FROM {};", table_changes_), [&watermark](int64_t maxId)
+				{
+					watermark = maxId;
+				});
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		return watermark;
+	}
+
+	void ReadChanges(long long after, const std::function<void(long long, ChangeKind, const std::string&)>& fn) override
+	{
+		Select<int64_t, int32_t, std::string>(fmt::format("SELECT Id, Kind, RowKey FROM {} WHERE Id > ? ORDER BY Id;", table_changes_),
+			[&fn](int64_t id, int32_t kind, const std::string& key)
+				{
+					fn(id, static_cast<ChangeKind>(kind), key);
+				}, static_cast<int64_t>(after));
+	}
+
+	void LogChange(ChangeKind kind, const std::string& key) override
+	{
+		Execute(fmt::format("INSERT INTO {} (Kind, RowKey, ChangedAt) VALUES (?, ?, ?);", table_changes_),
+			static_cast<int32_t>(kind), key, static_cast<int64_t>(std::time(nullptr)));
+	}
+
+	// The lease is held until the end, so every statement body runs on this thread uses the same connection
+	void RunInTransaction(const std::function<void()>& body) override
+	{
+		auto db = pool_.acquire();
+		db->exec("START TRANSACTION;");
+		try
+		{
+			body();
+			db->exec("COMMIT;");
+		}
+		catch (const std::exception&)
+		{
+			db->exec("ROLLBACK;");
+			throw;
+		}
+	}
+
+	// The legacy columns are only written with the legacy schema, they would overflow with long membership lists
+	void ImportGroupRow(const FString& group, const TArray<FString>& permissions, const TArray<FString>& parents) override
+	{
+		Execute(fmt::format("INSERT INTO {} (GroupName, Permissions, Parents) VALUES (?, ?, ?) "
+			"ON DUPLICATE KEY UPDATE Permissions = VALUES(Permissions), Parents = VALUES(Parents);", table_groups_),
+			group.ToString(), normalized_ ? std::string() : JoinNames(permissions).ToString(), JoinNames(parents).ToString());
+
+		if (normalized_)
+		{
+			Execute(fmt::format("DELETE FROM {} WHERE GroupName = ?;", table_group_permissions_), group.ToString());
+			for (const auto& permission : permissions)
+				WriteGroupPermission(group, permission);
+		}
+	}
+
+	void WriteGroupParents(const FString& group, const TArray<FString>& parents) override
+	{
+		Execute(fmt::format("UPDATE {} SET Parents = ? WHERE GroupName = ?;", table_groups_), JoinNames(parents).ToString(), group.ToString());
+	}
+
+	void ImportPlayerRow(const FString& eos_id, const CachedPermission& permission) override
+	{
+		Execute(fmt::format("INSERT INTO {} (EOS_Id, PermissionGroups, TimedPermissionGroups) VALUES (?, ?, ?) "
+			"ON DUPLICATE KEY UPDATE PermissionGroups = VALUES(PermissionGroups), TimedPermissionGroups = VALUES(TimedPermissionGroups);", table_players_),
+			eos_id.ToString(), normalized_ ? std::string() : JoinNames(permission.Groups).ToString(),
+			normalized_ ? std::string() : JoinTimedGroups(permission.TimedGroups).ToString());
+
+		if (normalized_)
+		{
+			Execute(fmt::format("DELETE FROM {} WHERE EOS_Id = ?;", table_player_groups_), eos_id.ToString());
+			for (const auto& group : permission.Groups)
+				WritePlayerMembership(eos_id, group);
+			for (const auto& group : permission.TimedGroups)
+				WritePlayerMembership(eos_id, group);
+		}
+	}
+
+	void ImportTribeRow(int tribeId, const CachedPermission& permission) override
+	{
+		Execute(fmt::format("INSERT INTO {} (TribeId, PermissionGroups, TimedPermissionGroups) VALUES (?, ?, ?) "
+			"ON DUPLICATE KEY UPDATE PermissionGroups = VALUES(PermissionGroups), TimedPermissionGroups = VALUES(TimedPermissionGroups);", table_tribes_),
+			static_cast<int64_t>(tribeId), normalized_ ? std::string() : JoinNames(permission.Groups).ToString(),
+			normalized_ ? std::string() : JoinTimedGroups(permission.TimedGroups).ToString());
+
+		if (normalized_)
+		{
+			Execute(fmt::format("DELETE FROM {} WHERE TribeId = ?;", table_tribe_groups_), static_cast<int64_t>(tribeId));
+			for (const auto& group : permission.Groups)
+				WriteTribeMembership(tribeId, group);
+			for (const auto& group : permission.TimedGroups)
+				WriteTribeMembership(tribeId, group);
+		}
+	}
+
+	void DeleteExpiredTimedGroups(ChangeKind kind, const std::string& key, long long expiredBefore) override
+	{
+		const bool player = kind == ChangeKind::Player;
+		if (normalized_)
+		{
+			if (player)
+				Execute(fmt::format("DELETE FROM {} WHERE EOS_Id = ? AND Timed = 1 AND ExpireAt > 0 AND ExpireAt <= ?;", table_player_groups_),
+					key, static_cast<int64_t>(expiredBefore));
+			else
+				Execute(fmt::format("DELETE FROM {} WHERE TribeId = ? AND Timed = 1 AND ExpireAt > 0 AND ExpireAt <= ?;", table_tribe_groups_),
+					static_cast<int64_t>(std::stoll(key)), static_cast<int64_t>(expiredBefore));
+			return;
+		}
+
+		std::optional<CachedPermission> stored;
+		if (player)
+		{
+			PlayerRows loaded;
+			LoadPlayers("WHERE p.EOS_Id = ?", loaded, key);
+			if (!loaded.empty())
+				stored = std::move(loaded.begin()->second);
+		}
+		else
+		{
+			std::unordered_map<int, CachedPermission> loaded;
+			LoadTribes("WHERE t.TribeId = ?", loaded, static_cast<int64_t>(std::stoll(key)));
+			if (!loaded.empty())
+				stored = std::move(loaded.begin()->second);
+		}
+		if (!stored || RemoveExpiredTimedGroups(stored->TimedGroups, expiredBefore) == 0)
+			return;
+
+		const std::string timedGroups = JoinTimedGroups(stored->TimedGroups).ToString();
+		if (player)
+			Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE EOS_Id = ?;", table_players_), timedGroups, key);
+		else
+			Execute(fmt::format("UPDATE {} SET TimedPermissionGroups = ? WHERE TribeId = ?;", table_tribes_), timedGroups, static_cast<int64_t>(std::stoll(key)));
+	}
+
+	bool ReadExpiredPlayers(std::string& after, size_t limit, long long expiredBefore, std::vector<std::pair<std::string, int>>& expired) override
+	{
+		// after changes while the rows are fetched, the statement gets a copy
+		const std::string from = after;
+		size_t read = 0;
+		if (normalized_)
+		{
+			Select<std::string, int64_t>(fmt::format("SELECT EOS_Id, COUNT(*) FROM {} WHERE EOS_Id > ? AND Timed = 1 AND ExpireAt > 0 AND ExpireAt <= ? "
+				"GROUP BY EOS_Id ORDER BY EOS_Id LIMIT ?;", table_player_groups_),
+				[&](const std::string& eos_id, int64_t count)
+					{
+						after = eos_id;
+						expired.emplace_back(eos_id, static_cast<int>(count));
+						++read;
+					}, from, static_cast<int64_t>(expiredBefore), static_cast<int64_t>(limit));
+			return read == limit;
+		}
+
+		Select<std::string, std::string>(fmt::format("SELECT EOS_Id, TimedPermissionGroups FROM {} WHERE EOS_Id > ? AND TimedPermissionGroups <> '' "
+			"ORDER BY EOS_Id LIMIT ?;", table_players_),
+			[&](const std::string& eos_id, const std::string& timedGroups)
+				{
+					after = eos_id;
+					if (const int count = CountExpiredTimedGroups(CachedPermission("", timedGroups.c_str()).TimedGroups, expiredBefore); count > 0)
+						expired.emplace_back(eos_id, count);
+					++read;
+				}, from, static_cast<int64_t>(limit));
+		return read == limit;
+	}
+
+	bool ReadPlayerPage(std::string& after, size_t limit, PlayerRows& rows) override
+	{
+		std::unordered_set<std::string> keys;
+		std::string last = after;
+		Select<std::string>(fmt::format("SELECT EOS_Id FROM {} WHERE EOS_Id > ? ORDER BY EOS_Id LIMIT ?;", table_players_),
+			[&keys, &last](const std::string& eos_id)
+				{
+					keys.insert(eos_id);
+					last = eos_id;
+				}, after, static_cast<int64_t>(limit));
+		after = last;
+		rows = LoadPlayerRows(keys);
+		return keys.size() == limit;
+	}
+
+	void PruneChanges()
+	{
+		const time_t now = std::time(nullptr);
+		if (now - lastChangePrune < 3600)
+			return;
+
+		lastChangePrune = now;
+
+		try
+		{
+			Execute(fmt::format("DELETE FROM {} WHERE ChangedAt < ?;", table_changes_), static_cast<int64_t>(now - ChangeLogRetentionSecs));
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+	}
+
+	/// <summary>
+	/// Runs a prepared statement from the pool, args are bound by reference. Throws on failure, the failed statement
+	/// is dropped so a broken one (e.g. after a reconnect) gets prepared again.
+	/// </summary>
+	template <typename... Args>
+	void Execute(const std::string& sql, const Args&... args)
+	{
+		auto db = pool_.acquire();
+		auto& statement = db.statement(sql);
+		if constexpr (sizeof...(Args) > 0)
+			statement.bind_param(args...);
+		if (!statement.execute())
+			Fail(db, sql, statement);
+	}
+
+	// Like Execute, then calls fn with every row read into Columns
+	template <typename... Columns, typename Fn, typename... Args>
+	void Select(const std::string& sql, Fn&& fn, const Args&... args)
+	{
+		auto db = pool_.acquire();
+		auto& statement = db.statement(sql);
+		if constexpr (sizeof...(Args) > 0)
+			statement.bind_param(args...);
+		if (!statement.execute())
+			Fail(db, sql, statement);
+
+		std::tuple<Columns...> row;
+		std::apply([&statement](auto&... columns) { statement.bind_result(columns...); }, row);
+		while (statement.fetch())
+			std::apply(fn, row);
+		if (statement.error_code() != 0)
+			Fail(db, sql, statement);
+	}
+
+	[[noreturn]] static void Fail(MysqlConnectionPool::Lease& db, const std::string& sql, daotk::mysql::prepared_stmt& statement)
+	{
+		const std::string error = statement.error_message();
+		db.discard(sql);
+		throw std::runtime_error(error);
+	}
+
+	// Keys per delta reload statement
+	static constexpr size_t ReloadChunkSize = 100;
+
+	static std::string Placeholders(size_t count)
+	{
+		std::string placeholders;
+		for (size_t i = 0; i < count; ++i)
+			placeholders += i == 0 ? "?" : ",?";
+		return placeholders;
+	}
+
+	/// <summary>
+	/// Splits keys into IN (?, ...) sized chunks so one sync doesn't turn into hundreds of round trips. Short chunks are
+	/// padded by repeating their last key, every reload then reuses the same prepared statement.
+	/// </summary>
+	template <typename Fn>
+	static void ForEachKeyChunk(const std::unordered_set<std::string>& keys, Fn&& fn)
+	{
+		std::vector<std::string> chunk;
+		auto flush = [&chunk, &fn]()
+			{
+				std::array<std::string, ReloadChunkSize> bound;
+				for (size_t i = 0; i < bound.size(); ++i)
+					bound[i] = chunk[std::min(i, chunk.size() - 1)];
+				fn(chunk, bound);
+				chunk.clear();
+			};
+
+		for (const auto& key : keys)
+		{
+			chunk.push_back(key);
+			if (chunk.size() == ReloadChunkSize)
+				flush();
+		}
+		if (!chunk.empty())
+			flush();
+	}
+
+	void ReloadGroups(const std::unordered_set<std::string>& groups)
+	{
+		ForEachKeyChunk(groups, [&](const std::vector<std::string>& chunk, const std::array<std::string, ReloadChunkSize>& bound)
+			{
+				std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> loaded;
+				std::apply([&](const auto&... keys)
+					{
+						LoadGroups(fmt::format("WHERE g.GroupName IN ({})", Placeholders(ReloadChunkSize)), loaded, keys...);
+					}, bound);
+
+				for (const auto& group : chunk)
+				{
+					auto loadedGroup = loaded.find(FString(group.c_str()));
+					if (loadedGroup != loaded.end())
+						SetGroup(loadedGroup->first, std::move(loadedGroup->second));
+					else
+						EraseGroup(FString(group.c_str()));
+				}
+			});
+	}
+
+	void ReloadPlayers(const std::unordered_set<std::string>& players)
+	{
+		auto loaded = LoadPlayerRows(players);
+		std::vector<FString> keys;
+		keys.reserve(players.size());
+		for (const auto& eos_id : players)
+			keys.emplace_back(eos_id.c_str());
+		SetPlayers(keys, loaded);
+	}
+
+	PlayerRows LoadPlayerRows(const std::unordered_set<std::string>& players) override
+	{
+		PlayerRows loaded;
+		ForEachKeyChunk(players, [&](const std::vector<std::string>&, const std::array<std::string, ReloadChunkSize>& bound)
+			{
+				std::apply([&](const auto&... keys)
+					{
+						LoadPlayers(fmt::format("WHERE p.EOS_Id IN ({})", Placeholders(ReloadChunkSize)), loaded, keys...);
+					}, bound);
+			});
+		return loaded;
+	}
+
+	std::optional<TArray<FString>> LoadGroupMemberIds(const FString& group, long long now) override
+	{
+		if (!normalized_)
+			return std::nullopt;
+
+		TArray<FString> members;
+		Select<std::string>(fmt::format("SELECT DISTINCT EOS_Id FROM {} WHERE GroupName = ? "
+			"AND (Timed = 0 OR ((DelayUntil <= 0 OR DelayUntil <= ?) AND ExpireAt > ?));", table_player_groups_),
+			[&members](const std::string& eos_id)
+				{
+					members.Add(FString(eos_id.c_str()));
+				}, group.ToString(), static_cast<int64_t>(now), static_cast<int64_t>(now));
+		return members;
+	}
+
+	void DeleteGroupMemberships(const FString& group) override
+	{
+		std::vector<std::string> changed;
+		if (normalized_)
+		{
+			Select<std::string>(fmt::format("SELECT DISTINCT EOS_Id FROM {} WHERE GroupName = ?;", table_player_groups_),
+				[&changed](const std::string& eos_id)
+					{
+						changed.push_back(eos_id);
+					}, group.ToString());
+			Execute(fmt::format("DELETE FROM {} WHERE GroupName = ?;", table_player_groups_), group.ToString());
+		}
+		else
+		{
+			// Also matches other groups containing the name, only rows that held the group are written
+			const std::string pattern = "%" + group.ToString() + "%";
+			PlayerRows stored;
+			LoadPlayers("WHERE p.PermissionGroups LIKE ? OR p.TimedPermissionGroups LIKE ?", stored, pattern, pattern);
+			for (auto& [eos_id, permission] : stored)
+			{
+				if (permission.Groups.Remove(group) + permission.TimedGroups.Remove(TimedGroup{ group, 0, 0 }) == 0)
+					continue;
+
+				Execute(fmt::format("UPDATE {} SET PermissionGroups = ?, TimedPermissionGroups = ? WHERE EOS_Id = ?;", table_players_),
+					JoinNames(permission.Groups).ToString(), JoinTimedGroups(permission.TimedGroups).ToString(), eos_id.ToString());
+				changed.push_back(eos_id.ToString());
+			}
+		}
+
+		for (const auto& eos_id : changed)
+			LogChange(ChangeKind::Player, eos_id);
+	}
+
+	void ReloadTribes(const std::unordered_set<std::string>& tribes)
+	{
+		std::unordered_map<int, CachedPermission> loaded;
+		ForEachKeyChunk(tribes, [&](const std::vector<std::string>&, const std::array<std::string, ReloadChunkSize>& bound)
+			{
+				std::array<int64_t, ReloadChunkSize> tribeIds;
+				for (size_t i = 0; i < bound.size(); ++i)
+					tribeIds[i] = std::stoll(bound[i]);
+
+				std::apply([&](const auto&... keys)
+					{
+						LoadTribes(fmt::format("WHERE t.TribeId IN ({})", Placeholders(ReloadChunkSize)), loaded, keys...);
+					}, tribeIds);
+			});
+
+		std::vector<int> keys;
+		keys.reserve(tribes.size());
+		for (const auto& tribeId : tribes)
+			keys.push_back(std::stoi(tribeId));
+		SetTribes(keys, loaded);
+	}
+
+	// Legacy rows keep memberships as comma strings, the normalized schema has one row per membership. args are bound to the ? in where
+	template <typename... Args>
+	void LoadPlayers(const std::string& where, std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual>& players, const Args&... args)
+	{
+		if (!normalized_)
+		{
+			Select<std::string, std::string, std::string>(fmt::format("SELECT p.EOS_Id, p.PermissionGroups, p.TimedPermissionGroups FROM {} p {};", table_players_, where),
+				[&players](const std::string& eos_id, const std::string& groups, const std::string& timedGroups)
+					{
+						players[FString(eos_id.c_str())] = CachedPermission(FString(groups.c_str()), FString(timedGroups.c_str()));
+					}, args...);
+			return;
+		}
+
+		Select<std::string, std::string, int32_t, int64_t, int64_t>(fmt::format("SELECT p.EOS_Id, m.GroupName, COALESCE(m.Timed, 0), COALESCE(m.DelayUntil, 0), COALESCE(m.ExpireAt, 0) "
+			"FROM {} p LEFT JOIN {} m ON m.EOS_Id = p.EOS_Id {};", table_players_, table_player_groups_, where),
+			[&players](const std::string& eos_id, const std::string& groupName, int32_t timed, int64_t delayUntil, int64_t expireAt)
+				{
+					auto& permission = players[FString(eos_id.c_str())];
+					if (!groupName.empty())
+						permission.addMembership(FString(groupName.c_str()), timed != 0, delayUntil, expireAt);
+				}, args...);
+	}
+
+	template <typename... Args>
+	void LoadTribes(const std::string& where, std::unordered_map<int, CachedPermission>& tribes, const Args&... args)
+	{
+		if (!normalized_)
+		{
+			Select<int32_t, std::string, std::string>(fmt::format("SELECT t.TribeId, t.PermissionGroups, t.TimedPermissionGroups FROM {} t {};", table_tribes_, where),
+				[&tribes](int32_t tribeId, const std::string& groups, const std::string& timedGroups)
+					{
+						tribes[tribeId] = CachedPermission(groups.c_str(), timedGroups.c_str());
+					}, args...);
+			return;
+		}
+
+		Select<int32_t, std::string, int32_t, int64_t, int64_t>(fmt::format("SELECT t.TribeId, m.GroupName, COALESCE(m.Timed, 0), COALESCE(m.DelayUntil, 0), COALESCE(m.ExpireAt, 0) "
+			"FROM {} t LEFT JOIN {} m ON m.TribeId = t.TribeId {};", table_tribes_, table_tribe_groups_, where),
+			[&tribes](int32_t tribeId, const std::string& groupName, int32_t timed, int64_t delayUntil, int64_t expireAt)
+				{
+					auto& permission = tribes[tribeId];
+					if (!groupName.empty())
+						permission.addMembership(FString(groupName.c_str()), timed != 0, delayUntil, expireAt);
+				}, args...);
+	}
+
+	template <typename... Args>
+	void LoadGroups(const std::string& where, std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual>& groups, const Args&... args)
+	{
+		if (!normalized_)
+		{
+			Select<std::string, std::string, std::string>(fmt::format("SELECT g.GroupName, g.Permissions, g.Parents FROM {} g {};", table_groups_, where),
+				[&groups](const std::string& groupName, const std::string& groupPermissions, const std::string& groupParents)
+					{
+						groups[FString(groupName.c_str())] = CachedGroup(FString(groupPermissions.c_str()), FString(groupParents.c_str()));
+					}, args...);
+			return;
+		}
+
+		// Parents repeat on every permission row of the group
+		Select<std::string, std::string, std::string>(fmt::format("SELECT g.GroupName, m.Permission, g.Parents FROM {} g LEFT JOIN {} m ON m.GroupName = g.GroupName {};", table_groups_, table_group_permissions_, where),
+			[&groups](const std::string& groupName, const std::string& permission, const std::string& groupParents)
+				{
+					auto& group = groups.try_emplace(FString(groupName.c_str()), FString(), FString(groupParents.c_str())).first->second;
+					if (!permission.empty())
+						group.addPermission(FString(permission.c_str()));
+				}, args...);
+	}
+
+	void WritePlayerMembership(const FString& eos_id, const FString& group)
+	{
+		Execute(fmt::format("INSERT INTO {} (EOS_Id, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 0, 0, 0) "
+			"ON DUPLICATE KEY UPDATE DelayUntil = 0;", table_player_groups_), eos_id.ToString(), group.ToString());
+	}
+
+	void WritePlayerMembership(const FString& eos_id, const TimedGroup& group)
+	{
+		Execute(fmt::format("INSERT INTO {} (EOS_Id, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 1, ?, ?) "
+			"ON DUPLICATE KEY UPDATE DelayUntil = VALUES(DelayUntil), ExpireAt = VALUES(ExpireAt);", table_player_groups_),
+			eos_id.ToString(), group.GroupName().ToString(), static_cast<int64_t>(group.DelayUntilTime), static_cast<int64_t>(group.ExpireAtTime));
+	}
+
+	void DeletePlayerMembership(const FString& eos_id, const FString& group, bool timed)
+	{
+		Execute(fmt::format("DELETE FROM {} WHERE EOS_Id = ? AND GroupName = ? AND Timed = ?;", table_player_groups_),
+			eos_id.ToString(), group.ToString(), static_cast<int32_t>(timed ? 1 : 0));
+	}
+
+	void WriteTribeMembership(int tribeId, const FString& group)
+	{
+		Execute(fmt::format("INSERT INTO {} (TribeId, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 0, 0, 0) "
+			"ON DUPLICATE KEY UPDATE DelayUntil = 0;", table_tribe_groups_), static_cast<int64_t>(tribeId), group.ToString());
+	}
+
+	void WriteTribeMembership(int tribeId, const TimedGroup& group)
+	{
+		Execute(fmt::format("INSERT INTO {} (TribeId, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 1, ?, ?) "
+			"ON DUPLICATE KEY UPDATE DelayUntil = VALUES(DelayUntil), ExpireAt = VALUES(ExpireAt);", table_tribe_groups_),
+			static_cast<int64_t>(tribeId), group.GroupName().ToString(), static_cast<int64_t>(group.DelayUntilTime), static_cast<int64_t>(group.ExpireAtTime));
+	}
+
+	void DeleteTribeMembership(int tribeId, const FString& group, bool timed)
+	{
+		Execute(fmt::format("DELETE FROM {} WHERE TribeId = ? AND GroupName = ? AND Timed = ?;", table_tribe_groups_),
+			static_cast<int64_t>(tribeId), group.ToString(), static_cast<int32_t>(timed ? 1 : 0));
+	}
+
+	void WriteGroupPermission(const FString& group, const FString& permission)
+	{
+		Execute(fmt::format("INSERT IGNORE INTO {} (GroupName, Permission) VALUES (?, ?);", table_group_permissions_), group.ToString(), permission.ToString());
+	}
 
+	void DeleteGroupPermission(const FString& group, const FString& permission)
+	{
+		Execute(fmt::format("DELETE FROM {} WHERE GroupName = ? AND Permission = ?;", table_group_permissions_), group.ToString(), permission.ToString());
+	}
+
+	/// <summary>
+	/// Creates the normalized membership tables. The first time they are created the legacy comma-joined columns are
+	/// copied over in one transaction, if that fails the tables are dropped again and the legacy schema stays in use.
+	/// </summary>
+	bool PrepareNormalizedSchema()
+	{
+		// Held throughout so the migration's transaction and inserts share one connection
+		auto db = pool_.acquire();
+
+		try
+		{
+			int64_t tables = 0;
+			Select<int64_t>("SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = DATABASE() AND table_name = ?;",
+				[&tables](int64_t count) { tables = count; }, table_player_groups_);
+			if (tables > 0)
+				return true;
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->critical("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return false;
+		}
+
+		try
+		{
+			// Parse the legacy columns before the tables exist, so the loaders still read the old layout
+			normalized_ = false;
+			auto players = InitPlayers();
+			auto tribes = InitTribes();
+			auto groups = InitGroups();
+			normalized_ = true;
+
+			db->exec(fmt::format("CREATE TABLE {} ("
+				"EOS_Id VARCHAR(50) NOT NULL,"
+				"GroupName VARCHAR(128) NOT NULL,"
+				"Timed TINYINT NOT NULL DEFAULT 0,"
+				"DelayUntil BIGINT NOT NULL DEFAULT 0,"
+				"ExpireAt BIGINT NOT NULL DEFAULT 0,"
+				"PRIMARY KEY(EOS_Id, GroupName, Timed),"
+				"INDEX GroupName_INDEX (GroupName ASC));", table_player_groups_));
+			db->exec(fmt::format("CREATE TABLE {} ("
+				"TribeId BIGINT(11) NOT NULL,"
+				"GroupName VARCHAR(128) NOT NULL,"
+				"Timed TINYINT NOT NULL DEFAULT 0,"
+				"DelayUntil BIGINT NOT NULL DEFAULT 0,"
+				"ExpireAt BIGINT NOT NULL DEFAULT 0,"
+				"PRIMARY KEY(TribeId, GroupName, Timed),"
+				"INDEX GroupName_INDEX (GroupName ASC));", table_tribe_groups_));
+			db->exec(fmt::format("CREATE TABLE {} ("
+				"GroupName VARCHAR(128) NOT NULL,"
+				"Permission VARCHAR(128) NOT NULL,"
+				"PRIMARY KEY(GroupName, Permission));", table_group_permissions_));
+
+			// CREATE TABLE commits implicitly, so the transaction only covers the copy. Every row goes through the same
+			// prepared statement of its table, names are bound rather than spliced into the SQL
+			const std::string insertPlayer = fmt::format("INSERT IGNORE INTO {} (EOS_Id, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, ?, ?, ?);", table_player_groups_);
+			const std::string insertTribe = fmt::format("INSERT IGNORE INTO {} (TribeId, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, ?, ?, ?);", table_tribe_groups_);
+			const std::string insertPermission = fmt::format("INSERT IGNORE INTO {} (GroupName, Permission) VALUES (?, ?);", table_group_permissions_);
+			RunInTransaction([&]()
+				{
+					for (const auto& player : players)
+					{
+						const std::string eos_id = player.first.ToString();
+						for (const auto& group : player.second.Groups)
+							Execute(insertPlayer, eos_id, group.ToString(), static_cast<int32_t>(0), static_cast<int64_t>(0), static_cast<int64_t>(0));
+						for (const auto& group : player.second.TimedGroups)
+							Execute(insertPlayer, eos_id, group.GroupName().ToString(), static_cast<int32_t>(1), static_cast<int64_t>(group.DelayUntilTime), static_cast<int64_t>(group.ExpireAtTime));
+					}
+					for (const auto& tribe : tribes)
+					{
+						const int64_t tribeId = tribe.first;
+						for (const auto& group : tribe.second.Groups)
+							Execute(insertTribe, tribeId, group.ToString(), static_cast<int32_t>(0), static_cast<int64_t>(0), static_cast<int64_t>(0));
+						for (const auto& group : tribe.second.TimedGroups)
+							Execute(insertTribe, tribeId, group.GroupName().ToString(), static_cast<int32_t>(1), static_cast<int64_t>(group.DelayUntilTime), static_cast<int64_t>(group.ExpireAtTime));
+					}
+					for (const auto& group : groups)
+					{
+						const std::string name = group.first.ToString();
+						for (const auto& permission : group.second.PermissionList)
+							Execute(insertPermission, name, permission.ToString());
+					}
+				});
+
+			Log::GetLog()->info("Migrated {} players, {} tribes and {} groups to the normalized schema", players.size(), tribes.size(), groups.size());
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->critical("({} {}) Failed to migrate to the normalized schema, using legacy columns! {}", __FILE__, __FUNCTION__, exception.what());
+
+			try
+			{
+				db->exec(fmt::format("DROP TABLE IF EXISTS {}, {}, {};", table_player_groups_, table_tribe_groups_, table_group_permissions_));
+			}
+			catch (const std::exception&)
+			{
+			}
+			return false;
+		}
+
+		return true;
 	}
 
 private:
-	daotk::mysql::connection db_;
+	MysqlConnectionPool pool_;
 	std::string table_players_;
 	std::string table_tribes_;
 	std::string table_groups_;
+	std::string table_changes_;
+	std::string table_player_groups_;
+	std::string table_tribe_groups_;
+	std::string table_group_permissions_;
+	// Server, database and tables, for GetSnapshotIdentity
+	std::string identity_;
+	// Memberships in the PlayerGroups/TribeGroups/GroupPermissions tables instead of the comma-joined columns
+	bool normalized_;
 };
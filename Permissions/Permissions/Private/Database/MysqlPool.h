@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mysql++11.h>
+
+#include "../Public/Permissions.h"
+
+/// <summary>
+/// Fixed set of MySQL connections, so a sync, the background writer and commands don't wait on each other's queries.
+/// A thread keeps the connection it leased until its outermost lease ends, everything inside a transaction therefore
+/// runs on the same connection. Prepared statements are kept per connection and reused.
+/// </summary>
+class MysqlConnectionPool {
+	struct Slot {
+		daotk::mysql::connection Connection;
+		// Declared after Connection so the statements are closed before it
+		std::unordered_map<std::string, std::unique_ptr<daotk::mysql::prepared_stmt>> Statements;
+		std::thread::id Owner;
+		int Depth = 0;
+	};
+
+public:
+	class Lease {
+	public:
+		Lease(MysqlConnectionPool& pool, Slot& slot)
+			: pool(pool), slot(slot)
+		{
+		}
+
+		~Lease()
+		{
+			pool.release(slot);
+		}
+
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+
+		daotk::mysql::connection* operator->()
+		{
+			return &slot.Connection;
+		}
+
+		// Prepared on first use, throws if the server rejects the statement
+		daotk::mysql::prepared_stmt& statement(const std::string& sql)
+		{
+			auto& statement = slot.Statements[sql];
+			if (!statement)
+			{
+				try
+				{
+					statement = std::make_unique<daotk::mysql::prepared_stmt>(slot.Connection, sql);
+				}
+				catch (...)
+				{
+					slot.Statements.erase(sql);
+					throw;
+				}
+			}
+			return *statement;
+		}
+
+		// Drops a statement that failed, it is prepared again on next use (e.g. after a reconnect)
+		void discard(const std::string& sql)
+		{
+			slot.Statements.erase(sql);
+		}
+
+	private:
+		MysqlConnectionPool& pool;
+		Slot& slot;
+	};
+
+	// Opens up to size connections, returns false if not even one could be opened
+	bool open(const daotk::mysql::connect_options& options, size_t size)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		for (size_t i = 0; i < std::max<size_t>(size, 1); ++i)
+		{
+			auto slot = std::make_unique<Slot>();
+			if (!slot->Connection.open(options))
+			{
+				if (!slots.empty())
+					Log::GetLog()->warn("Opened {} of {} database connections", slots.size(), size);
+				break;
+			}
+			slots.push_back(std::move(slot));
+		}
+		return !slots.empty();
+	}
+
+	// Blocks until a connection is free, a thread that already holds one gets the same connection back
+	Lease acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (slots.empty())
+			throw std::runtime_error("No database connection");
+
+		const auto self = std::this_thread::get_id();
+		for (auto& slot : slots)
+		{
+			if (slot->Depth > 0 && slot->Owner == self)
+			{
+				++slot->Depth;
+				return Lease(*this, *slot);
+			}
+		}
+
+		Slot* free = nullptr;
+		available.wait(lock, [this, &free]()
+			{
+				for (auto& slot : slots)
+				{
+					if (slot->Depth == 0)
+					{
+						free = slot.get();
+						return true;
+					}
+				}
+				return false;
+			});
+
+		free->Owner = self;
+		free->Depth = 1;
+		return Lease(*this, *free);
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return slots.size();
+	}
+
+private:
+	void release(Slot& slot)
+	{
+		{
+			std::lock_guard<std::mutex> lg(mutex);
+			if (--slot.Depth > 0)
+				return;
+			slot.Owner = std::thread::id();
+		}
+		available.notify_one();
+	}
+
+	std::mutex mutex;
+	std::condition_variable available;
+	std::vector<std::unique_ptr<Slot>> slots;
+};
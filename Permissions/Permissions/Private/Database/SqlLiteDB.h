@@ -1,6 +1,7 @@
 #pragma once
 
 #include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Transaction.h>
 
 #include "IDatabase.h"
 #include "../Main.h"
@@ -8,14 +9,17 @@
 class SqlLite : public IDatabase
 {
 public:
-	explicit SqlLite(const std::string& path)
+	explicit SqlLite(const std::string& path, bool normalized)
 		: db_(path.empty()
 			      ? Permissions::GetDbPath()
-			      : path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)
+			      : path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE), normalized_(normalized)
 	{
 		try
 		{
 			db_.exec("PRAGMA journal_mode=WAL;");
+			// With WAL this only syncs at checkpoints instead of on every commit, a power loss can lose the last commits
+			// but never corrupts the database
+			db_.exec("PRAGMA synchronous=NORMAL;");
 
 			db_.exec("create table if not exists Players ("
 				"Id integer primary key autoincrement not null,"
@@ -32,8 +36,19 @@ public:
 			db_.exec("create table if not exists Groups ("
 				"Id integer primary key autoincrement not null,"
 				"GroupName text not null COLLATE NOCASE,"
-				"Permissions text default '' COLLATE NOCASE"
+				"Permissions text default '' COLLATE NOCASE,"
+				"Parents text default '' COLLATE NOCASE"
 				");");
+			db_.exec("create table if not exists PermissionChanges ("
+				"Id integer primary key autoincrement not null,"
+				"Kind integer not null,"
+				"RowKey text not null COLLATE NOCASE,"
+				"ChangedAt integer not null"
+				");");
+			db_.exec("create index if not exists PermissionChanges_ChangedAt on PermissionChanges (ChangedAt);");
+			// Rows are looked up one at a time by delta syncs, lazy player loading and every write
+			db_.exec("create index if not exists Players_EOS_Id on Players (EOS_Id);");
+			db_.exec("create index if not exists Tribes_TribeId on Tribes (TribeId);");
 
 			// Add default groups
 
@@ -45,6 +60,9 @@ public:
 				"WHERE NOT EXISTS(SELECT 1 FROM Groups WHERE GroupName = 'Default');");
 
 			upgradeDatabase();
+
+			if (normalized_)
+				normalized_ = PrepareNormalizedSchema();
 		}
 		catch (const std::exception& exception)
 		{
@@ -75,69 +93,49 @@ public:
 
 	bool IsPlayerExists(const FString& eos_id) override
 	{
-		bool found = false;
-
-		std::lock_guard<std::mutex> lg(playersMutex);
-		if (permissionPlayers.find(eos_id) == permissionPlayers.end())
-			found = false;
-		else
-			found = true;
-
-		return found;
+		return FindPlayer(eos_id) != nullptr;
 	}
 
 	bool AddPlayer(const FString& eos_id) override
 	{
-		try
-		{
-			SQLite::Statement query(db_, "INSERT INTO Players (EOS_Id, Groups) VALUES (?, ?);");
-			query.bind(1, eos_id.ToString());
-			query.bind(2, "Default,");
-			query.exec();
-
-			std::lock_guard<std::mutex> lg(playersMutex);
-			permissionPlayers[eos_id] = CachedPermission("Default,", "");
-
-			return true;
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), "Row", [this, eos_id]()
+			{
+				auto query = Prepare("INSERT INTO Players (EOS_Id, Groups) VALUES (?, ?);");
+				query->bind(1, eos_id.ToString());
+				query->bind(2, "Default,");
+				query->exec();
+				if (normalized_)
+					WritePlayerMembership(eos_id, "Default");
+			});
+		if (error)
 			return false;
-		}
 
-		return false;
+		SetPlayer(eos_id, CachedPermission("Default,", ""));
+		Permissions::Cache::Invalidate();
+
+		return true;
 	}
 
 	bool IsGroupExists(const FString& group) override
 	{
-		bool found = false;
-
-		std::lock_guard<std::mutex> lg(groupsMutex);
-		if (permissionGroups.find(group.ToString()) == permissionGroups.end())
-			found = false;
-		else
-			found = true;
-
-		return found;
+		return permissionGroups.contains(group);
 	}
 
 	TArray<FString> GetPlayerGroups(const FString& eos_id, bool includeTimed = true) override
 	{
 		TArray<FString> groups;
 
-		if (IsPlayerExists(eos_id))
+		if (auto permission = PeekPlayer(eos_id))
 		{
-			std::lock_guard<std::mutex> lg(playersMutex);
 			if (includeTimed)
 			{
 				auto nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-				groups = permissionPlayers[eos_id].getGroups(nowSecs);
+				groups = permission->getGroups(nowSecs);
 			}
 			else
 			{
-				groups = permissionPlayers[eos_id].Groups;
-		}
+				groups = permission->Groups.ToArray();
+			}
 		}
 
 		return groups;
@@ -145,8 +143,14 @@ public:
 
 	CachedPermission HydratePlayerGroups(const FString& eos_id) override
 	{
-		std::lock_guard<std::mutex> lg(playersMutex);
-		return permissionPlayers[eos_id];
+		auto permission = FindPlayer(eos_id);
+		return permission ? *permission : CachedPermission();
+	}
+
+	long long GetNextTimedBoundary(const FString& eos_id, long long now) override
+	{
+		auto permission = PeekPlayer(eos_id);
+		return permission ? permission->getNextBoundary(now) : 0;
 	}
 
 	TArray<FString> GetGroupPermissions(const FString& group) override
@@ -156,43 +160,31 @@ public:
 
 		TArray<FString> permissions;
 
-		if (IsGroupExists(group))
-		{
-			std::lock_guard<std::mutex> lg(groupsMutex);
-			FString permissions_fstr(permissionGroups[group.ToString()].c_str());
-			permissions_fstr.ParseIntoArray(permissions, L",", true);
-		}
+		if (auto cachedGroup = permissionGroups.find(group))
+			permissions = cachedGroup->PermissionList;
 
 		return permissions;
 	}
 
+	bool IsGroupHasPermission(const FString& group, const FString& permission, bool allowWildcard) override
+	{
+		auto cachedGroup = permissionGroups.find(group);
+		return cachedGroup && cachedGroup->hasPermission(permission, allowWildcard);
+	}
+
 	TArray<FString> GetAllGroups() override
 	{
 		TArray<FString> all_groups;
 
-		std::lock_guard<std::mutex> lg(groupsMutex);
-		for (auto& group : permissionGroups)
+		// The map keeps the spelling the group was first cached with
+		permissionGroups.forEach([&all_groups](const FString& group, const CachedGroup&)
 			{
-			all_groups.Add(group.first.c_str());
-		}
+				all_groups.Add(Permissions::groupNames.canonical(group));
+			});
 
 		return all_groups;
 	}
 	
-	TArray<FString> GetGroupMembers(const FString& group) override
-	{
-		TArray<FString> members;
-
-		std::lock_guard<std::mutex> lg(playersMutex);
-		for (auto& players : permissionPlayers)
-		{
-			if (Permissions::IsPlayerInGroup(players.first, group))
-				members.Add(players.first);
-		}
-
-		return members;
-	}
-
 	std::optional<std::string> AddPlayerToGroup(const FString& eos_id, const FString& group) override
 	{
 		if (!IsPlayerExists(eos_id))
@@ -206,28 +198,33 @@ public:
 		if (groups.Contains(group))
 			return "Player was already added";
 
-		try
-		{
-			groups.AddUnique(group);
+		groups.AddUnique(group);
 
-			FString query_groups("");
+		FString query_groups("");
 
-			for (const FString& f : groups)
-				query_groups += f + ",";
+		for (const FString& f : groups)
+			query_groups += f + ",";
 
-			SQLite::Statement query(db_, "UPDATE Players SET Groups = ? WHERE EOS_Id = ?;");
-			query.bind(1, query_groups.ToString());
-			query.bind(2, eos_id.ToString());
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, false), [this, eos_id, group, query_groups]()
+			{
+				if (normalized_)
+					WritePlayerMembership(eos_id, group);
+				else
+				{
+					auto query = Prepare("UPDATE Players SET Groups = ? WHERE EOS_Id = ?;");
+					query->bind(1, query_groups.ToString());
+					query->bind(2, eos_id.ToString());
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(playersMutex);
-			permissionPlayers[eos_id].Groups.AddUnique(group);
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
+			{
+				permission.Groups.AddUnique(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -250,21 +247,26 @@ public:
 				new_groups += current_group + ",";
 		}
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Players SET Groups = ? WHERE EOS_Id = ?;");
-			query.bind(1, new_groups.ToString());
-			query.bind(2, eos_id.ToString());
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, false), [this, eos_id, group, new_groups]()
+			{
+				if (normalized_)
+					DeletePlayerMembership(eos_id, group, false);
+				else
+				{
+					auto query = Prepare("UPDATE Players SET Groups = ? WHERE EOS_Id = ?;");
+					query->bind(1, new_groups.ToString());
+					query->bind(2, eos_id.ToString());
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(playersMutex);
-			permissionPlayers[eos_id].Groups.Remove(group);
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
+			{
+				permission.Groups.Remove(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -274,20 +276,28 @@ public:
 		if (IsGroupExists(group))
 			return "Group already exists";
 
-		try
-		{
-			SQLite::Statement query(db_, "INSERT INTO Groups (GroupName) VALUES (?);");
-			query.bind(1, group.ToString());
-			query.exec();
+		// Shares its slot with RemoveGroup, so leftovers of a removed group that is re-added before the flush are cleared first
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), "Row", [this, group]()
+			{
+				auto deleteQuery = Prepare("DELETE FROM Groups WHERE GroupName = ?;");
+				deleteQuery->bind(1, group.ToString());
+				deleteQuery->exec();
+				if (normalized_)
+				{
+					auto permissionsQuery = Prepare("DELETE FROM GroupPermissions WHERE GroupName = ?;");
+					permissionsQuery->bind(1, group.ToString());
+					permissionsQuery->exec();
+				}
 
-			std::lock_guard<std::mutex> lg(groupsMutex);
-			permissionGroups[group.ToString()] = "";
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+				auto query = Prepare("INSERT INTO Groups (GroupName) VALUES (?);");
+				query->bind(1, group.ToString());
+				query->exec();
+			});
+		if (error)
+			return error;
+
+		SetGroup(group, CachedGroup());
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -297,69 +307,164 @@ public:
 		if (!IsGroupExists(group))
 			return "Group does not exist";
 
-		// Remove all players from this group
-		TArray<FString> group_members = GetGroupMembers(group);
-		for (FString player : group_members)
+		// Every member's rows are queued together with the group row, so the whole removal is stored in one transaction
+		std::vector<PendingWrite> writes;
+		std::vector<FString> members, indexed;
+		groupMembers.forEach(group, [&indexed](const FString& eos_id, const GroupMemberIndex::Membership&)
+			{
+				indexed.push_back(eos_id);
+			});
+		for (const auto& eos_id : indexed)
 		{
-			RemovePlayerFromGroup(player, group);
-		}
+			auto permission = permissionPlayers.find(eos_id);
+			if (!permission)
+				continue;
+			members.push_back(eos_id);
+
+			if (permission->Groups.Contains(group))
+			{
+				FString new_groups;
+				for (const FString& current_group : permission->Groups)
+				{
+					if (current_group != group)
+						new_groups += current_group + ",";
+				}
 
-		// Delete group
+				writes.push_back(PendingWrite{ ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, false), [this, eos_id, group, new_groups]()
+					{
+						if (normalized_)
+							DeletePlayerMembership(eos_id, group, false);
+						else
+						{
+							auto query = Prepare("UPDATE Players SET Groups = ? WHERE EOS_Id = ?;");
+							query->bind(1, new_groups.ToString());
+							query->bind(2, eos_id.ToString());
+							query->exec();
+						}
+					} });
+			}
 
-		try
-		{
-			SQLite::Statement query(db_, "DELETE FROM Groups WHERE GroupName = ?;");
-			query.bind(1, group.ToString());
-			query.exec();
+			if (permission->TimedGroups.Contains(group))
+			{
+				FString new_groups;
+				for (const TimedGroup& current_group : permission->TimedGroups)
+				{
+					if (current_group.GroupName() != group)
+						new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName().ToString());
+				}
 
-			std::lock_guard<std::mutex> lg(groupsMutex);
-			permissionGroups.erase(group.ToString());
+				writes.push_back(PendingWrite{ ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, true), [this, eos_id, group, new_groups]()
+					{
+						if (normalized_)
+							DeletePlayerMembership(eos_id, group, true);
+						else
+						{
+							auto query = Prepare("UPDATE Players SET TimedGroups = ? WHERE EOS_Id = ?;");
+							query->bind(1, new_groups.ToString());
+							query->bind(2, eos_id.ToString());
+							query->exec();
+						}
+					} });
+			}
 		}
-		catch (const std::exception& exception)
+
+		// Groups inheriting from it lose it as a parent, a group added later under the same name isn't inherited
+		for (auto& [child, parents] : GetChildGroups(group))
 		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
+			writes.push_back(PendingWrite{ ChangeKind::Group, child.ToString(), "Parents", [this, child, parents]()
+				{
+					WriteGroupParents(child, parents);
+				} });
+		}
+
+		// Lazy mode, the players that aren't loaded hold it only in their stored rows
+		if (Permissions::Players::Lazy)
+		{
+			writes.push_back(PendingWrite{ ChangeKind::Group, group.ToString(), "Members", [this, group]()
+				{
+					DeleteGroupMemberships(group);
+				} });
 		}
 
+		writes.push_back(PendingWrite{ ChangeKind::Group, group.ToString(), "Row", [this, group]()
+			{
+				auto query = Prepare("DELETE FROM Groups WHERE GroupName = ?;");
+				query->bind(1, group.ToString());
+				query->exec();
+				if (normalized_)
+				{
+					auto permissionsQuery = Prepare("DELETE FROM GroupPermissions WHERE GroupName = ?;");
+					permissionsQuery->bind(1, group.ToString());
+					permissionsQuery->exec();
+				}
+			} });
+
+		auto error = QueueWrites(std::move(writes));
+		if (error)
+			return error;
+
+		const long long now = std::time(nullptr);
+		UpdatePlayers(members, [&](const FString& eos_id, CachedPermission& permission)
+			{
+				permission.Groups.Remove(group);
+				if (permission.TimedGroups.Remove(TimedGroup{ group, 0, 0 }) > 0)
+					timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, now);
+			});
+		EraseGroup(group);
+		Permissions::Cache::Invalidate();
+
 		return {};
 	}
 
 	std::optional<std::string> GroupGrantPermission(const FString& group, const FString& permission) override
 	{
-		if (!IsGroupExists(group))
+		auto cachedGroup = permissionGroups.find(group);
+		if (!cachedGroup)
 			return "Group does not exist";
 
-		if (Permissions::IsGroupHasPermission(group, permission))
+		// An inherited permission can still be granted, the group then keeps it without the parent
+		if (cachedGroup->hasOwnPermission(permission))
 			return "Group already has this permission";
 
-		try
-		{
-			SQLite::Statement
-				query(db_, "UPDATE Groups SET Permissions = Permissions || ? || ',' WHERE GroupName = ?;");
-			query.bind(1, permission.ToString());
-			query.bind(2, group.ToString());
-			query.exec();
+		// The whole column is written so queued grants to the same group can be coalesced
+		FString new_permissions;
 
-			std::lock_guard<std::mutex> lg(groupsMutex);
-			std::string groupPermissions = fmt::format("{},{}", permission.ToString(), permissionGroups[group.ToString()]);
-			permissionGroups[group.ToString()] = groupPermissions;
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		for (const FString& current_perm : GetGroupPermissions(group))
+			new_permissions += current_perm + ",";
+		new_permissions += permission + ",";
+
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), PermissionSlot(normalized_, permission), [this, group, permission, new_permissions]()
+			{
+				if (normalized_)
+					WriteGroupPermission(group, permission);
+				else
+				{
+					auto query = Prepare("UPDATE Groups SET Permissions = ? WHERE GroupName = ?;");
+					query->bind(1, new_permissions.ToString());
+					query->bind(2, group.ToString());
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
+
+		UpdateGroup(group, [&](CachedGroup& cachedGroup)
+			{
+				cachedGroup.addPermission(permission);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
 
 	std::optional<std::string> GroupRevokePermission(const FString& group, const FString& permission) override
 	{
-		if (!IsGroupExists(group))
+		auto cachedGroup = permissionGroups.find(group);
+		if (!cachedGroup)
 			return "Group does not exist";
 
-		if (!Permissions::IsGroupHasPermission(group, permission))
-			return "Group does not have this permission";
+		if (!cachedGroup->hasOwnPermission(permission))
+			return cachedGroup->hasPermission(permission, false) ? "Permission is inherited from a parent group" : "Group does not have this permission";
 
 		TArray<FString> permissions = GetGroupPermissions(group);
 
@@ -371,21 +476,26 @@ public:
 				new_permissions += current_perm + ",";
 		}
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Groups SET Permissions = ? WHERE GroupName = ?;");
-			query.bind(1, new_permissions.ToString());
-			query.bind(2, group.ToString());
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Group, group.ToString(), PermissionSlot(normalized_, permission), [this, group, permission, new_permissions]()
+			{
+				if (normalized_)
+					DeleteGroupPermission(group, permission);
+				else
+				{
+					auto query = Prepare("UPDATE Groups SET Permissions = ? WHERE GroupName = ?;");
+					query->bind(1, new_permissions.ToString());
+					query->bind(2, group.ToString());
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(groupsMutex);
-			permissionGroups[group.ToString()] = new_permissions.ToString();
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		UpdateGroup(group, [&](CachedGroup& cachedGroup)
+			{
+				cachedGroup.removePermission(permission);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -401,9 +511,7 @@ public:
 		TArray<TimedGroup> groups;
 		if (IsPlayerExists(eos_id))
 		{
-			playersMutex.lock();
-			groups = permissionPlayers[eos_id].TimedGroups;
-			playersMutex.unlock();
+			groups = HydratePlayerGroups(eos_id).TimedGroups;
 		}
 
 		// Pelayori 29-07-2025: Existing timed permissions timer extension
@@ -446,24 +554,30 @@ public:
 		FString new_groups;
 		for (const TimedGroup& current_group : groups)
 		{
-			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
+			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName().ToString());
 		}
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Players SET TimedGroups = ? WHERE EOS_Id = ?;");
-			query.bind(1, new_groups.ToString());
-			query.bind(2, eos_id.ToString());
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, true), [this, eos_id, timedGroup = *groups.FindByKey(group), new_groups]()
+			{
+				if (normalized_)
+					WritePlayerMembership(eos_id, timedGroup);
+				else
+				{
+					auto query = Prepare("UPDATE Players SET TimedGroups = ? WHERE EOS_Id = ?;");
+					query->bind(1, new_groups.ToString());
+					query->bind(2, eos_id.ToString());
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(playersMutex);
-			permissionPlayers[eos_id].TimedGroups = groups;
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
+			{
+				permission.TimedGroups = groups;
+				timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, std::time(nullptr));
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -473,98 +587,81 @@ public:
 		if (!IsPlayerExists(eos_id) || !IsGroupExists(group))
 			return "Player or group does not exist";
 
-		playersMutex.lock();
-		TArray<TimedGroup> groups = permissionPlayers[eos_id].TimedGroups;
-		playersMutex.unlock();
-
+		// Removed by name from the entry the cache holds now, the legacy column is written from that same state
+		TArray<TimedGroup> removed;
 		FString new_groups;
-		int32 groupIndex = INDEX_NONE;
-		for (int32 Index = 0; Index != groups.Num(); ++Index)
-		{
-			const TimedGroup& current_group = groups[Index];
-			if (current_group.GroupName != group)
-				new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
-			else
-				groupIndex = Index;
-		}
-		if (groupIndex == INDEX_NONE)
+		UpdatePlayer(eos_id, [&](CachedPermission& permission)
+			{
+				removed = TakeTimedGroup(permission.TimedGroups, group);
+				new_groups = JoinTimedGroups(permission.TimedGroups);
+				if (!removed.IsEmpty())
+					timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, std::time(nullptr));
+			});
+		if (removed.IsEmpty())
 			return "Player is not in timed group";
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Players SET TimedGroups = ? WHERE EOS_Id = ?;");
-			query.bind(1, new_groups.ToString());
-			query.bind(2, eos_id.ToString());
-			query.exec();
-
-			std::lock_guard<std::mutex> lg(playersMutex);
-			permissionPlayers[eos_id].TimedGroups.RemoveAt(groupIndex);
-		}
-		catch (const std::exception& exception)
+		auto error = QueueWrite(ChangeKind::Player, eos_id.ToString(), MembershipSlot(normalized_, group, true), [this, eos_id, group, new_groups]()
+			{
+				if (normalized_)
+					DeletePlayerMembership(eos_id, group, true);
+				else
+				{
+					auto query = Prepare("UPDATE Players SET TimedGroups = ? WHERE EOS_Id = ?;");
+					query->bind(1, new_groups.ToString());
+					query->bind(2, eos_id.ToString());
+					query->exec();
+				}
+			});
+		if (error)
 		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
+			UpdatePlayer(eos_id, [&](CachedPermission& permission)
+				{
+					permission.TimedGroups.Append(removed);
+					timedScheduler.SchedulePlayer(eos_id, permission.TimedGroups, std::time(nullptr));
+				});
+			return error;
 		}
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
 
-	void UpdatePlayerGroupCallbacks(const FString& eos_id, TArray<FString> groups) override
-	{
-		std::lock_guard<std::mutex> lg(playersMutex);
-		permissionPlayers[eos_id].CallbackGroups = groups;
-	}
-
 	bool IsTribeExists(int tribeId) override
 	{
-		bool found = false;
-
-		std::lock_guard<std::mutex> lg(tribesMutex);
-		if (permissionTribes.find(tribeId) == permissionTribes.end())
-			found = false;
-		else
-			found = true;
-
-		return found;
+		return permissionTribes.contains(tribeId);
 	}
 
 	bool AddTribe(int tribeId) override
 	{
-		try
-		{
-			SQLite::Statement query(db_, "INSERT INTO Tribes (TribeId) VALUES (?);");
-			query.bind(1, static_cast<int64>(tribeId));
-			query.exec();
-
-			std::lock_guard<std::mutex> lg(tribesMutex);
-			permissionTribes[tribeId] = CachedPermission("", "");
-
-			return true;
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), "Row", [this, tribeId]()
+			{
+				auto query = Prepare("INSERT INTO Tribes (TribeId) VALUES (?);");
+				query->bind(1, static_cast<int64>(tribeId));
+				query->exec();
+			});
+		if (error)
 			return false;
-		}
 
-		return false;
+		permissionTribes.set(tribeId, CachedPermission("", ""));
+		Permissions::Cache::Invalidate();
+
+		return true;
 	}
 
 	TArray<FString> GetTribeGroups(int tribeId, bool includeTimed = true) override
 	{
 		TArray<FString> groups;
 
-		if (IsTribeExists(tribeId))
+		if (auto permission = permissionTribes.find(tribeId))
 		{
-			std::lock_guard<std::mutex> lg(tribesMutex);
 			if (includeTimed)
 			{
 				auto nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-				groups = permissionTribes[tribeId].getGroups(nowSecs);
+				groups = permission->getGroups(nowSecs);
 			}
 			else
 			{
-				groups = permissionTribes[tribeId].Groups;
+				groups = permission->Groups.ToArray();
 			}
 		}
 
@@ -573,8 +670,14 @@ public:
 
 	CachedPermission HydrateTribeGroups(int tribeId) override
 	{
-		std::lock_guard<std::mutex> lg(tribesMutex);
-		return permissionTribes[tribeId];
+		auto permission = permissionTribes.find(tribeId);
+		return permission ? *permission : CachedPermission();
+	}
+
+	long long GetTribeNextTimedBoundary(int tribeId, long long now) override
+	{
+		auto permission = permissionTribes.find(tribeId);
+		return permission ? permission->getNextBoundary(now) : 0;
 	}
 
 	std::optional<std::string> AddTribeToGroup(int tribeId, const FString& group) override
@@ -590,28 +693,33 @@ public:
 		if (groups.Contains(group))
 			return "Tribe was already added";
 
-		try
-		{
-			groups.AddUnique(group);
+		groups.AddUnique(group);
 
-			FString query_groups("");
+		FString query_groups("");
 
-			for (const FString& f : groups)
-				query_groups += f + ",";
+		for (const FString& f : groups)
+			query_groups += f + ",";
 
-			SQLite::Statement query(db_, "UPDATE Tribes SET Groups = ? WHERE TribeId = ?;");
-			query.bind(1, query_groups.ToString());
-			query.bind(2, static_cast<int64>(tribeId));
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, false), [this, tribeId, group, query_groups]()
+			{
+				if (normalized_)
+					WriteTribeMembership(tribeId, group);
+				else
+				{
+					auto query = Prepare("UPDATE Tribes SET Groups = ? WHERE TribeId = ?;");
+					query->bind(1, query_groups.ToString());
+					query->bind(2, static_cast<int64>(tribeId));
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(tribesMutex);
-			permissionTribes[tribeId].Groups.Add(group);
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
+			{
+				permission.Groups.Add(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -634,21 +742,26 @@ public:
 				new_groups += current_group + ",";
 		}
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Tribes SET Groups = ? WHERE TribeId = ?;");
-			query.bind(1, new_groups.ToString());
-			query.bind(2, static_cast<int64>(tribeId));
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, false), [this, tribeId, group, new_groups]()
+			{
+				if (normalized_)
+					DeleteTribeMembership(tribeId, group, false);
+				else
+				{
+					auto query = Prepare("UPDATE Tribes SET Groups = ? WHERE TribeId = ?;");
+					query->bind(1, new_groups.ToString());
+					query->bind(2, static_cast<int64>(tribeId));
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(tribesMutex);
-			permissionTribes[tribeId].Groups.Remove(group);
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
+			{
+				permission.Groups.Remove(group);
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -664,9 +777,7 @@ public:
 		TArray<TimedGroup> groups;
 		if (IsTribeExists(tribeId))
 		{
-			tribesMutex.lock();
-			groups = permissionTribes[tribeId].TimedGroups;
-			tribesMutex.unlock();
+			groups = HydrateTribeGroups(tribeId).TimedGroups;
 		}
 
 		// Pelayori 29-07-2025: Existing timed permissions timer extension
@@ -709,24 +820,30 @@ public:
 		FString new_groups;
 		for (const TimedGroup& current_group : groups)
 		{
-			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
+			new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName().ToString());
 		}
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Tribes SET TimedGroups = ? WHERE TribeId = ?;");
-			query.bind(1, new_groups.ToString());
-			query.bind(2, static_cast<int64>(tribeId));
-			query.exec();
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, true), [this, tribeId, timedGroup = *groups.FindByKey(group), new_groups]()
+			{
+				if (normalized_)
+					WriteTribeMembership(tribeId, timedGroup);
+				else
+				{
+					auto query = Prepare("UPDATE Tribes SET TimedGroups = ? WHERE TribeId = ?;");
+					query->bind(1, new_groups.ToString());
+					query->bind(2, static_cast<int64>(tribeId));
+					query->exec();
+				}
+			});
+		if (error)
+			return error;
 
-			std::lock_guard<std::mutex> lg(tribesMutex);
-			permissionTribes[tribeId].TimedGroups = groups;
-		}
-		catch (const std::exception& exception)
-		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
-		}
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
+			{
+				permission.TimedGroups = groups;
+				timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, std::time(nullptr));
+			});
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
@@ -736,99 +853,173 @@ public:
 		if (!IsTribeExists(tribeId) || !IsGroupExists(group))
 			return "Tribe or group does not exist";
 
-		tribesMutex.lock();
-		TArray<TimedGroup> groups = permissionTribes[tribeId].TimedGroups;
-		tribesMutex.unlock();
-
+		// Removed by name from the entry the cache holds now, the legacy column is written from that same state
+		TArray<TimedGroup> removed;
 		FString new_groups;
-		int32 groupIndex = INDEX_NONE;
-		for (int32 Index = 0; Index != groups.Num(); ++Index)
-		{
-			const TimedGroup& current_group = groups[Index];
-			if (current_group.GroupName != group)
-				new_groups += FString::Format("{};{};{},", current_group.DelayUntilTime, current_group.ExpireAtTime, current_group.GroupName.ToString());
-			else
-				groupIndex = Index;
-		}
-		if (groupIndex == INDEX_NONE)
+		permissionTribes.update(tribeId, [&](CachedPermission& permission)
+			{
+				removed = TakeTimedGroup(permission.TimedGroups, group);
+				new_groups = JoinTimedGroups(permission.TimedGroups);
+				if (!removed.IsEmpty())
+					timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, std::time(nullptr));
+			});
+		if (removed.IsEmpty())
 			return "Tribe is not in timed group";
 
-		try
-		{
-			SQLite::Statement query(db_, "UPDATE Tribes SET TimedGroups = ? WHERE TribeId = ?;");
-			query.bind(1, new_groups.ToString());
-			query.bind(2, static_cast<int64>(tribeId));
-			query.exec();
-
-			std::lock_guard<std::mutex> lg(tribesMutex);
-			permissionTribes[tribeId].TimedGroups.RemoveAt(groupIndex);
-		}
-		catch (const std::exception& exception)
+		auto error = QueueWrite(ChangeKind::Tribe, std::to_string(tribeId), MembershipSlot(normalized_, group, true), [this, tribeId, group, new_groups]()
+			{
+				if (normalized_)
+					DeleteTribeMembership(tribeId, group, true);
+				else
+				{
+					auto query = Prepare("UPDATE Tribes SET TimedGroups = ? WHERE TribeId = ?;");
+					query->bind(1, new_groups.ToString());
+					query->bind(2, static_cast<int64>(tribeId));
+					query->exec();
+				}
+			});
+		if (error)
 		{
-			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
-			return "Unexpected DB error";
+			permissionTribes.update(tribeId, [&](CachedPermission& permission)
+				{
+					permission.TimedGroups.Append(removed);
+					timedScheduler.ScheduleTribe(tribeId, permission.TimedGroups, std::time(nullptr));
+				});
+			return error;
 		}
+		Permissions::Cache::Invalidate();
 
 		return {};
 	}
 
-	void UpdateTribeGroupCallbacks(int tribeId, TArray<FString> groups) override
+	void Init() override
 	{
-		std::lock_guard<std::mutex> lg(tribesMutex);
-		permissionTribes[tribeId].CallbackGroups = groups;
+		static auto& initStat = Permissions::Stats::Timer("Database.Init");
+		static auto& initRows = Permissions::Stats::Counter("Database.Init rows");
+		Permissions::Stats::ScopedTimer timer(initStat);
+
+		std::lock_guard<std::mutex> syncLock(syncMutex);
+		// One connection, so writes wait until the reload is done
+		std::lock_guard<std::mutex> flushLock(flushMutex);
+
+		// Queued writes go in first, otherwise the reload would bring back the rows they change
+		FlushWritesLocked();
+
+		// Read the change log first, anything written while loading gets re-applied by the next delta sync
+		auto readTransaction = BeginRead();
+		changeCursor = StartChangeCursor();
+
+		// Each map is loaded off to the side and swapped in at once, readers keep the previous version until then
+		auto groups = InitGroups();
+		auto players = Permissions::Players::Lazy ? InitTrackedPlayers() : InitPlayers();
+		auto tribes = InitTribes();
+		readTransaction.reset();
+		initRows.add(groups.size() + players.size() + tribes.size());
+
+		KeepPendingRows(groups, players, tribes);
+		AssignGroups(std::move(groups));
+		AssignPlayers(std::move(players));
+		permissionTribes.assign(std::move(tribes));
+
+		RescheduleTimedGroups();
+		Permissions::Cache::Invalidate();
 	}
 
-	void Init() override
+	void SyncChanges() override
 	{
-		groupsMutex.lock();
-		permissionGroups = InitGroups();
-		groupsMutex.unlock();
+		static auto& syncStat = Permissions::Stats::Timer("Database.SyncChanges");
+		static auto& syncRows = Permissions::Stats::Counter("Database.SyncChanges rows");
+		Permissions::Stats::ScopedTimer timer(syncStat);
 
-		playersMutex.lock();
-		permissionPlayers = InitPlayers();
-		playersMutex.unlock();
+		std::unique_lock<std::mutex> syncLock(syncMutex);
+		std::unique_lock<std::mutex> flushLock(flushMutex);
 
-		tribesMutex.lock();
-		permissionTribes = InitTribes();
-		tribesMutex.unlock();
-	}
+		FlushWritesLocked();
 
-	std::unordered_map<std::string, std::string> InitGroups() override
-	{
-		std::unordered_map<std::string, std::string> pGroups;
+		std::unordered_set<std::string> players, tribes, groups;
+		ChangeCursor next;
+		int changes = 0;
+		auto readTransaction = BeginRead();
 
 		try
 		{
-			SQLite::Statement query(db_, "SELECT GroupName, Permissions FROM Groups;");
-			while (query.executeStep())
-			{
-				pGroups[query.getColumn(0).getText()] = query.getColumn(1).getText();
-			}
+			changes = CollectChanges(next, players, tribes, groups);
 		}
 		catch (const std::exception& exception)
 		{
 			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return;
 		}
 
-		return pGroups;
-	}
+		if (changes > MaxDeltaChanges)
+		{
+			readTransaction.reset();
+			flushLock.unlock();
+			syncLock.unlock();
+			Init();
+			return;
+		}
 
-	std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> InitPlayers() override
-	{
-		std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> pPlayers;
+		TakeFailedRows(players, tribes, groups);
+		DropUntrackedPlayers(players);
 
-		try
+		if (changes > 0 || !players.empty() || !tribes.empty() || !groups.empty())
 		{
-			SQLite::Statement query(db_, "SELECT EOS_Id, Groups, TimedGroups FROM Players;");
-			while (query.executeStep())
+			// Rows changed again since the flush keep their cached state, their write logs another change
+			std::erase_if(groups, [this](const std::string& key) { return IsReloadBlocked(ChangeKind::Group, key); });
+			std::erase_if(players, [this](const std::string& key) { return IsReloadBlocked(ChangeKind::Player, key); });
+			std::erase_if(tribes, [this](const std::string& key) { return IsReloadBlocked(ChangeKind::Tribe, key); });
+			syncRows.add(groups.size() + players.size() + tribes.size());
+
+			try
+			{
+				for (const auto& group : groups)
+					ReloadGroup(group);
+				ReloadPlayers(players);
+				ReloadTribes(tribes);
+			}
+			catch (const std::exception& exception)
 			{
-				const FString& eos_id = query.getColumn(0).getText();
-				FString Groups = query.getColumn(1).getText();
-				FString TimedGroups = query.getColumn(2).getText();
-				pPlayers[eos_id] = CachedPermission(Groups, TimedGroups);
+				// Keep the old cursor so the same changes are retried next sync
+				Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+				return;
 			}
+
+			Permissions::Cache::Invalidate();
 		}
-		catch (const std::exception& exception)
+		changeCursor = std::move(next);
+
+		readTransaction.reset();
+		PruneChanges();
+	}
+
+	std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> InitGroups() override
+	{
+		std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> pGroups;
+
+		try
+		{
+			auto query = Prepare(GroupsQuery(""));
+			ReadGroups(*query, pGroups);
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		return pGroups;
+	}
+
+	std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> InitPlayers() override
+	{
+		std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual> pPlayers;
+
+		try
+		{
+			auto query = Prepare(PlayersQuery(""));
+			ReadPlayers(*query, pPlayers);
+		}
+		catch (const std::exception& exception)
 		{
 			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
 		}
@@ -836,27 +1027,699 @@ public:
 		return pPlayers;
 	}
 
+	// Lazy mode reloads only the players being tracked, what is cached stays if that fails
+	PlayerRows InitTrackedPlayers()
+	{
+		try
+		{
+			return ReadPlayerRows(residency.keys());
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		PlayerRows cached;
+		permissionPlayers.forEach([&cached](const FString& eos_id, const CachedPermission& permission)
+			{
+				cached.emplace(eos_id, permission);
+			});
+		return cached;
+	}
+
 	std::unordered_map<int, CachedPermission> InitTribes() override
 	{
 		std::unordered_map<int, CachedPermission> pTribes;
 
 		try
 		{
-			SQLite::Statement query(db_, "SELECT TribeId, Groups, TimedGroups FROM Tribes;");
-			while (query.executeStep())
+			auto query = Prepare(TribesQuery(""));
+			ReadTribes(*query, pTribes);
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		return pTribes;
+	}
+
+	std::string GetSnapshotIdentity() override
+	{
+		return "sqlite:" + db_.getFilename() + (normalized_ ? ":normalized" : "");
+	}
+
+	long long GetChangeWatermark() override
+	{
+		try
+		{
+			auto query = Prepare("SELECT IFNULL(MAX(Id), 0) FROM PermissionChanges;");
+			if (query->executeStep())
+				return query->getColumn(0).getInt64();
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+		}
+
+		return 0;
+	}
+
+	void ReadChanges(long long after, const std::function<void(long long, ChangeKind, const std::string&)>& fn) override
+	{
+		auto query = Prepare("SELECT Id, Kind, RowKey FROM PermissionChanges WHERE Id > ? ORDER BY Id;");
+		query->bind(1, static_cast<int64>(after));
+		while (query->executeStep())
+			fn(query->getColumn(0).getInt64(), static_cast<ChangeKind>(query->getColumn(1).getInt()), query->getColumn(2).getText());
+	}
+
+	void LogChange(ChangeKind kind, const std::string& key) override
+	{
+		auto query = Prepare("INSERT INTO PermissionChanges (Kind, RowKey, ChangedAt) VALUES (?, ?, ?);");
+		query->bind(1, static_cast<int>(kind));
+		query->bind(2, key);
+		query->bind(3, static_cast<int64>(std::time(nullptr)));
+		query->exec();
+	}
+
+	/// <summary>
+	/// Handed out by Prepare, resets the statement when it goes out of scope so a SELECT that wasn't read to the end
+	/// doesn't keep its read transaction (and with it an old view of the database) open.
+	/// </summary>
+	class CachedStatement {
+	public:
+		explicit CachedStatement(SQLite::Statement& statement)
+			: statement(statement)
+		{
+		}
+
+		CachedStatement(const CachedStatement&) = delete;
+		CachedStatement& operator=(const CachedStatement&) = delete;
+
+		~CachedStatement()
+		{
+			statement.tryReset();
+		}
+
+		SQLite::Statement* operator->() const
+		{
+			return &statement;
+		}
+
+		SQLite::Statement& operator*() const
+		{
+			return statement;
+		}
+
+	private:
+		SQLite::Statement& statement;
+	};
+
+	/// <summary>
+	/// Statement for sql, prepared on first use and kept for the lifetime of the connection, every parameter has to be
+	/// bound again. Caller holds flushMutex, like every other use of db_ after the constructor.
+	/// </summary>
+	CachedStatement Prepare(const std::string& sql)
+	{
+		auto& statement = statements_[sql];
+		if (!statement)
+			statement = std::make_unique<SQLite::Statement>(db_, sql);
+		else
+			statement->tryReset();
+		return CachedStatement(*statement);
+	}
+
+	/// <summary>
+	/// Puts the reads of a load in one transaction: they all see the same state of the database and don't take the
+	/// read lock statement by statement. Reads have nothing to commit, the transaction ends when it is destroyed.
+	/// </summary>
+	std::unique_ptr<SQLite::Transaction> BeginRead()
+	{
+		try
+		{
+			return std::make_unique<SQLite::Transaction>(db_);
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return nullptr;
+		}
+	}
+
+	void RunInTransaction(const std::function<void()>& body) override
+	{
+		SQLite::Transaction transaction(db_);
+		body();
+		transaction.commit();
+	}
+
+	// Rows aren't unique by key in this schema, so they are deleted and inserted rather than upserted
+	void ImportGroupRow(const FString& group, const TArray<FString>& permissions, const TArray<FString>& parents) override
+	{
+		auto deleteQuery = Prepare("DELETE FROM Groups WHERE GroupName = ?;");
+		deleteQuery->bind(1, group.ToString());
+		deleteQuery->exec();
+
+		auto query = Prepare("INSERT INTO Groups (GroupName, Permissions, Parents) VALUES (?, ?, ?);");
+		query->bind(1, group.ToString());
+		query->bind(2, normalized_ ? "" : JoinNames(permissions).ToString());
+		query->bind(3, JoinNames(parents).ToString());
+		query->exec();
+
+		if (normalized_)
+		{
+			auto permissionsQuery = Prepare("DELETE FROM GroupPermissions WHERE GroupName = ?;");
+			permissionsQuery->bind(1, group.ToString());
+			permissionsQuery->exec();
+			for (const auto& permission : permissions)
+				WriteGroupPermission(group, permission);
+		}
+	}
+
+	void WriteGroupParents(const FString& group, const TArray<FString>& parents) override
+	{
+		auto query = Prepare("UPDATE Groups SET Parents = ? WHERE GroupName = ?;");
+		query->bind(1, JoinNames(parents).ToString());
+		query->bind(2, group.ToString());
+		query->exec();
+	}
+
+	void ImportPlayerRow(const FString& eos_id, const CachedPermission& permission) override
+	{
+		auto deleteQuery = Prepare("DELETE FROM Players WHERE EOS_Id = ?;");
+		deleteQuery->bind(1, eos_id.ToString());
+		deleteQuery->exec();
+
+		auto query = Prepare("INSERT INTO Players (EOS_Id, Groups, TimedGroups) VALUES (?, ?, ?);");
+		query->bind(1, eos_id.ToString());
+		query->bind(2, normalized_ ? "" : JoinNames(permission.Groups).ToString());
+		query->bind(3, normalized_ ? "" : JoinTimedGroups(permission.TimedGroups).ToString());
+		query->exec();
+
+		if (normalized_)
+		{
+			auto membershipsQuery = Prepare("DELETE FROM PlayerGroups WHERE EOS_Id = ?;");
+			membershipsQuery->bind(1, eos_id.ToString());
+			membershipsQuery->exec();
+			for (const auto& group : permission.Groups)
+				WritePlayerMembership(eos_id, group);
+			for (const auto& group : permission.TimedGroups)
+				WritePlayerMembership(eos_id, group);
+		}
+	}
+
+	void ImportTribeRow(int tribeId, const CachedPermission& permission) override
+	{
+		auto deleteQuery = Prepare("DELETE FROM Tribes WHERE TribeId = ?;");
+		deleteQuery->bind(1, static_cast<int64>(tribeId));
+		deleteQuery->exec();
+
+		auto query = Prepare("INSERT INTO Tribes (TribeId, Groups, TimedGroups) VALUES (?, ?, ?);");
+		query->bind(1, static_cast<int64>(tribeId));
+		query->bind(2, normalized_ ? "" : JoinNames(permission.Groups).ToString());
+		query->bind(3, normalized_ ? "" : JoinTimedGroups(permission.TimedGroups).ToString());
+		query->exec();
+
+		if (normalized_)
+		{
+			auto membershipsQuery = Prepare("DELETE FROM TribeGroups WHERE TribeId = ?;");
+			membershipsQuery->bind(1, static_cast<int64>(tribeId));
+			membershipsQuery->exec();
+			for (const auto& group : permission.Groups)
+				WriteTribeMembership(tribeId, group);
+			for (const auto& group : permission.TimedGroups)
+				WriteTribeMembership(tribeId, group);
+		}
+	}
+
+	void DeleteExpiredTimedGroups(ChangeKind kind, const std::string& key, long long expiredBefore) override
+	{
+		const bool player = kind == ChangeKind::Player;
+		auto bindKey = [player, &key](SQLite::Statement& query, int index)
 			{
-				int tribeId = query.getColumn(0).getInt();
-				FString Groups = query.getColumn(1).getText();
-				FString TimedGroups = query.getColumn(2).getText();
-				pTribes[tribeId] = CachedPermission(Groups, TimedGroups);
+				if (player)
+					query.bind(index, key);
+				else
+					query.bind(index, static_cast<int64>(std::stoll(key)));
+			};
+
+		if (normalized_)
+		{
+			auto query = Prepare(player ? "DELETE FROM PlayerGroups WHERE EOS_Id = ? AND Timed = 1 AND ExpireAt > 0 AND ExpireAt <= ?;"
+				: "DELETE FROM TribeGroups WHERE TribeId = ? AND Timed = 1 AND ExpireAt > 0 AND ExpireAt <= ?;");
+			bindKey(*query, 1);
+			query->bind(2, static_cast<int64>(expiredBefore));
+			query->exec();
+			return;
+		}
+
+		FString stored;
+		{
+			auto query = Prepare(player ? "SELECT TimedGroups FROM Players WHERE EOS_Id = ?;" : "SELECT TimedGroups FROM Tribes WHERE TribeId = ?;");
+			bindKey(*query, 1);
+			if (!query->executeStep())
+				return;
+			stored = query->getColumn(0).getText();
+		}
+
+		TArray<TimedGroup> groups = CachedPermission("", stored).TimedGroups;
+		if (RemoveExpiredTimedGroups(groups, expiredBefore) == 0)
+			return;
+
+		auto query = Prepare(player ? "UPDATE Players SET TimedGroups = ? WHERE EOS_Id = ?;" : "UPDATE Tribes SET TimedGroups = ? WHERE TribeId = ?;");
+		query->bind(1, JoinTimedGroups(groups).ToString());
+		bindKey(*query, 2);
+		query->exec();
+	}
+
+	bool ReadExpiredPlayers(std::string& after, size_t limit, long long expiredBefore, std::vector<std::pair<std::string, int>>& expired) override
+	{
+		size_t read = 0;
+		if (normalized_)
+		{
+			auto query = Prepare("SELECT EOS_Id, COUNT(*) FROM PlayerGroups WHERE EOS_Id > ? AND Timed = 1 AND ExpireAt > 0 AND ExpireAt <= ? "
+				"GROUP BY EOS_Id ORDER BY EOS_Id LIMIT ?;");
+			query->bind(1, after);
+			query->bind(2, static_cast<int64>(expiredBefore));
+			query->bind(3, static_cast<int64>(limit));
+			for (; query->executeStep(); ++read)
+			{
+				after = query->getColumn(0).getText();
+				expired.emplace_back(after, query->getColumn(1).getInt());
+			}
+			return read == limit;
+		}
+
+		auto query = Prepare("SELECT EOS_Id, TimedGroups FROM Players WHERE EOS_Id > ? AND TimedGroups <> '' ORDER BY EOS_Id LIMIT ?;");
+		query->bind(1, after);
+		query->bind(2, static_cast<int64>(limit));
+		for (; query->executeStep(); ++read)
+		{
+			after = query->getColumn(0).getText();
+			if (const int count = CountExpiredTimedGroups(CachedPermission("", query->getColumn(1).getText()).TimedGroups, expiredBefore); count > 0)
+				expired.emplace_back(after, count);
+		}
+		return read == limit;
+	}
+
+	bool ReadPlayerPage(std::string& after, size_t limit, PlayerRows& rows) override
+	{
+		std::unordered_set<std::string> keys;
+		{
+			auto query = Prepare("SELECT EOS_Id FROM Players WHERE EOS_Id > ? ORDER BY EOS_Id LIMIT ?;");
+			query->bind(1, after);
+			query->bind(2, static_cast<int64>(limit));
+			while (query->executeStep())
+			{
+				after = query->getColumn(0).getText();
+				keys.insert(after);
 			}
 		}
+		rows = ReadPlayerRows(keys);
+		return keys.size() == limit;
+	}
+
+	void PruneChanges()
+	{
+		const time_t now = std::time(nullptr);
+		if (now - lastChangePrune < 3600)
+			return;
+
+		lastChangePrune = now;
+
+		try
+		{
+			auto query = Prepare("DELETE FROM PermissionChanges WHERE ChangedAt < ?;");
+			query->bind(1, static_cast<int64>(now - ChangeLogRetentionSecs));
+			query->exec();
+		}
 		catch (const std::exception& exception)
 		{
 			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
 		}
+	}
 
-		return pTribes;
+	void ReloadGroup(const std::string& group)
+	{
+		std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual> loaded;
+		auto query = Prepare(GroupsQuery("WHERE Groups.GroupName = ?"));
+		query->bind(1, group);
+		ReadGroups(*query, loaded);
+
+		auto loadedGroup = loaded.find(FString(group.c_str()));
+		if (loadedGroup != loaded.end())
+			SetGroup(loadedGroup->first, std::move(loadedGroup->second));
+		else
+			EraseGroup(FString(group.c_str()));
+	}
+
+	// Caller holds flushMutex, one publish for all of them
+	void ReloadPlayers(const std::unordered_set<std::string>& players)
+	{
+		auto loaded = ReadPlayerRows(players);
+		std::vector<FString> keys;
+		keys.reserve(players.size());
+		for (const auto& eos_id : players)
+			keys.emplace_back(eos_id.c_str());
+		SetPlayers(keys, loaded);
+	}
+
+	// Caller holds flushMutex
+	PlayerRows ReadPlayerRows(const std::unordered_set<std::string>& players)
+	{
+		PlayerRows loaded;
+		auto query = Prepare(PlayersQuery("WHERE Players.EOS_Id = ?"));
+		for (const auto& eos_id : players)
+		{
+			query->reset();
+			query->bind(1, eos_id);
+			ReadPlayers(*query, loaded);
+		}
+		return loaded;
+	}
+
+	PlayerRows LoadPlayerRows(const std::unordered_set<std::string>& players) override
+	{
+		// The connection is shared with the sync and the writer
+		std::lock_guard<std::mutex> flushLock(flushMutex);
+		return ReadPlayerRows(players);
+	}
+
+	std::optional<TArray<FString>> LoadGroupMemberIds(const FString& group, long long now) override
+	{
+		if (!normalized_)
+			return std::nullopt;
+
+		std::lock_guard<std::mutex> flushLock(flushMutex);
+		TArray<FString> members;
+		auto query = Prepare("SELECT DISTINCT EOS_Id FROM PlayerGroups WHERE GroupName = ? "
+			"AND (Timed = 0 OR ((DelayUntil <= 0 OR DelayUntil <= ?) AND ExpireAt > ?));");
+		query->bind(1, group.ToString());
+		query->bind(2, static_cast<int64>(now));
+		query->bind(3, static_cast<int64>(now));
+		while (query->executeStep())
+			members.Add(FString(query->getColumn(0).getText()));
+		return members;
+	}
+
+	void DeleteGroupMemberships(const FString& group) override
+	{
+		std::vector<std::string> changed;
+		if (normalized_)
+		{
+			{
+				auto query = Prepare("SELECT DISTINCT EOS_Id FROM PlayerGroups WHERE GroupName = ?;");
+				query->bind(1, group.ToString());
+				while (query->executeStep())
+					changed.push_back(query->getColumn(0).getText());
+			}
+
+			auto query = Prepare("DELETE FROM PlayerGroups WHERE GroupName = ?;");
+			query->bind(1, group.ToString());
+			query->exec();
+		}
+		else
+		{
+			// Also matches other groups containing the name, only rows that held the group are written
+			const std::string pattern = "%" + group.ToString() + "%";
+			PlayerRows stored;
+			{
+				auto query = Prepare(PlayersQuery("WHERE Groups LIKE ? OR TimedGroups LIKE ?"));
+				query->bind(1, pattern);
+				query->bind(2, pattern);
+				ReadPlayers(*query, stored);
+			}
+
+			auto query = Prepare("UPDATE Players SET Groups = ?, TimedGroups = ? WHERE EOS_Id = ?;");
+			for (auto& [eos_id, permission] : stored)
+			{
+				if (permission.Groups.Remove(group) + permission.TimedGroups.Remove(TimedGroup{ group, 0, 0 }) == 0)
+					continue;
+
+				query->reset();
+				query->bind(1, JoinNames(permission.Groups).ToString());
+				query->bind(2, JoinTimedGroups(permission.TimedGroups).ToString());
+				query->bind(3, eos_id.ToString());
+				query->exec();
+				changed.push_back(eos_id.ToString());
+			}
+		}
+
+		for (const auto& eos_id : changed)
+			LogChange(ChangeKind::Player, eos_id);
+	}
+
+	void ReloadTribes(const std::unordered_set<std::string>& tribes)
+	{
+		std::unordered_map<int, CachedPermission> loaded;
+		std::vector<int> keys;
+		keys.reserve(tribes.size());
+		auto query = Prepare(TribesQuery("WHERE Tribes.TribeId = ?"));
+		for (const auto& tribeId : tribes)
+		{
+			keys.push_back(std::stoi(tribeId));
+			query->reset();
+			query->bind(1, static_cast<int64>(keys.back()));
+			ReadTribes(*query, loaded);
+		}
+		SetTribes(keys, loaded);
+	}
+
+	// Legacy rows keep memberships as comma strings, the normalized schema has one row per membership
+	std::string PlayersQuery(const std::string& where) const
+	{
+		if (normalized_)
+			return "SELECT Players.EOS_Id, PlayerGroups.GroupName, PlayerGroups.Timed, PlayerGroups.DelayUntil, PlayerGroups.ExpireAt "
+				"FROM Players LEFT JOIN PlayerGroups ON PlayerGroups.EOS_Id = Players.EOS_Id " + where + ";";
+
+		return "SELECT EOS_Id, Groups, TimedGroups FROM Players " + where + ";";
+	}
+
+	std::string TribesQuery(const std::string& where) const
+	{
+		if (normalized_)
+			return "SELECT Tribes.TribeId, TribeGroups.GroupName, TribeGroups.Timed, TribeGroups.DelayUntil, TribeGroups.ExpireAt "
+				"FROM Tribes LEFT JOIN TribeGroups ON TribeGroups.TribeId = Tribes.TribeId " + where + ";";
+
+		return "SELECT TribeId, Groups, TimedGroups FROM Tribes " + where + ";";
+	}
+
+	std::string GroupsQuery(const std::string& where) const
+	{
+		if (normalized_)
+			return "SELECT Groups.GroupName, GroupPermissions.Permission, Groups.Parents "
+				"FROM Groups LEFT JOIN GroupPermissions ON GroupPermissions.GroupName = Groups.GroupName " + where + ";";
+
+		return "SELECT GroupName, Permissions, Parents FROM Groups " + where + ";";
+	}
+
+	void ReadPlayers(SQLite::Statement& query, std::unordered_map<FString, CachedPermission, FStringHash, FStringEqual>& players)
+	{
+		while (query.executeStep())
+		{
+			const FString eos_id = query.getColumn(0).getText();
+			if (!normalized_)
+			{
+				players[eos_id] = CachedPermission(query.getColumn(1).getText(), query.getColumn(2).getText());
+				continue;
+			}
+
+			auto& permission = players[eos_id];
+			if (!query.getColumn(1).isNull())
+				permission.addMembership(query.getColumn(1).getText(), query.getColumn(2).getInt() != 0, query.getColumn(3).getInt64(), query.getColumn(4).getInt64());
+		}
+	}
+
+	void ReadTribes(SQLite::Statement& query, std::unordered_map<int, CachedPermission>& tribes)
+	{
+		while (query.executeStep())
+		{
+			const int tribeId = query.getColumn(0).getInt();
+			if (!normalized_)
+			{
+				tribes[tribeId] = CachedPermission(query.getColumn(1).getText(), query.getColumn(2).getText());
+				continue;
+			}
+
+			auto& permission = tribes[tribeId];
+			if (!query.getColumn(1).isNull())
+				permission.addMembership(query.getColumn(1).getText(), query.getColumn(2).getInt() != 0, query.getColumn(3).getInt64(), query.getColumn(4).getInt64());
+		}
+	}
+
+	void ReadGroups(SQLite::Statement& query, std::unordered_map<FString, CachedGroup, FStringNoCaseHash, FStringNoCaseEqual>& groups)
+	{
+		while (query.executeStep())
+		{
+			const FString groupName = query.getColumn(0).getText();
+			if (!normalized_)
+			{
+				groups[groupName] = CachedGroup(query.getColumn(1).getText(), query.getColumn(2).getText());
+				continue;
+			}
+
+			// Parents repeat on every permission row of the group
+			auto& group = groups.try_emplace(groupName, "", query.getColumn(2).getText()).first->second;
+			if (!query.getColumn(1).isNull())
+				group.addPermission(query.getColumn(1).getText());
+		}
+	}
+
+	void WritePlayerMembership(const FString& eos_id, const FString& group)
+	{
+		auto query = Prepare("INSERT OR REPLACE INTO PlayerGroups (EOS_Id, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 0, 0, 0);");
+		query->bind(1, eos_id.ToString());
+		query->bind(2, group.ToString());
+		query->exec();
+	}
+
+	void WritePlayerMembership(const FString& eos_id, const TimedGroup& group)
+	{
+		auto query = Prepare("INSERT OR REPLACE INTO PlayerGroups (EOS_Id, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 1, ?, ?);");
+		query->bind(1, eos_id.ToString());
+		query->bind(2, group.GroupName().ToString());
+		query->bind(3, static_cast<int64>(group.DelayUntilTime));
+		query->bind(4, static_cast<int64>(group.ExpireAtTime));
+		query->exec();
+	}
+
+	void DeletePlayerMembership(const FString& eos_id, const FString& group, bool timed)
+	{
+		auto query = Prepare("DELETE FROM PlayerGroups WHERE EOS_Id = ? AND GroupName = ? AND Timed = ?;");
+		query->bind(1, eos_id.ToString());
+		query->bind(2, group.ToString());
+		query->bind(3, timed ? 1 : 0);
+		query->exec();
+	}
+
+	void WriteTribeMembership(int tribeId, const FString& group)
+	{
+		auto query = Prepare("INSERT OR REPLACE INTO TribeGroups (TribeId, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 0, 0, 0);");
+		query->bind(1, static_cast<int64>(tribeId));
+		query->bind(2, group.ToString());
+		query->exec();
+	}
+
+	void WriteTribeMembership(int tribeId, const TimedGroup& group)
+	{
+		auto query = Prepare("INSERT OR REPLACE INTO TribeGroups (TribeId, GroupName, Timed, DelayUntil, ExpireAt) VALUES (?, ?, 1, ?, ?);");
+		query->bind(1, static_cast<int64>(tribeId));
+		query->bind(2, group.GroupName().ToString());
+		query->bind(3, static_cast<int64>(group.DelayUntilTime));
+		query->bind(4, static_cast<int64>(group.ExpireAtTime));
+		query->exec();
+	}
+
+	void DeleteTribeMembership(int tribeId, const FString& group, bool timed)
+	{
+		auto query = Prepare("DELETE FROM TribeGroups WHERE TribeId = ? AND GroupName = ? AND Timed = ?;");
+		query->bind(1, static_cast<int64>(tribeId));
+		query->bind(2, group.ToString());
+		query->bind(3, timed ? 1 : 0);
+		query->exec();
+	}
+
+	void WriteGroupPermission(const FString& group, const FString& permission)
+	{
+		auto query = Prepare("INSERT OR IGNORE INTO GroupPermissions (GroupName, Permission) VALUES (?, ?);");
+		query->bind(1, group.ToString());
+		query->bind(2, permission.ToString());
+		query->exec();
+	}
+
+	void DeleteGroupPermission(const FString& group, const FString& permission)
+	{
+		auto query = Prepare("DELETE FROM GroupPermissions WHERE GroupName = ? AND Permission = ?;");
+		query->bind(1, group.ToString());
+		query->bind(2, permission.ToString());
+		query->exec();
+	}
+
+	/// <summary>
+	/// Creates the normalized membership tables. The first time they are created the legacy comma-joined columns are
+	/// copied over in one transaction, if that fails the tables are dropped again and the legacy schema stays in use.
+	/// </summary>
+	bool PrepareNormalizedSchema()
+	{
+		try
+		{
+			SQLite::Statement existsQuery(db_, "SELECT count(1) FROM sqlite_master WHERE type = 'table' AND name = 'PlayerGroups';");
+			existsQuery.executeStep();
+			if (existsQuery.getColumn(0).getInt() != 0)
+				return true;
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->critical("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return false;
+		}
+
+		try
+		{
+			// Parse the legacy columns before the tables exist, so the loaders still read the old layout
+			normalized_ = false;
+			auto players = InitPlayers();
+			auto tribes = InitTribes();
+			auto groups = InitGroups();
+			normalized_ = true;
+
+			SQLite::Transaction transaction(db_);
+
+			db_.exec("create table PlayerGroups ("
+				"EOS_Id text not null COLLATE NOCASE,"
+				"GroupName text not null COLLATE NOCASE,"
+				"Timed integer not null default 0,"
+				"DelayUntil integer not null default 0,"
+				"ExpireAt integer not null default 0,"
+				"primary key (EOS_Id, GroupName, Timed)"
+				");");
+			db_.exec("create index PlayerGroups_GroupName on PlayerGroups (GroupName);");
+			db_.exec("create table TribeGroups ("
+				"TribeId integer not null,"
+				"GroupName text not null COLLATE NOCASE,"
+				"Timed integer not null default 0,"
+				"DelayUntil integer not null default 0,"
+				"ExpireAt integer not null default 0,"
+				"primary key (TribeId, GroupName, Timed)"
+				");");
+			db_.exec("create index TribeGroups_GroupName on TribeGroups (GroupName);");
+			db_.exec("create table GroupPermissions ("
+				"GroupName text not null COLLATE NOCASE,"
+				"Permission text not null COLLATE NOCASE,"
+				"primary key (GroupName, Permission)"
+				");");
+
+			for (const auto& player : players)
+			{
+				for (const auto& group : player.second.Groups)
+					WritePlayerMembership(player.first, group);
+				for (const auto& group : player.second.TimedGroups)
+					WritePlayerMembership(player.first, group);
+			}
+			for (const auto& tribe : tribes)
+			{
+				for (const auto& group : tribe.second.Groups)
+					WriteTribeMembership(tribe.first, group);
+				for (const auto& group : tribe.second.TimedGroups)
+					WriteTribeMembership(tribe.first, group);
+			}
+			for (const auto& group : groups)
+			{
+				for (const auto& permission : group.second.PermissionList)
+					WriteGroupPermission(group.first, permission);
+			}
+
+			transaction.commit();
+
+			Log::GetLog()->info("Migrated {} players, {} tribes and {} groups to the normalized schema", players.size(), tribes.size(), groups.size());
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->critical("({} {}) Failed to migrate to the normalized schema, using legacy columns! {}", __FILE__, __FUNCTION__, exception.what());
+			return false;
+		}
+
+		return true;
 	}
 
 	void upgradeDatabase()
@@ -872,8 +1735,24 @@ public:
 				Log::GetLog()->critical("({} {}) Failed to update Permissions players table! {}", __FILE__, __FUNCTION__, exception.what());
 			}
 		}
+
+		if (!IsFieldExists("groups", "Parents"))
+		{
+			try
+			{
+				db_.exec("ALTER TABLE groups ADD COLUMN Parents text DEFAULT '' COLLATE NOCASE;");
+			}
+			catch (const std::exception& exception)
+			{
+				Log::GetLog()->critical("({} {}) Failed to update Permissions groups table! {}", __FILE__, __FUNCTION__, exception.what());
+			}
+		}
 	}
 
 private:
 	SQLite::Database db_;
+	// Declared after db_ so they are finalized before the connection closes
+	std::unordered_map<std::string, std::unique_ptr<SQLite::Statement>> statements_;
+	// Memberships in PlayerGroups/TribeGroups/GroupPermissions instead of the comma-joined columns
+	bool normalized_;
 };
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "GroupNames.h"
+
+/// <summary>
+/// Group changes made during a tick, handed to subscribers in one go at the end of it. A membership changed more than
+/// once in the same tick keeps its first position and its last state, so a bulk grant that touches a player twice
+/// reports it once. Mutations can come from any thread, the queue is drained on the game thread.
+/// </summary>
+class GroupChangeQueue {
+public:
+	void push(Permissions::GroupChange change)
+	{
+		const Key key{ change.EosId, change.TribeId, Permissions::groupNames.find(change.Group), change.bIsTimedGroup };
+
+		std::lock_guard<std::mutex> lg(mutex);
+		// Groups that were never interned can't be told apart by id, they are rare enough to just be appended
+		if (key.Group != GroupNameTable::Invalid)
+		{
+			auto [iter, inserted] = positions.try_emplace(key, changes.size());
+			if (!inserted)
+			{
+				changes[iter->second] = std::move(change);
+				return;
+			}
+		}
+		changes.push_back(std::move(change));
+	}
+
+	std::vector<Permissions::GroupChange> take()
+	{
+		std::vector<Permissions::GroupChange> taken;
+		std::lock_guard<std::mutex> lg(mutex);
+		taken.swap(changes);
+		positions.clear();
+		return taken;
+	}
+
+private:
+	struct Key {
+		FString EosId;
+		int TribeId;
+		GroupId Group;
+		bool Timed;
+
+		bool operator==(const Key& other) const
+		{
+			return TribeId == other.TribeId && Group == other.Group && Timed == other.Timed && FStringEqual()(EosId, other.EosId);
+		}
+	};
+
+	struct KeyHash {
+		std::size_t operator()(const Key& key) const noexcept
+		{
+			std::size_t hash = FStringHash()(key.EosId);
+			hash ^= std::hash<int>()(key.TribeId) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+			hash ^= std::hash<GroupId>()(key.Group) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+			return hash * 2 + (key.Timed ? 1 : 0);
+		}
+	};
+
+	std::mutex mutex;
+	std::vector<Permissions::GroupChange> changes;
+	// Index into changes of each membership queued this tick
+	std::unordered_map<Key, size_t, KeyHash> positions;
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <unordered_set>
+#include <vector>
+
+#include "CachedGroup.h"
+
+namespace Permissions::Inheritance
+{
+	struct Ancestor {
+		FString Name;
+		// Null if no group has that name, its permissions and parents are then left out
+		const CachedGroup* Group;
+	};
+
+	/// <summary>
+	/// Every group group inherits from, parents first and then their parents, each once. find(name) returns the group
+	/// or nullptr. AddGroupParent refuses cycles, but rows edited outside the plugin or parents added on two servers at
+	/// once can still form one, it is cut where it leads back to the group and cycle is set.
+	/// </summary>
+	template <typename Find>
+	std::vector<Ancestor> Ancestors(const FString& name, const CachedGroup& group, Find&& find, bool* cycle = nullptr)
+	{
+		std::vector<Ancestor> ancestors;
+		std::unordered_set<FString, FStringNoCaseHash, FStringNoCaseEqual> visited{ name };
+		std::vector<FString> pending;
+		for (const auto& parent : group.ParentList)
+			pending.push_back(parent);
+		for (size_t next = 0; next < pending.size(); ++next)
+		{
+			const FString parent = pending[next];
+			if (!visited.insert(parent).second)
+			{
+				if (cycle && FStringNoCaseEqual()(parent, name))
+					*cycle = true;
+				continue;
+			}
+
+			const CachedGroup* parentGroup = find(parent);
+			ancestors.push_back(Ancestor{ parent, parentGroup });
+			if (!parentGroup)
+				continue;
+			for (const auto& grandparent : parentGroup->ParentList)
+				pending.push_back(grandparent);
+		}
+		return ancestors;
+	}
+
+	template <typename Find>
+	bool InheritsFrom(const FString& name, const CachedGroup& group, const FString& ancestor, Find&& find)
+	{
+		for (const auto& inherited : Ancestors(name, group, find))
+		{
+			if (FStringNoCaseEqual()(inherited.Name, ancestor))
+				return true;
+		}
+		return false;
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "CachedPermission.h"
+
+/// <summary>
+/// Group -> players holding a permanent or timed membership in it, kept in step with the player cache.
+/// Timed memberships are listed whether or not they are active, callers filter by time.
+/// </summary>
+class GroupMemberIndex {
+public:
+	struct Membership {
+		bool Permanent = false, Timed = false;
+		long long DelayUntilTime = 0, ExpireAtTime = 0;
+
+		bool isActive(long long now) const
+		{
+			return Permanent || (Timed && (DelayUntilTime <= 0 || now >= DelayUntilTime) && ExpireAtTime > 0 && now < ExpireAtTime);
+		}
+	};
+	using Members = std::unordered_map<FString, Membership, FStringHash, FStringEqual>;
+
+	// Replaces what was indexed for the player
+	void setPlayer(const FString& eos_id, const CachedPermission& permission)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		Unlink(eos_id);
+		Link(eos_id, permission);
+	}
+
+	void erasePlayer(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		Unlink(eos_id);
+	}
+
+	template <typename Map>
+	void assign(const Map& players)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		groups.clear();
+		playerGroups.clear();
+		for (const auto& player : players)
+			Link(player.first, player.second);
+	}
+
+	// Visits the group's members in place under the lock, fn must not call back into the index
+	template <typename Fn>
+	void forEach(const FString& group, Fn&& fn)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto iter = groups.find(Permissions::groupNames.find(group));
+		if (iter == groups.end())
+			return;
+		for (const auto& [eos_id, membership] : iter->second)
+			fn(eos_id, membership);
+	}
+
+private:
+	// Caller holds mutex
+	void Link(const FString& eos_id, const CachedPermission& permission)
+	{
+		auto& indexed = playerGroups[eos_id];
+		for (const auto group : permission.Groups.Ids())
+			indexed.push_back(group);
+		for (const auto& group : permission.TimedGroups)
+		{
+			if (std::find(indexed.begin(), indexed.end(), group.Group) == indexed.end())
+				indexed.push_back(group.Group);
+		}
+
+		if (indexed.empty())
+		{
+			playerGroups.erase(eos_id);
+			return;
+		}
+
+		for (const auto group : permission.Groups.Ids())
+			groups[group][eos_id].Permanent = true;
+		for (const auto& group : permission.TimedGroups)
+		{
+			auto& membership = groups[group.Group][eos_id];
+			membership.Timed = true;
+			membership.DelayUntilTime = group.DelayUntilTime;
+			membership.ExpireAtTime = group.ExpireAtTime;
+		}
+	}
+
+	// Caller holds mutex
+	void Unlink(const FString& eos_id)
+	{
+		auto player = playerGroups.find(eos_id);
+		if (player == playerGroups.end())
+			return;
+
+		for (const auto& group : player->second)
+		{
+			auto iter = groups.find(group);
+			if (iter == groups.end())
+				continue;
+			iter->second.erase(eos_id);
+			if (iter->second.empty())
+				groups.erase(iter);
+		}
+		playerGroups.erase(player);
+	}
+
+	std::mutex mutex;
+	std::unordered_map<GroupId, Members> groups;
+	// What each player was indexed under, so a change only touches its own entries
+	std::unordered_map<FString, std::vector<GroupId>, FStringHash, FStringEqual> playerGroups;
+};
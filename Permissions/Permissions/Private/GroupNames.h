@@ -0,0 +1,224 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CachedGroup.h"
+#include "SnapshotMap.h"
+
+using GroupId = uint32_t;
+
+/// <summary>
+/// Group names interned to small ids, so memberships are stored and compared as integers. Matching is
+/// case-insensitive like the group table, the spelling shown is the one of the group row (see setCanonical), or the
+/// first one seen for a name without a row. Ids are never reused and names never freed, a removed group keeps its id
+/// in case it comes back. Lookups don't lock, interning a new name or spelling does.
+/// </summary>
+class GroupNameTable {
+public:
+	static constexpr GroupId Invalid = UINT32_MAX;
+
+	// Invalid if the name was never interned, no member can hold it then
+	GroupId find(const FString& name) const
+	{
+		auto id = ids.find(name);
+		return id ? *id : Invalid;
+	}
+
+	GroupId intern(const FString& name)
+	{
+		if (auto id = ids.find(name))
+			return *id;
+
+		std::lock_guard<std::mutex> lg(mutex);
+		if (auto id = ids.find(name))
+			return *id;
+
+		if (count >= ChunkSize * MaxChunks)
+		{
+			Log::GetLog()->critical("({} {}) Too many distinct group names, ignoring {}", __FILE__, __FUNCTION__, name.ToString());
+			return Invalid;
+		}
+
+		const GroupId id = count++;
+		auto& chunk = chunks[id / ChunkSize];
+		if (!chunk)
+		{
+			owned[id / ChunkSize] = std::make_unique<std::atomic<const FString*>[]>(ChunkSize);
+			chunk.store(owned[id / ChunkSize].get(), std::memory_order_release);
+		}
+		Store(id, name);
+
+		// Published after the name is stored, anyone finding the id can read it
+		ids.set(name, id);
+		return id;
+	}
+
+	/// <summary>
+	/// Makes name, as spelled in the group row, the spelling shown for its id. A group re-created or renamed with
+	/// different case then shows up with the new spelling. References to the old spelling stay valid.
+	/// </summary>
+	void setCanonical(const FString& name)
+	{
+		const GroupId id = intern(name);
+		if (id == Invalid)
+			return;
+
+		std::lock_guard<std::mutex> lg(mutex);
+		if (!this->name(id).Equals(name, ESearchCase::CaseSensitive))
+			Store(id, name);
+	}
+
+	const FString& name(GroupId id) const
+	{
+		static const FString empty;
+		if (id == Invalid)
+			return empty;
+		return *chunks[id / ChunkSize].load(std::memory_order_acquire)[id % ChunkSize].load(std::memory_order_acquire);
+	}
+
+	// Spelling shown for name, name itself if it was never interned
+	const FString& canonical(const FString& name) const
+	{
+		const GroupId id = find(name);
+		return id == Invalid ? name : this->name(id);
+	}
+
+private:
+	// Slots live in fixed chunks that never move and spellings are never freed, so name() can hand out references
+	// without locking
+	static constexpr GroupId ChunkSize = 1024;
+	static constexpr GroupId MaxChunks = 256;
+
+	// Caller holds mutex
+	void Store(GroupId id, const FString& name)
+	{
+		spellings.push_back(std::make_unique<const FString>(name));
+		chunks[id / ChunkSize].load(std::memory_order_relaxed)[id % ChunkSize].store(spellings.back().get(), std::memory_order_release);
+	}
+
+	SnapshotMap<FString, GroupId, FStringNoCaseHash, FStringNoCaseEqual> ids;
+	std::array<std::atomic<std::atomic<const FString*>*>, MaxChunks> chunks{};
+	std::array<std::unique_ptr<std::atomic<const FString*>[]>, MaxChunks> owned;
+	std::vector<std::unique_ptr<const FString>> spellings;
+	GroupId count = 0;
+	std::mutex mutex;
+};
+
+namespace Permissions
+{
+	inline GroupNameTable groupNames;
+}
+
+/// <summary>
+/// Groups of a player or tribe as interned ids in the order they were granted. Drop-in for the TArray<FString> it
+/// replaces: players hold a handful of groups, so scanning a few integers beats hashing, and each membership costs
+/// 4 bytes instead of an FString allocation.
+/// </summary>
+class GroupSet {
+public:
+	class const_iterator {
+	public:
+		explicit const_iterator(std::vector<GroupId>::const_iterator position)
+			: position(position)
+		{
+		}
+
+		const FString& operator*() const
+		{
+			return Permissions::groupNames.name(*position);
+		}
+
+		const_iterator& operator++()
+		{
+			++position;
+			return *this;
+		}
+
+		bool operator!=(const const_iterator& other) const
+		{
+			return position != other.position;
+		}
+
+	private:
+		std::vector<GroupId>::const_iterator position;
+	};
+
+	bool Contains(GroupId id) const
+	{
+		return std::find(groups.begin(), groups.end(), id) != groups.end();
+	}
+
+	bool Contains(const FString& group) const
+	{
+		return Contains(Permissions::groupNames.find(group));
+	}
+
+	void AddUnique(GroupId id)
+	{
+		if (id != GroupNameTable::Invalid && !Contains(id))
+			groups.push_back(id);
+	}
+
+	void AddUnique(const FString& group)
+	{
+		AddUnique(Permissions::groupNames.intern(group));
+	}
+
+	// Memberships are unique, same as AddUnique
+	void Add(const FString& group)
+	{
+		AddUnique(group);
+	}
+
+	int32 Remove(const FString& group)
+	{
+		auto iter = std::find(groups.begin(), groups.end(), Permissions::groupNames.find(group));
+		if (iter == groups.end())
+			return 0;
+		groups.erase(iter);
+		return 1;
+	}
+
+	// Empties the set but keeps its storage, for buffers reused across resolves
+	void Reset()
+	{
+		groups.clear();
+	}
+
+	int32 Num() const
+	{
+		return static_cast<int32>(groups.size());
+	}
+
+	const std::vector<GroupId>& Ids() const
+	{
+		return groups;
+	}
+
+	TArray<FString> ToArray() const
+	{
+		TArray<FString> names;
+		names.Reserve(Num());
+		for (const auto id : groups)
+			names.Add(Permissions::groupNames.name(id));
+		return names;
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(groups.begin());
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(groups.end());
+	}
+
+private:
+	std::vector<GroupId> groups;
+};
@@ -7,6 +7,17 @@ namespace Permissions
 		return AsaApi::Tools::GetCurrentDir() + "/ArkApi/Plugins/Permissions/ArkDB.db";
 	}
 
+	inline std::string GetSnapshotPath()
+	{
+		return AsaApi::Tools::GetCurrentDir() + "/ArkApi/Plugins/Permissions/PermissionsSnapshot.bin";
+	}
+
+	// Files of Permissions.Export and Permissions.Import, kept in the plugin folder
+	inline std::string GetTransferPath(const std::string& fileName)
+	{
+		return AsaApi::Tools::GetCurrentDir() + "/ArkApi/Plugins/Permissions/" + fileName;
+	}
+
 	inline std::string GetConfigPath()
 	{
 		return AsaApi::Tools::GetCurrentDir() + "/ArkApi/Plugins/Permissions/config.json";
@@ -1,18 +1,24 @@
 #include "Hooks.h"
 
 #include "Main.h"
+#include "TribePresence.h"
 
 namespace Permissions::Hooks
 {
 	DECLARE_HOOK(AShooterGameMode_HandleNewPlayer, bool, AShooterGameMode*, AShooterPlayerController*, UPrimalPlayerData*, AShooterCharacter*, bool);
 	DECLARE_HOOK(AShooterPlayerController_ClientNotifyAdmin, void, AShooterPlayerController*);
+	DECLARE_HOOK(AShooterGameMode_Logout, void, AShooterGameMode*, AController*);
+	DECLARE_HOOK(AShooterPlayerState_AddToTribe, bool, AShooterPlayerState*, FTribeData*, bool, bool, bool, APlayerController*);
+	DECLARE_HOOK(AShooterPlayerState_ClearTribe, void, AShooterPlayerState*, bool, bool, APlayerController*);
 
 	bool Hook_AShooterGameMode_HandleNewPlayer(AShooterGameMode* _this, AShooterPlayerController* new_player, UPrimalPlayerData* player_data, AShooterCharacter* player_character, bool is_from_login)
 	{
 		FString eos_id;
 		new_player->GetUniqueNetIdAsString(&eos_id);
-		
-		if (!database->IsPlayerExists(*eos_id))
+
+		// Lazy player loading reads the row in the background, adds a new player there and keeps it until logout
+		database->SetPlayerOnline(*eos_id, true);
+		if (!Permissions::Players::Lazy && !database->IsPlayerExists(*eos_id))
 		{
 			const bool res = database->AddPlayer(*eos_id);
 			if (!res)
@@ -21,8 +27,49 @@ namespace Permissions::Hooks
 			}
 		}
 
-		return AShooterGameMode_HandleNewPlayer_original(_this, new_player, player_data, player_character,
+		const bool result = AShooterGameMode_HandleNewPlayer_original(_this, new_player, player_data, player_character,
 			is_from_login);
+
+		Presence::UpdatePlayer(new_player);
+
+		// Online state and tribe online counts feed into resolved groups
+		Cache::Invalidate();
+
+		return result;
+	}
+
+	void Hook_AShooterGameMode_Logout(AShooterGameMode* _this, AController* exiting)
+	{
+		auto* player_controller = static_cast<AShooterPlayerController*>(exiting);
+		if (player_controller)
+		{
+			FString eos_id;
+			player_controller->GetUniqueNetIdAsString(&eos_id);
+			Presence::RemovePlayer(eos_id);
+			database->SetPlayerOnline(*eos_id, false);
+		}
+
+		AShooterGameMode_Logout_original(_this, exiting);
+
+		Cache::Invalidate();
+	}
+
+	bool Hook_AShooterPlayerState_AddToTribe(AShooterPlayerState* _this, FTribeData* tribe_data, bool merge_tribe, bool force, bool is_from_invite, APlayerController* inviter_pc)
+	{
+		const bool result = AShooterPlayerState_AddToTribe_original(_this, tribe_data, merge_tribe, force, is_from_invite, inviter_pc);
+
+		Presence::UpdatePlayer(Presence::FindController(_this));
+		Cache::Invalidate();
+
+		return result;
+	}
+
+	void Hook_AShooterPlayerState_ClearTribe(AShooterPlayerState* _this, bool dont_remove_from_tribe, bool force, APlayerController* for_pc)
+	{
+		AShooterPlayerState_ClearTribe_original(_this, dont_remove_from_tribe, force, for_pc);
+
+		Presence::UpdatePlayer(Presence::FindController(_this));
+		Cache::Invalidate();
 	}
 
 	void Hook_AShooterPlayerController_ClientNotifyAdmin(AShooterPlayerController* player_controller)
@@ -40,5 +87,8 @@ namespace Permissions::Hooks
 	{
 		AsaApi::GetHooks().SetHook("AShooterGameMode.HandleNewPlayer_Implementation(AShooterPlayerController*,UPrimalPlayerData*,AShooterCharacter*,bool)",&Hook_AShooterGameMode_HandleNewPlayer, &AShooterGameMode_HandleNewPlayer_original);
 		AsaApi::GetHooks().SetHook("AShooterPlayerController.ClientNotifyAdmin()", &Hook_AShooterPlayerController_ClientNotifyAdmin, &AShooterPlayerController_ClientNotifyAdmin_original);
+		AsaApi::GetHooks().SetHook("AShooterGameMode.Logout(AController*)", &Hook_AShooterGameMode_Logout, &AShooterGameMode_Logout_original);
+		AsaApi::GetHooks().SetHook("AShooterPlayerState.AddToTribe(FTribeData&,bool,bool,bool,APlayerController*)", &Hook_AShooterPlayerState_AddToTribe, &AShooterPlayerState_AddToTribe_original);
+		AsaApi::GetHooks().SetHook("AShooterPlayerState.ClearTribe(bool,bool,APlayerController*)", &Hook_AShooterPlayerState_ClearTribe, &AShooterPlayerState_ClearTribe_original);
 	}
 }
\ No newline at end of file
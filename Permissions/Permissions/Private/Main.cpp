@@ -12,6 +12,12 @@
 
 #include "Hooks.h"
 #include "Helper.h"
+#include "TribePresence.h"
+#include "CallbackCache.h"
+#include "Stats.h"
+#include "Snapshot.h"
+#include "Transfer.h"
+#include "Compaction.h"
 
 #pragma comment(lib, "AsaApi.lib")
 
@@ -21,7 +27,13 @@ namespace Permissions
 {
 	nlohmann::json config;
 	time_t lastDatabaseSyncTime = time(0);
+	time_t lastFullDatabaseSyncTime = time(0);
+	time_t lastSnapshotTime = time(0);
 	int SyncFrequency = 60;
+	int FullSyncFrequency = 3600;
+	// Seconds between checks of the change log for changes made on other servers, 0 leaves it to SyncFrequency
+	int ChangeCheckFrequency = 0;
+	time_t lastChangeCheckTime = time(0);
 	bool HideAllPlayerSuccessMessages = false;
 	bool SendMessagesAsNotification = false;
 	float TextSize = 1.5f;
@@ -40,32 +52,56 @@ namespace Permissions
 		return nullptr;
 	}
 
+	bool FindOnlinePlayer(const FString& eos_id, OnlinePlayer& player)
+	{
+		return Presence::FindPlayer(eos_id, player);
+	}
+
+	void GetOnlinePlayers(TArray<FString>& eos_ids, TArray<int>& tribe_ids)
+	{
+		std::lock_guard<std::mutex> lg(Presence::presenceMutex);
+		eos_ids.Reserve(static_cast<int32>(Presence::onlinePlayers.size()));
+		tribe_ids.Reserve(static_cast<int32>(Presence::onlinePlayers.size()));
+		for (const auto& player : Presence::onlinePlayers)
+		{
+			eos_ids.Add(player.first);
+			tribe_ids.Add(player.second.TribeId);
+		}
+	}
+
 	TArray<FString> GetTribeDefaultGroups(FTribeData* tribeData)
 	{
 		TArray<FString> groups;
 		if (tribeData)
 		{
-			auto world = AsaApi::GetApiUtils().GetWorld();
-			auto tribeId = tribeData->TribeIDField();
-			auto Tribemates = tribeData->MembersPlayerDataIDField();
-			const auto& player_controllers = world->PlayerControllerListField();
-			int tribematesOnline = 0;
-			for (TWeakObjectPtr<APlayerController> player_controller : player_controllers)
-			{
-				AShooterPlayerController* pc = static_cast<AShooterPlayerController*>(player_controller.Get());
-				if (pc)
-				{
-					auto playerId = pc->GetLinkedPlayerID();
-					if (Tribemates.Contains(playerId))
-						tribematesOnline++;
-				}
-			}
-			groups.Add(FString::Format("TribeSize:{}", Tribemates.Num()));
-			groups.Add(FString::Format("TribeOnline:{}", tribematesOnline));
+			groups.Add(FString::Format("TribeSize:{}", tribeData->MembersPlayerDataIDField().Num()));
+			groups.Add(FString::Format("TribeOnline:{}", Presence::GetTribeOnline(tribeData->TribeIDField())));
 		}
 		return groups;
 	}
 
+	// Interns "TribeSize:n" and the like once per count, resolving a player then doesn't format the name again
+	GroupId TribeCountGroup(std::vector<GroupId>& ids, const char* prefix, int count)
+	{
+		if (count < 0)
+			return GroupNameTable::Invalid;
+		if (static_cast<size_t>(count) >= ids.size())
+			ids.resize(count + 1, GroupNameTable::Invalid);
+		if (ids[count] == GroupNameTable::Invalid)
+			ids[count] = groupNames.intern(FString::Format("{}:{}", prefix, count));
+		return ids[count];
+	}
+
+	void AddTribeDefaultGroups(FTribeData* tribeData, GroupSet& groups)
+	{
+		if (!tribeData)
+			return;
+
+		thread_local std::vector<GroupId> sizeGroups, onlineGroups;
+		groups.AddUnique(TribeCountGroup(sizeGroups, "TribeSize", tribeData->MembersPlayerDataIDField().Num()));
+		groups.AddUnique(TribeCountGroup(onlineGroups, "TribeOnline", Presence::GetTribeOnline(tribeData->TribeIDField())));
+	}
+
 	// AddPlayerToGroup
 	std::optional<std::string> AddPlayerToGroup(const FString& cmd)
 	{
@@ -547,6 +583,68 @@ namespace Permissions
 			SendRconReply(rcon_connection, rcon_packet->Id, result.value().c_str());
 	}
 
+	// AddGroupParent
+
+	std::optional<std::string> AddGroupParent(const FString& cmd)
+	{
+		TArray<FString> parsed;
+		cmd.ParseIntoArray(parsed, L" ", true);
+
+		if (!parsed.IsValidIndex(2))
+			return "Wrong syntax";
+
+		const FString group = *parsed[1];
+		const FString parent = *parsed[2];
+
+		return database->AddGroupParent(group, parent);
+	}
+
+	void AddGroupParentCmd(APlayerController* player_controller, FString* cmd, bool)
+	{
+		auto result = AddGroupParent(*cmd);
+		HandlePlayerMessage(player_controller, result, "Successfully added parent group");
+	}
+
+	void AddGroupParentRcon(RCONClientConnection* rcon_connection, RCONPacket* rcon_packet, UWorld*)
+	{
+		auto result = AddGroupParent(rcon_packet->Body);
+		if (!result.has_value())
+			SendRconReply(rcon_connection, rcon_packet->Id, "Successfully added parent group");
+		else
+			SendRconReply(rcon_connection, rcon_packet->Id, result.value().c_str());
+	}
+
+	// RemoveGroupParent
+
+	std::optional<std::string> RemoveGroupParent(const FString& cmd)
+	{
+		TArray<FString> parsed;
+		cmd.ParseIntoArray(parsed, L" ", true);
+
+		if (!parsed.IsValidIndex(2))
+			return "Wrong syntax";
+
+		const FString group = *parsed[1];
+		const FString parent = *parsed[2];
+
+		return database->RemoveGroupParent(group, parent);
+	}
+
+	void RemoveGroupParentCmd(APlayerController* player_controller, FString* cmd, bool)
+	{
+		auto result = RemoveGroupParent(*cmd);
+		HandlePlayerMessage(player_controller, result, "Successfully removed parent group");
+	}
+
+	void RemoveGroupParentRcon(RCONClientConnection* rcon_connection, RCONPacket* rcon_packet, UWorld*)
+	{
+		auto result = RemoveGroupParent(rcon_packet->Body);
+		if (!result.has_value())
+			SendRconReply(rcon_connection, rcon_packet->Id, "Successfully removed parent group");
+		else
+			SendRconReply(rcon_connection, rcon_packet->Id, result.value().c_str());
+	}
+
 	// PlayerGroups
 	std::string getTimeLeft(int secs, int intervalsToShow) {
 		int days, hours, mins;
@@ -591,9 +689,9 @@ namespace Permissions
 		CachedPermission permissions = database->HydrateTribeGroups(tribe_id);
 
 		FString groups_str = tribeDefaults;
-		for (int32 Index = 0; Index != permissions.Groups.Num(); ++Index) {
+		for (const FString& current_group : permissions.Groups) {
 			if (groups_str.Len() > 0) groups_str += ", ";
-			groups_str += permissions.Groups[Index];
+			groups_str += current_group;
 		}
 		auto nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 
@@ -602,7 +700,7 @@ namespace Permissions
 			if (current_group.ExpireAtTime <= nowSecs) continue;
 			if (groups_str.Len() > 0)
 				groups_str += "\n";
-			groups_str += current_group.GroupName;
+			groups_str += current_group.GroupName();
 			if (current_group.DelayUntilTime > 0 && current_group.DelayUntilTime > nowSecs) {
 				auto diff = current_group.DelayUntilTime - nowSecs;
 				groups_str += FString::Format(" - Activates in {}", getTimeLeft(diff, 2));
@@ -624,8 +722,9 @@ namespace Permissions
 	}
 
 	FString GetPlayerGroupsStr(const FString eos_id, bool forChat) {
+		// Lazy mode reads the row in the background, asking again once it's in shows the groups
 		if (!database->IsPlayerExists(eos_id))
-			return "";
+			return database->IsPlayerKnown(eos_id) ? "" : "Loading the player's groups, try again in a moment";
 
 		CachedPermission permissions = database->HydratePlayerGroups(eos_id);
 
@@ -642,7 +741,7 @@ namespace Permissions
 			if (current_group.ExpireAtTime < nowSecs) continue;
 			if (groups_str.Len() > 0)
 				groups_str += "\n";
-			groups_str += current_group.GroupName;
+			groups_str += current_group.GroupName();
 			if (current_group.DelayUntilTime > 0 && current_group.DelayUntilTime > nowSecs)
 			{
 				auto diff = current_group.DelayUntilTime - nowSecs;
@@ -655,44 +754,20 @@ namespace Permissions
 			}
 		}
 
-		auto world = AsaApi::GetApiUtils().GetWorld();
-		if (world)
+		OnlinePlayer online;
+		if (FindOnlinePlayer(eos_id, online) && online.TribeId > 0)
 		{
-			const auto& player_controllers = world->PlayerControllerListField();
-			for (TWeakObjectPtr<APlayerController> player_controller : player_controllers)
+			auto defaultTribeGroups = GetTribeDefaultGroups(GetTribeData(online.Controller));
+			FString defaults = "";
+			for (auto tribeGroup : defaultTribeGroups)
 			{
-				APlayerController* pc = player_controller.Get();
-				if (pc)
-				{
-					AShooterPlayerController* shooter_pc = static_cast<AShooterPlayerController*>(pc);
-					if (shooter_pc)
-					{
-						auto tribeData = Permissions::GetTribeData(shooter_pc);
-						if (tribeData)
-						{
-							auto tribeId = tribeData->TribeIDField();
-							if (tribeId > 0)
-							{
-								auto defaultTribeGroups = GetTribeDefaultGroups(tribeData);
-								FString defaults = "";
-								for (auto tribeGroup : defaultTribeGroups)
-								{
-									if (defaults.Len() > 0) defaults += ", ";
-									defaults += tribeGroup;
-								}
-								FString tribeStr = GetTribeGroupsStr(defaults, tribeId, forChat);
-								if (groups_str.Len() > 0 && tribeStr.Len() > 0)
-									groups_str += "\n";
-								groups_str += tribeStr;
-							}
-						}
-					}
-					else
-						Log::GetLog()->error("({} {}) AShooterPlayerController is null", __FILE__, __FUNCTION__);
-				}
-				else
-					Log::GetLog()->error("({} {}) APlayerController is null", __FILE__, __FUNCTION__);
+				if (defaults.Len() > 0) defaults += ", ";
+				defaults += tribeGroup;
 			}
+			FString tribeStr = GetTribeGroupsStr(defaults, online.TribeId, forChat);
+			if (groups_str.Len() > 0 && tribeStr.Len() > 0)
+				groups_str += "\n";
+			groups_str += tribeStr;
 		}
 
 		return groups_str;
@@ -833,7 +908,16 @@ namespace Permissions
 				permissions += permission + L"; ";
 			}
 
-			groups += FString::Format(L"{0}) {1} - {2}\n", i++, group.ToString(), permissions.ToString());
+			FString parents;
+			for (const auto& parent : database->GetGroupParents(group))
+			{
+				parents += parent + L"; ";
+			}
+
+			if (parents.IsEmpty())
+				groups += FString::Format(L"{0}) {1} - {2}\n", i++, group.ToString(), permissions.ToString());
+			else
+				groups += FString::Format(L"{0}) {1} (inherits {2}) - {3}\n", i++, group.ToString(), parents.ToString(), permissions.ToString());
 		}
 
 		return groups;
@@ -853,6 +937,108 @@ namespace Permissions
 		SendRconReply(rcon_connection, rcon_packet->Id, *result);
 	}
 
+	// Stats, "Permissions.Stats reset" clears the counters after printing them
+	FString StatsReport(const FString& cmd)
+	{
+		TArray<FString> parsed;
+		cmd.ParseIntoArray(parsed, L" ", true);
+
+		std::string result;
+		for (const auto& line : GetStats())
+		{
+			if (!result.empty())
+				result += "\n";
+			result += line;
+		}
+
+		if (parsed.IsValidIndex(1) && parsed[1] == L"reset")
+			Stats::Reset();
+
+		return FString(result.c_str());
+	}
+
+	void StatsCmd(APlayerController* player_controller, FString* cmd, bool)
+	{
+		const auto shooter_controller = static_cast<AShooterPlayerController*>(player_controller);
+
+		const FString result = StatsReport(*cmd);
+		AsaApi::GetApiUtils().SendServerMessage(shooter_controller, FColorList::White, *result);
+	}
+
+	void StatsRcon(RCONClientConnection* rcon_connection, RCONPacket* rcon_packet, UWorld*)
+	{
+		const FString result = StatsReport(rcon_packet->Body);
+		SendRconReply(rcon_connection, rcon_packet->Id, *result);
+	}
+
+	// Export / Import
+
+	std::atomic<bool> transferRunning{ false };
+
+	// Runs the export or import on the pool, the outcome is logged once it is done
+	std::optional<std::string> TransferCommand(const FString& cmd, bool import)
+	{
+		TArray<FString> parsed;
+		cmd.ParseIntoArray(parsed, L" ", true);
+
+		if (!parsed.IsValidIndex(1))
+			return "Wrong syntax";
+
+		// Only a file name, commands shouldn't be able to reach outside the plugin folder
+		const std::string fileName = parsed[1].ToString();
+		if (fileName.find_first_of("/\\:") != std::string::npos || fileName.find("..") != std::string::npos)
+			return "Expected a file name, the file is kept in the Permissions plugin folder";
+
+		if (transferRunning.exchange(true))
+			return "An export or import is already running";
+
+		pool.push_task(
+			[import, path = GetTransferPath(fileName)]()
+			{
+				size_t records = 0, skipped = 0;
+				const auto error = import ? Transfer::Import(*database, path, records, skipped) : Transfer::Export(*database, path, records);
+				if (error)
+					Log::GetLog()->error("{} of {} stopped after {} records: {}", import ? "Import" : "Export", path, records, *error);
+				else if (import)
+					Log::GetLog()->info("Imported {} records from {}, skipped {} malformed lines", records, path, skipped);
+				else
+					Log::GetLog()->info("Exported {} records to {}", records, path);
+				transferRunning = false;
+			}
+		);
+		return {};
+	}
+
+	void ExportCmd(APlayerController* player_controller, FString* cmd, bool)
+	{
+		auto result = TransferCommand(*cmd, false);
+		HandlePlayerMessage(player_controller, result, "Export started, the result is logged");
+	}
+
+	void ExportRcon(RCONClientConnection* rcon_connection, RCONPacket* rcon_packet, UWorld*)
+	{
+		auto result = TransferCommand(rcon_packet->Body, false);
+		if (!result.has_value())
+			SendRconReply(rcon_connection, rcon_packet->Id, "Export started, the result is logged");
+		else
+			SendRconReply(rcon_connection, rcon_packet->Id, result.value().c_str());
+	}
+
+	void ImportCmd(APlayerController* player_controller, FString* cmd, bool)
+	{
+		auto result = TransferCommand(*cmd, true);
+		HandlePlayerMessage(player_controller, result, "Import started, the result is logged");
+	}
+
+	void ImportRcon(RCONClientConnection* rcon_connection, RCONPacket* rcon_packet, UWorld*)
+	{
+		auto result = TransferCommand(rcon_packet->Body, true);
+		if (!result.has_value())
+			SendRconReply(rcon_connection, rcon_packet->Id, "Import started, the result is logged");
+		else
+			SendRconReply(rcon_connection, rcon_packet->Id, result.value().c_str());
+	}
+
 	// Chat commands
 
 	void ShowMyGroupsChat(AShooterPlayerController* player_controller, FString*, int, int)
@@ -869,14 +1055,129 @@ namespace Permissions
 	{
 		if (difftime(time(0), lastDatabaseSyncTime) >= SyncFrequency)
 		{
+			// Only rows from the change log are refetched, the occasional full reload picks up edits made outside the plugin
+			const bool fullSync = difftime(time(0), lastFullDatabaseSyncTime) >= FullSyncFrequency;
+			const bool saveSnapshot = Snapshot::IntervalSecs > 0 && difftime(time(0), lastSnapshotTime) >= Snapshot::IntervalSecs;
 			pool.push_task(
-				[]() { database->Init(); }
+				[fullSync, saveSnapshot]()
+				{
+					if (fullSync)
+						database->Init();
+					else
+						database->SyncChanges();
+
+					// Right after syncing, so a restart has as little as possible to catch up on
+					if (saveSnapshot)
+						Snapshot::Save(*database, GetSnapshotPath());
+				}
 			);
 
+			Presence::Rebuild();
+
 			lastDatabaseSyncTime = time(0);
+			if (fullSync)
+				lastFullDatabaseSyncTime = time(0);
+			if (saveSnapshot)
+				lastSnapshotTime = time(0);
 		}
 	}
 
+	std::atomic<bool> changeCheckRunning{ false };
+
+	// Between the regular syncs, applies what other servers changed as soon as it shows up in the change log
+	void CheckForChanges()
+	{
+		if (ChangeCheckFrequency <= 0 || changeCheckRunning || difftime(time(0), lastChangeCheckTime) < ChangeCheckFrequency)
+			return;
+
+		changeCheckRunning = true;
+		lastChangeCheckTime = time(0);
+		pool.push_task(
+			[]()
+			{
+				if (database->HasNewChanges())
+					database->SyncChanges();
+				changeCheckRunning = false;
+			}
+		);
+	}
+
+	time_t lastStatsLogTime = time(0);
+
+	void LogStats()
+	{
+		if (Stats::LogIntervalSecs <= 0 || difftime(time(0), lastStatsLogTime) < Stats::LogIntervalSecs)
+			return;
+
+		for (const auto& line : GetStats())
+			Log::GetLog()->info(line);
+		lastStatsLogTime = time(0);
+	}
+
+	time_t lastCompactionTime = time(0);
+	std::atomic<bool> compactionRunning{ false };
+
+	// Drops long expired timed memberships from the database and the caches, what was removed is logged
+	void CompactTimedGroups()
+	{
+		if (Compaction::IntervalSecs <= 0 || compactionRunning || difftime(time(0), lastCompactionTime) < Compaction::IntervalSecs)
+			return;
+
+		compactionRunning = true;
+		lastCompactionTime = time(0);
+		pool.push_task(
+			[]()
+			{
+				size_t players = 0, tribes = 0, removed = 0;
+				const auto error = Compaction::CompactTimedGroups(*database, players, tribes, removed);
+				if (error)
+					Log::GetLog()->error("Timed group compaction stopped after removing {} expired timed groups from {} players and {} tribes: {}", removed, players, tribes, *error);
+				else if (removed > 0)
+					Log::GetLog()->info("Removed {} expired timed groups from {} players and {} tribes", removed, players, tribes);
+				compactionRunning = false;
+			}
+		);
+	}
+
+	std::atomic<bool> writeFlushRunning{ false };
+
+	// Hands queued mutations to the pool, one flush at a time so writes reach the database in order
+	void ProcessPendingWrites()
+	{
+		ProcessWriteFailures();
+
+		if (writeFlushRunning || !database->IsWriteDue())
+			return;
+
+		writeFlushRunning = true;
+		pool.push_task(
+			[]()
+			{
+				database->FlushWrites();
+				writeFlushRunning = false;
+			}
+		);
+	}
+
+	std::atomic<bool> playerLoadRunning{ false };
+
+	// Lazy player loading, players the checks asked for are read on the pool so the game thread never waits on the database
+	void ProcessPlayerLoads()
+	{
+		database->RunDeferredChanges();
+		if (playerLoadRunning || !database->HasPlayerLoads())
+			return;
+
+		playerLoadRunning = true;
+		pool.push_task(
+			[]()
+			{
+				database->LoadRequestedPlayers();
+				playerLoadRunning = false;
+			}
+		);
+	}
+
 	void ReadConfig()
 	{
 		const std::string config_path = GetConfigPath();
@@ -892,6 +1193,18 @@ namespace Permissions
 		TextSize = config.value("TextSize", 1.5f);
 		DisplayTime = config.value("DisplayTime", 3.0f);
 
+		Cache::ResolvedCacheMs = config.value("ResolvedCacheMs", 1000);
+		Cache::CallbackCacheMs = config.value("CallbackCacheMs", 60000);
+		Writes::Async = config.value("AsyncWrites", true);
+		Writes::MaxAttempts = std::max(config.value("WriteMaxAttempts", 5), 1);
+		Stats::LogIntervalSecs = config.value("StatsLogIntervalSecs", 3600);
+		Players::OfflineCacheSize = config.value("OfflinePlayerCacheSize", 2000);
+		Snapshot::IntervalSecs = config.value("SnapshotIntervalSecs", 300);
+		ChangeCheckFrequency = config.value("ClusterChangeCheckTime", 0);
+		Transfer::ImportChunkRows = std::max(config.value("ImportChunkRows", 500), 1);
+		Compaction::IntervalSecs = config.value("TimedGroupCompactionSecs", 3600);
+		Cache::Invalidate();
+
 		file.close();
 	}
 
@@ -947,6 +1260,10 @@ namespace Permissions
 			if (SyncFrequency < 20)
 				SyncFrequency = 20;
 
+			FullSyncFrequency = config.value("ClusterFullSyncTime", 3600);
+			if (FullSyncFrequency < SyncFrequency)
+				FullSyncFrequency = SyncFrequency;
+
 		}
 		catch (const std::exception& error)
 		{
@@ -954,6 +1271,9 @@ namespace Permissions
 			throw;
 		}
 
+		// Switching it needs the caches to be rebuilt, so unlike the other settings it isn't reloaded
+		Players::Lazy = config.value("LazyPlayerLoading", false);
+
 		if (config.value("UseMysql", false))
 		{
 			database = std::make_unique<MySql>(
@@ -964,15 +1284,47 @@ namespace Permissions
 				config.value("MysqlPort", 3306),
 				config.value("MysqlPlayersTable", "Players"),
 				config.value("MysqlGroupsTable", "PermissionGroups"),
-				config.value("MysqlTribesTable", "TribePermissions"));
+				config.value("MysqlTribesTable", "TribePermissions"),
+				config.value("MysqlChangesTable", "PermissionChanges"),
+				config.value("NormalizedSchema", false),
+				config.value("MysqlPlayerGroupsTable", "PlayerGroups"),
+				config.value("MysqlTribeGroupsTable", "TribeGroups"),
+				config.value("MysqlGroupPermissionsTable", "GroupPermissions"),
+				config.value("MysqlPoolSize", 3));
 		}
 		else
-			database = std::make_unique<SqlLite>(config.value("DbPathOverride", ""));
+			database = std::make_unique<SqlLite>(config.value("DbPathOverride", ""), config.value("NormalizedSchema", false));
 
-		database->Init();
+		// A snapshot from the last run serves checks right away, the database is read in the background to catch up
+		if (Snapshot::IntervalSecs > 0 && Snapshot::Load(*database, GetSnapshotPath()))
+		{
+			pool.push_task(
+				[]()
+				{
+					Snapshot::Reconcile(*database);
+				}
+			);
+		}
+		else
+		{
+			database->Init();
+			if (Snapshot::IntervalSecs > 0)
+			{
+				pool.push_task(
+					[]()
+					{
+						Snapshot::Save(*database, GetSnapshotPath());
+					}
+				);
+			}
+		}
 		lastDatabaseSyncTime = time(0);
+		lastFullDatabaseSyncTime = time(0);
+		lastSnapshotTime = time(0);
 
 		Hooks::Init();
+		// The plugin can be (re)loaded with players already online
+		Presence::Rebuild();
 
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.Add", &AddPlayerToGroupCmd);
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.Remove", &RemovePlayerFromGroupCmd);
@@ -982,6 +1334,8 @@ namespace Permissions
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.RemoveGroup", &RemoveGroupCmd);
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.Grant", &GroupGrantPermissionCmd);
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.Revoke", &GroupRevokePermissionCmd);
+		AsaApi::GetCommands().AddConsoleCommand("Permissions.AddParent", &AddGroupParentCmd);
+		AsaApi::GetCommands().AddConsoleCommand("Permissions.RemoveParent", &RemoveGroupParentCmd);
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.PlayerGroups", &PlayerGroupsCmd);
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.GroupPermissions", &GroupPermissionsCmd);
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.ListGroups", &ListGroupsCmd);
@@ -1000,6 +1354,8 @@ namespace Permissions
 		AsaApi::GetCommands().AddRconCommand("Permissions.RemoveGroup", &RemoveGroupRcon);
 		AsaApi::GetCommands().AddRconCommand("Permissions.Grant", &GroupGrantPermissionRcon);
 		AsaApi::GetCommands().AddRconCommand("Permissions.Revoke", &GroupRevokePermissionRcon);
+		AsaApi::GetCommands().AddRconCommand("Permissions.AddParent", &AddGroupParentRcon);
+		AsaApi::GetCommands().AddRconCommand("Permissions.RemoveParent", &RemoveGroupParentRcon);
 		AsaApi::GetCommands().AddRconCommand("Permissions.PlayerGroups", &PlayerGroupsRcon);
 		AsaApi::GetCommands().AddRconCommand("Permissions.GroupPermissions", &GroupPermissionsRcon);
 		AsaApi::GetCommands().AddRconCommand("Permissions.ListGroups", &ListGroupsRcon);
@@ -1012,13 +1368,58 @@ namespace Permissions
 
 		AsaApi::GetCommands().AddConsoleCommand("Permissions.Reload", &ReloadConfig);
 		AsaApi::GetCommands().AddRconCommand("Permissions.Reload", &ReloadConfigRcon);
+		AsaApi::GetCommands().AddConsoleCommand("Permissions.Stats", &StatsCmd);
+		AsaApi::GetCommands().AddRconCommand("Permissions.Stats", &StatsRcon);
+		AsaApi::GetCommands().AddConsoleCommand("Permissions.Export", &ExportCmd);
+		AsaApi::GetCommands().AddRconCommand("Permissions.Export", &ExportRcon);
+		AsaApi::GetCommands().AddConsoleCommand("Permissions.Import", &ImportCmd);
+		AsaApi::GetCommands().AddRconCommand("Permissions.Import", &ImportRcon);
 
 		AsaApi::GetCommands().AddChatCommand("/groups", &ShowMyGroupsChat);
 
 		AsaApi::GetCommands().AddOnTimerCallback("DatabaseSync", &DatabaseSync);
+		AsaApi::GetCommands().AddOnTimerCallback("ChangeCheck", &CheckForChanges);
+		AsaApi::GetCommands().AddOnTimerCallback("TimedGroupBoundaries", &ProcessTimedGroupBoundaries);
+		AsaApi::GetCommands().AddOnTimerCallback("PermissionCallbacks", &ProcessPermissionCallbacks);
+		AsaApi::GetCommands().AddOnTimerCallback("ResolvedPlayers", &SweepResolvedPlayers);
+		AsaApi::GetCommands().AddOnTimerCallback("PendingWrites", &ProcessPendingWrites);
+		AsaApi::GetCommands().AddOnTimerCallback("StatsLog", &LogStats);
+		AsaApi::GetCommands().AddOnTimerCallback("TimedGroupCompaction", &CompactTimedGroups);
+		// Group changes made during a tick reach the subscribers together once it ends
+		AsaApi::GetCommands().AddOnTickCallback("GroupChanges", [](float) { DispatchGroupChanges(); });
+		AsaApi::GetCommands().AddOnTickCallback("PlayerLoads", [](float) { ProcessPlayerLoads(); });
 
 		pool.sleep_duration = 20000; // "if not set, default is 1ms which is overkill and will increase cpu usage a lot" - @Lethal 2021
 	}
+
+	// Plugin unload and server shutdown, stores the changes the background writer still holds before the DLL goes away
+	void Unload()
+	{
+		for (const auto* timer : { "DatabaseSync", "ChangeCheck", "TimedGroupBoundaries", "PermissionCallbacks", "ResolvedPlayers",
+			"PendingWrites", "StatsLog", "TimedGroupCompaction" })
+			AsaApi::GetCommands().RemoveOnTimerCallback(timer);
+		AsaApi::GetCommands().RemoveOnTickCallback("GroupChanges");
+		AsaApi::GetCommands().RemoveOnTickCallback("PlayerLoads");
+
+		// Syncs, snapshots and player loads still running may queue writes of their own
+		pool.wait_for_tasks();
+		if (!database)
+			return;
+
+		// Lazy mode, changes waiting for their player's row are made now rather than dropped
+		if (database->HasPlayerLoads())
+			database->LoadRequestedPlayers();
+		database->RunDeferredChanges();
+
+		if (const auto error = database->FlushWrites())
+			Log::GetLog()->error("Pending permission changes could not be stored on unload: {}", *error);
+	}
+}
+
+// Called by AsaApi when the plugin is unloaded, with async writes the queue has to be stored first
+extern "C" __declspec(dllexport) void Plugin_Unload()
+{
+	Permissions::Unload();
 }
 
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved)
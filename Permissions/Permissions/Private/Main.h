@@ -6,8 +6,27 @@ namespace Permissions
 {
 	inline std::unique_ptr<IDatabase> database;
 
+	// What the presence map knows about an online player
+	struct OnlinePlayer
+	{
+		AShooterPlayerController* Controller;
+		uint64 PlayerId;
+		int TribeId;
+	};
+
 	std::string GetDbPath();
 	int GetTribeId(AShooterPlayerController* playerController);
 	FTribeData* GetTribeData(AShooterPlayerController* playerController);
 	TArray<FString> GetTribeDefaultGroups(FTribeData* tribeData);
+	// GetTribeDefaultGroups() as ids, for resolving checks
+	void AddTribeDefaultGroups(FTribeData* tribeData, GroupSet& groups);
+	void ProcessTimedGroupBoundaries();
+	void ProcessPermissionCallbacks();
+	void SweepResolvedPlayers();
+	void ProcessWriteFailures();
+	void DispatchGroupChanges();
+	// Lookup in the presence map kept by the hooks, false when the player isn't online
+	bool FindOnlinePlayer(const FString& eos_id, OnlinePlayer& player);
+	void GetOnlinePlayers(TArray<FString>& eos_ids, TArray<int>& tribe_ids);
+	std::vector<std::string> GetStats();
 }
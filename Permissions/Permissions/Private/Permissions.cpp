@@ -1,21 +1,79 @@
 #include "../Public/Permissions.h"
 
 #include "Main.h"
+#include "CallbackCache.h"
+#include "GroupChangeQueue.h"
+#include "Stats.h"
 
 struct PermissionCallback
 {
-	PermissionCallback(FString command, bool onlyCheckOnline, bool cacheBySteamId, bool cacheByTribe, std::function<TArray<FString>(const FString&, int*)> callback)
+	PermissionCallback(FString command, bool onlyCheckOnline, bool cacheBySteamId, bool cacheByTribe, int cacheTtlMs, std::function<TArray<FString>(const FString&, int*)> callback)
 		: command(std::move(command)),
 		cacheBySteamId(std::move(cacheBySteamId)),
 		cacheByTribe(std::move(cacheByTribe)),
 		onlyCheckOnline(std::move(onlyCheckOnline)),
-		callback(std::move(callback))
+		cacheTtlMs(cacheTtlMs),
+		callback(std::move(callback)),
+		stats(Permissions::Stats::Timer("Callback " + this->command.ToString()))
+	{
+	}
+
+	PermissionCallback(FString command, int cacheTtlMs, std::function<TArray<TArray<FString>>(const TArray<FString>&, const TArray<int>&)> bulkCallback)
+		: command(std::move(command)),
+		cacheBySteamId(true),
+		cacheByTribe(false),
+		onlyCheckOnline(true),
+		cacheTtlMs(cacheTtlMs),
+		bulkCallback(std::move(bulkCallback)),
+		stats(Permissions::Stats::Timer("Callback " + this->command.ToString()))
 	{
 	}
 
 	FString command;
 	bool cacheBySteamId, cacheByTribe, onlyCheckOnline;
+	int cacheTtlMs;
 	std::function<TArray<FString>(const FString&, int*)> callback;
+	// Answers for many players in one call, results in the same order as the eos ids
+	std::function<TArray<TArray<FString>>(const TArray<FString>&, const TArray<int>&)> bulkCallback;
+	std::chrono::steady_clock::time_point lastBulkRefresh;
+	CallbackResultCache results;
+	// Calls into the owning plugin, shows which callbacks slow permission checks down
+	Permissions::Stats::Metric& stats;
+
+	bool isCached() const
+	{
+		return (cacheBySteamId || cacheByTribe) && cacheTtlMs > 0;
+	}
+
+	TArray<FString> invoke(const FString& eos_id, int tribeId)
+	{
+		Permissions::Stats::ScopedTimer timer(stats);
+		if (callback)
+			return callback(eos_id, &tribeId);
+
+		auto answers = bulkCallback(TArray<FString>{ eos_id }, TArray<int>{ tribeId });
+		return answers.Num() > 0 ? answers[0] : TArray<FString>();
+	}
+
+	// Empty answers are cached too, most players usually get nothing from a callback
+	void store(const FString& eos_id, int tribeId, const TArray<FString>& groups, std::chrono::steady_clock::time_point now)
+	{
+		const auto expiresAt = now + std::chrono::milliseconds(cacheTtlMs);
+		if (cacheBySteamId)
+			results.storePlayer(eos_id, groups, expiresAt);
+		else if (cacheByTribe && tribeId > 0)
+			results.storeTribe(tribeId, groups, expiresAt);
+	}
+
+	// Adds the cached answer to groups and names, see AddCallbackGroup
+	bool find(const FString& eos_id, int tribeId, std::chrono::steady_clock::time_point now, GroupSet& groups, TArray<FString>& names)
+	{
+		if (cacheBySteamId)
+			return results.findPlayer(eos_id, now, groups, names);
+		if (cacheByTribe && tribeId > 0)
+			return results.findTribe(tribeId, now, groups, names);
+		return false;
+	}
 };
 
 struct PermissionGroupUpdatedCallback
@@ -42,6 +100,30 @@ struct PermissionGroupUpdatedDetailedCallback
 	std::function<void(const FString&, int, const FString&, bool, bool, bool)> callback;
 };
 
+struct PermissionGroupsChangedCallback
+{
+	PermissionGroupsChangedCallback(FString CallbackName, std::function<void(const TArray<Permissions::GroupChange>&)> callback)
+		: SubscriberUID(std::move(CallbackName)),
+		callback(std::move(callback))
+	{
+	}
+
+	FString SubscriberUID;
+	std::function<void(const TArray<Permissions::GroupChange>&)> callback;
+};
+
+struct PermissionWriteFailedCallback
+{
+	PermissionWriteFailedCallback(FString CallbackName, std::function<void(const FString&, int, const FString&, const std::string&)> callback)
+		: SubscriberUID(std::move(CallbackName)),
+		callback(std::move(callback))
+	{
+	}
+
+	FString SubscriberUID;
+	std::function<void(const FString&, int, const FString&, const std::string&)> callback;
+};
+
 namespace Permissions
 {
 #pragma region Subscribers
@@ -80,7 +162,8 @@ namespace Permissions
 	/// <param name="tribeid"></param>
 	void NotifySubscribers(const FString& eos_id, int tribeid)
 	{
-		for (const auto& subscriber : permissionGroupUpdatedSubscribers)
+		const auto subscribers = permissionGroupUpdatedSubscribers;
+		for (const auto& subscriber : subscribers)
 		{
 			subscriber->callback(eos_id, tribeid);
 		}
@@ -122,17 +205,180 @@ namespace Permissions
 	/// <param name="bIsTribeGroup"></param>
 	void NotifySubscribersDetailed(const FString& eosId, int tribeId, const FString& groupChanged, bool bAddedGroup, bool bIsTimedGroup, bool bIsTribeGroup)
 	{
-		for (const auto& subscriber : permissionGroupUpdatedDetailedSubscribers)
+		const auto subscribers = permissionGroupUpdatedDetailedSubscribers;
+		for (const auto& subscriber : subscribers)
 		{
 			subscriber->callback(eosId, tribeId, groupChanged, bAddedGroup, bIsTimedGroup, bIsTribeGroup);
 		}
 	}
 
+	std::vector<std::shared_ptr<PermissionGroupsChangedCallback>> permissionGroupsChangedSubscribers;
+	GroupChangeQueue groupChanges;
+
+	/// <summary>
+	/// Subscribes to every group change of a tick in one call, delivered at the end of the tick
+	/// </summary>
+	/// <param name="CallbackName"></param>
+	/// <param name="callback"></param>
+	void SubscribePermissionGroupsChangedCallback(FString CallbackName, const std::function<void(const TArray<GroupChange>&)>& callback)
+	{
+		permissionGroupsChangedSubscribers.push_back(std::make_shared<PermissionGroupsChangedCallback>(CallbackName, callback));
+	}
+
+	void UnSubscribePermissionGroupsChangedCallback(FString CallbackName)
+	{
+		auto iter = std::find_if(permissionGroupsChangedSubscribers.begin(), permissionGroupsChangedSubscribers.end(),
+			[&CallbackName](const std::shared_ptr<PermissionGroupsChangedCallback>& data) -> bool {return data->SubscriberUID == CallbackName; });
+
+		if (iter != permissionGroupsChangedSubscribers.end())
+			permissionGroupsChangedSubscribers.erase(std::remove(permissionGroupsChangedSubscribers.begin(), permissionGroupsChangedSubscribers.end(), *iter), permissionGroupsChangedSubscribers.end());
+	}
+
+	/// <summary>
+	/// Queues a change for the end of the tick, only successful changes are queued
+	/// </summary>
+	void QueueGroupChange(const FString& eosId, int tribeId, const FString& groupChanged, bool bAddedGroup, bool bIsTimedGroup, bool bIsTribeGroup)
+	{
+		groupChanges.push(GroupChange{ eosId, tribeId, groupChanged, bAddedGroup, bIsTimedGroup, bIsTribeGroup });
+	}
+
+	/// <summary>
+	/// Hands the changes queued during this tick to the subscribers, runs on the game thread at the end of every tick.
+	/// Batch subscribers get them all at once, PermissionGroupUpdatedCallback hears about each player or tribe once.
+	/// </summary>
+	void DispatchGroupChanges()
+	{
+		const auto changes = groupChanges.take();
+		if (changes.empty())
+			return;
+
+		static auto& stat = Stats::Timer("DispatchGroupChanges");
+		Stats::ScopedTimer timer(stat);
+
+		// Subscribers may unsubscribe from inside their callback
+		const auto batchSubscribers = permissionGroupsChangedSubscribers;
+		if (!batchSubscribers.empty())
+		{
+			TArray<GroupChange> batch;
+			batch.Reserve(static_cast<int32>(changes.size()));
+			for (const auto& change : changes)
+				batch.Add(change);
+
+			for (const auto& subscriber : batchSubscribers)
+				subscriber->callback(batch);
+		}
+
+		if (!permissionGroupUpdatedSubscribers.empty())
+		{
+			std::unordered_set<FString, FStringHash, FStringEqual> players;
+			std::unordered_set<int> tribes;
+			for (const auto& change : changes)
+			{
+				const bool first = change.EosId.IsEmpty() ? tribes.insert(change.TribeId).second : players.insert(change.EosId).second;
+				if (first)
+					NotifySubscribers(change.EosId, change.TribeId);
+			}
+		}
+
+		for (const auto& change : changes)
+			NotifySubscribersDetailed(change.EosId, change.TribeId, change.Group, change.bAddedGroup, change.bIsTimedGroup, change.bIsTribeGroup);
+	}
+
+	std::vector<std::shared_ptr<PermissionWriteFailedCallback>> permissionWriteFailedSubscribers;
+
+	/// <summary>
+	/// Subscribes to writes the background writer gave up on. The callback gets the eos id, tribe id or group of the
+	/// row (whichever it was) and the error, the row is reloaded from the database with the next sync.
+	/// </summary>
+	/// <param name="CallbackName"></param>
+	/// <param name="callback"></param>
+	void SubscribePermissionWriteFailedCallback(FString CallbackName, const std::function<void(const FString&, int, const FString&, const std::string&)>& callback)
+	{
+		permissionWriteFailedSubscribers.push_back(std::make_shared<PermissionWriteFailedCallback>(CallbackName, callback));
+	}
+
+	void UnSubscribePermissionWriteFailedCallback(FString CallbackName)
+	{
+		auto iter = std::find_if(permissionWriteFailedSubscribers.begin(), permissionWriteFailedSubscribers.end(),
+			[&CallbackName](const std::shared_ptr<PermissionWriteFailedCallback>& data) -> bool {return data->SubscriberUID == CallbackName; });
+
+		if (iter != permissionWriteFailedSubscribers.end())
+			permissionWriteFailedSubscribers.erase(std::remove(permissionWriteFailedSubscribers.begin(), permissionWriteFailedSubscribers.end(), *iter), permissionWriteFailedSubscribers.end());
+	}
+
+	/// <summary>
+	/// Reports writes the background writer gave up on, runs on the game thread
+	/// </summary>
+	void ProcessWriteFailures()
+	{
+		if (!database)
+			return;
+
+		for (const auto& failure : database->TakeWriteFailures())
+		{
+			const FString key(failure.Key.c_str());
+			Log::GetLog()->error("Gave up writing {} after {} attempts: {}", failure.Key, Writes::MaxAttempts, failure.Error);
+
+			FString eos_id, group;
+			int tribeId = 0;
+			switch (static_cast<ChangeKind>(failure.Kind))
+			{
+			case ChangeKind::Player:
+				eos_id = key;
+				break;
+			case ChangeKind::Tribe:
+				tribeId = std::stoi(failure.Key);
+				break;
+			case ChangeKind::Group:
+				group = key;
+				break;
+			}
+
+			// A callback may unsubscribe
+			const auto subscribers = permissionWriteFailedSubscribers;
+			for (const auto& subscriber : subscribers)
+				subscriber->callback(eos_id, tribeId, group, failure.Error);
+		}
+	}
+
+	std::optional<std::string> FlushPendingWrites()
+	{
+		return database->FlushWrites();
+	}
+
+	/// <summary>
+	/// Queues timed groups that activated or expired since the last tick for the subscribers
+	/// </summary>
+	void ProcessTimedGroupBoundaries()
+	{
+		if (!database)
+			return;
+
+		const auto events = database->PopDueTimedGroups(std::time(nullptr));
+		if (events.empty())
+			return;
+
+		Cache::Invalidate();
+
+		for (const auto& event : events)
+		{
+			QueueGroupChange(event.EosId, event.TribeId, event.GroupName, event.Activated, true, event.EosId.IsEmpty());
+		}
+	}
+
 #pragma endregion Subscribers
 
 	std::vector<std::shared_ptr<PermissionCallback>> playerPermissionCallbacks;
 	void AddPlayerPermissionCallback(FString CallbackName, bool onlyCheckOnline, bool cacheBySteamId, bool cacheByTribe, const std::function<TArray<FString>(const FString&, int*)>& callback) {
-		playerPermissionCallbacks.push_back(std::make_shared<PermissionCallback>(CallbackName, onlyCheckOnline, cacheBySteamId, cacheByTribe, callback));
+		AddPlayerPermissionCallback(CallbackName, onlyCheckOnline, cacheBySteamId, cacheByTribe, Cache::CallbackCacheMs, callback);
+	}
+	void AddPlayerPermissionCallback(FString CallbackName, bool onlyCheckOnline, bool cacheBySteamId, bool cacheByTribe, int cacheTtlMs, const std::function<TArray<FString>(const FString&, int*)>& callback) {
+		playerPermissionCallbacks.push_back(std::make_shared<PermissionCallback>(CallbackName, onlyCheckOnline, cacheBySteamId, cacheByTribe, cacheTtlMs, callback));
+		Cache::Invalidate();
+	}
+	void AddPlayerPermissionBulkCallback(FString CallbackName, int cacheTtlMs, const std::function<TArray<TArray<FString>>(const TArray<FString>&, const TArray<int>&)>& callback) {
+		playerPermissionCallbacks.push_back(std::make_shared<PermissionCallback>(CallbackName, cacheTtlMs, callback));
+		Cache::Invalidate();
 	}
 	void RemovePlayerPermissionCallback(FString CallbackName) {
 		auto iter = std::find_if(playerPermissionCallbacks.begin(), playerPermissionCallbacks.end(),
@@ -141,111 +387,213 @@ namespace Permissions
 		if (iter != playerPermissionCallbacks.end())
 		{
 			playerPermissionCallbacks.erase(std::remove(playerPermissionCallbacks.begin(), playerPermissionCallbacks.end(), *iter), playerPermissionCallbacks.end());
+			Cache::Invalidate();
 		}
 	}
-	TArray<FString> GetCallbackGroups(const FString& eos_id, int tribeId, bool isOnline) {
-		TArray<FString> groups;
-		for (const auto& permissionCallback : playerPermissionCallbacks)
+
+	std::shared_ptr<PermissionCallback> FindPermissionCallback(const FString& CallbackName)
+	{
+		auto iter = std::find_if(playerPermissionCallbacks.begin(), playerPermissionCallbacks.end(),
+			[&CallbackName](const std::shared_ptr<PermissionCallback>& data) -> bool {return data->command == CallbackName; });
+		return iter != playerPermissionCallbacks.end() ? *iter : nullptr;
+	}
+
+	void InvalidatePlayerPermissionCallback(FString CallbackName)
+	{
+		if (auto permissionCallback = FindPermissionCallback(CallbackName))
 		{
-			bool cache = false;
-			if (permissionCallback->onlyCheckOnline) continue;
-			if (permissionCallback->cacheBySteamId && database->IsPlayerExists(eos_id))
-			{
-				CachedPermission permissions = database->HydratePlayerGroups(eos_id);
+			permissionCallback->results.clear();
+			Cache::Invalidate();
+		}
+	}
 
-				if (permissions.hasCheckedCallbacks)
-				{
-					for (auto group : permissions.CallbackGroups)
-					{
-						if (!groups.Contains(group))
-							groups.Add(group);
-					}
-					continue;
-				}
-				cache = true;
-			}
-			if (permissionCallback->cacheByTribe && database->IsTribeExists(tribeId))
-			{
-				CachedPermission permissions = database->HydrateTribeGroups(tribeId);
+	void InvalidatePlayerPermissionCallback(FString CallbackName, const FString& eos_id, int tribeId)
+	{
+		if (auto permissionCallback = FindPermissionCallback(CallbackName))
+		{
+			permissionCallback->results.invalidatePlayer(eos_id);
+			if (tribeId > 0)
+				permissionCallback->results.invalidateTribe(tribeId);
+			Cache::Invalidate();
+		}
+	}
 
-				if (permissions.hasCheckedCallbacks)
-				{
-					for (auto group : permissions.CallbackGroups)
-					{
-						if (!groups.Contains(group))
-							groups.Add(group);
-					}
-					continue;
-				}
-				cache = true;
+	void RefreshPermissionCallback(PermissionCallback& permissionCallback, const TArray<FString>& eos_ids, const TArray<int>& tribe_ids, std::chrono::steady_clock::time_point now)
+	{
+		if (permissionCallback.bulkCallback)
+		{
+			TArray<TArray<FString>> answers;
+			{
+				Permissions::Stats::ScopedTimer timer(permissionCallback.stats);
+				answers = permissionCallback.bulkCallback(eos_ids, tribe_ids);
 			}
-			auto callbackGroups = permissionCallback->callback(eos_id, &tribeId);
-			if (cache && callbackGroups.Num() > 0)
+			for (int32 i = 0; i < eos_ids.Num() && i < answers.Num(); ++i)
+				permissionCallback.store(eos_ids[i], tribe_ids[i], answers[i], now);
+		}
+		else
+		{
+			for (int32 i = 0; i < eos_ids.Num(); ++i)
+				permissionCallback.store(eos_ids[i], tribe_ids[i], permissionCallback.invoke(eos_ids[i], tribe_ids[i]), now);
+		}
+		permissionCallback.lastBulkRefresh = now;
+	}
+
+	void RefreshPlayerPermissionCallbacks()
+	{
+		TArray<FString> eos_ids;
+		TArray<int> tribe_ids;
+		GetOnlinePlayers(eos_ids, tribe_ids);
+
+		const auto now = std::chrono::steady_clock::now();
+		for (const auto& permissionCallback : playerPermissionCallbacks)
+		{
+			if (permissionCallback->isCached())
+				RefreshPermissionCallback(*permissionCallback, eos_ids, tribe_ids, now);
+		}
+		Cache::Invalidate();
+	}
+
+	// Timer: bulk callbacks are refreshed for everyone online once their TTL runs out, the others only get pruned
+	void ProcessPermissionCallbacks()
+	{
+		const auto now = std::chrono::steady_clock::now();
+		TArray<FString> eos_ids;
+		TArray<int> tribe_ids;
+		bool collected = false, refreshed = false;
+
+		for (const auto& permissionCallback : playerPermissionCallbacks)
+		{
+			if (!permissionCallback->isCached()
+				|| now - permissionCallback->lastBulkRefresh < std::chrono::milliseconds(permissionCallback->cacheTtlMs))
+				continue;
+
+			if (permissionCallback->bulkCallback)
 			{
-				if (permissionCallback->cacheBySteamId && database->IsPlayerExists(eos_id))
+				if (!collected)
 				{
-					database->UpdatePlayerGroupCallbacks(eos_id, callbackGroups);
-				}
-				if (permissionCallback->cacheByTribe && database->IsTribeExists(tribeId))
-				{
-					database->UpdateTribeGroupCallbacks(tribeId, callbackGroups);
+					GetOnlinePlayers(eos_ids, tribe_ids);
+					collected = true;
 				}
+				RefreshPermissionCallback(*permissionCallback, eos_ids, tribe_ids, now);
+				refreshed = true;
 			}
-			for (auto group : callbackGroups)
+			else
 			{
-				if (!groups.Contains(group))
-					groups.Add(group);
+				permissionCallback->results.prune(now);
+				permissionCallback->lastBulkRefresh = now;
 			}
 		}
-		return groups;
+
+		if (refreshed)
+			Cache::Invalidate();
+	}
+
+	// Adds the groups the permission callbacks hand the player to groups and names, cached answers are added without copying
+	void AddCallbackGroups(const FString& eos_id, int tribeId, bool isOnline, GroupSet& groups, TArray<FString>& names) {
+		const auto now = std::chrono::steady_clock::now();
+		for (const auto& permissionCallback : playerPermissionCallbacks)
+		{
+			if (permissionCallback->onlyCheckOnline && !isOnline) continue;
+
+			const bool cache = permissionCallback->isCached();
+			if (cache && permissionCallback->find(eos_id, tribeId, now, groups, names))
+				continue;
+
+			const TArray<FString> callbackGroups = permissionCallback->invoke(eos_id, tribeId);
+			if (cache)
+				permissionCallback->store(eos_id, tribeId, callbackGroups, now);
+			for (const auto& group : callbackGroups)
+				AddCallbackGroup(group, groups, names);
+		}
 	}
 	
-	TArray<FString> GetPlayerGroups(const FString& eos_id)
+	ResolvedPlayerCache resolvedPlayers(4096);
+
+	// Adds every group the player holds to resolved, its buffers are reused from one miss to the next
+	void ResolvePlayerGroups(const FString& eos_id, long long nowSecs, ResolvedPlayer& resolved)
 	{
-		auto world = AsaApi::GetApiUtils().GetWorld();
-		TArray<FString> groups = database->GetPlayerGroups(eos_id);
-		auto shooter_pc = AsaApi::GetApiUtils().FindPlayerFromEOSID(eos_id);
+		static auto& stat = Stats::Timer("Resolve (cache miss)");
+		Stats::ScopedTimer timer(stat);
+		GroupSet& groups = resolved.Groups;
+		long long& validUntil = resolved.ValidUntil;
+		database->AddPlayerGroupIds(eos_id, nowSecs, groups);
+		validUntil = database->GetNextTimedBoundary(eos_id, nowSecs);
+		OnlinePlayer online;
 		int tribeId = -1;
 		bool isOnline = false;
-		if (shooter_pc) {
-			auto tribeData = GetTribeData(shooter_pc);
+		if (FindOnlinePlayer(eos_id, online)) {
+			auto tribeData = GetTribeData(online.Controller);
 			isOnline = true;
 			if (tribeData) {
-				tribeId = tribeData->TribeIDField();
-				auto tribeGroups = GetTribeGroups(tribeId);
-				for (auto tribeGroup : tribeGroups)
-				{
-					if (!groups.Contains(tribeGroup)) 
-					{
-						groups.Add(tribeGroup);
-					}
-				}
-				auto defaultTribeGroups = GetTribeDefaultGroups(tribeData);
-				for (auto tribeGroup : defaultTribeGroups) 
-				{
-					if (!groups.Contains(tribeGroup)) 
-					{
-						groups.Add(tribeGroup);
-					}
-				}
+				tribeId = online.TribeId;
+				const long long tribeBoundary = database->GetTribeNextTimedBoundary(tribeId, nowSecs);
+				if (tribeBoundary > 0 && (validUntil == 0 || tribeBoundary < validUntil))
+					validUntil = tribeBoundary;
+				database->AddTribeGroupIds(tribeId, nowSecs, groups);
+				AddTribeDefaultGroups(tribeData, groups);
 			}
 		}
-		auto callbackGroups = GetCallbackGroups(eos_id, tribeId, isOnline);
-		for (auto group : callbackGroups)
-		{
-			if (!groups.Contains(group))
-				groups.Add(group);
-		}
-		return groups;
+		AddCallbackGroups(eos_id, tribeId, isOnline, groups, resolved.CallbackNames);
+	}
+
+	/// <summary>
+	/// Runs fn against the player's resolved groups, resolving them first if the cached entry is stale.
+	/// Entries are dropped on a generation bump, at the next timed-group boundary or after ResolvedCacheMs.
+	/// </summary>
+	template <typename Fn>
+	auto WithResolvedPlayer(const FString& eos_id, Fn&& fn)
+	{
+		const auto generation = Cache::CurrentGeneration();
+		const auto now = std::chrono::steady_clock::now();
+		const long long nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+		auto cached = resolvedPlayers.find(eos_id);
+		if (cached && cached->isValid(generation, nowSecs, now))
+			return fn(*cached);
+
+		// Callbacks may call back into Permissions, so nothing is held while resolving
+		Scratch<ResolvedPlayer> resolved;
+		resolved->Generation = generation;
+		resolved->ExpiresAt = now + std::chrono::milliseconds(Cache::ResolvedCacheMs);
+		resolved->Groups.Reset();
+		resolved->CallbackNames.Reset();
+		ResolvePlayerGroups(eos_id, nowSecs, *resolved);
+
+		if (Cache::ResolvedCacheMs <= 0)
+			return fn(*resolved);
+
+		auto result = fn(*resolved);
+		resolvedPlayers.store(eos_id, *resolved);
+		return result;
+	}
+
+	// Timer: drops resolved players gone stale, a miss only evicts once the cache is full
+	void SweepResolvedPlayers()
+	{
+		static auto& stat = Stats::Timer("SweepResolvedPlayers");
+		Stats::ScopedTimer timer(stat);
+		const long long nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		resolvedPlayers.sweep(Cache::CurrentGeneration(), nowSecs, std::chrono::steady_clock::now());
+	}
+
+	TArray<FString> GetPlayerGroups(const FString& eos_id)
+	{
+		static auto& stat = Stats::Timer("GetPlayerGroups");
+		Stats::ScopedTimer timer(stat);
+		return WithResolvedPlayer(eos_id, [](const ResolvedPlayer& resolved) { return resolved.ToArray(); });
 	}
 
 	TArray<FString> GetTribeGroups(int tribeId)
 	{
+		static auto& stat = Stats::Timer("GetTribeGroups");
+		Stats::ScopedTimer timer(stat);
 		return database->GetTribeGroups(tribeId);
 	}
 	
 	TArray<FString> GetGroupPermissions(const FString& group)
 	{
+		static auto& stat = Stats::Timer("GetGroupPermissions");
+		Stats::ScopedTimer timer(stat);
 		if (group.IsEmpty())
 			return {};
 		return database->GetGroupPermissions(group);
@@ -253,158 +601,325 @@ namespace Permissions
 
 	TArray<FString> GetAllGroups()
 	{
+		static auto& stat = Stats::Timer("GetAllGroups");
+		Stats::ScopedTimer timer(stat);
 		return database->GetAllGroups();
 	}
 
 	TArray<FString> GetGroupMembers(const FString& group)
 	{
-		return database->GetGroupMembers(group);
-	}
-
-	bool IsPlayerInGroup(const FString& eos_id, const FString& group)
-	{
-		TArray<FString> groups = GetPlayerGroups(eos_id);
+		static auto& stat = Stats::Timer("GetGroupMembers");
+		Stats::ScopedTimer timer(stat);
+		TArray<FString> members = database->GetGroupMembers(group);
+
+		// Groups from tribes and permission callbacks are only known for players online
+		TArray<FString> eos_ids;
+		TArray<int> tribe_ids;
+		GetOnlinePlayers(eos_ids, tribe_ids);
+
+		// One pass over the stored members drops the online players already listed
+		std::unordered_set<FString, FStringHash, FStringEqual> online;
+		online.reserve(eos_ids.Num());
+		for (const auto& eos_id : eos_ids)
+			online.insert(eos_id);
+		for (const auto& eos_id : members)
+		{
+			if (online.empty())
+				break;
+			online.erase(eos_id);
+		}
 
-		for (const auto& current_group : groups)
+		for (const auto& eos_id : eos_ids)
 		{
-			if (current_group == group)
-				return true;
+			if (online.erase(eos_id) == 0 || !database->IsPlayerLoaded(eos_id))
+				continue;
+
+			const bool isMember = WithResolvedPlayer(eos_id, [&group](const ResolvedPlayer& resolved) {
+				return resolved.hasGroup(group);
+			});
+			if (isMember)
+				members.Add(eos_id);
 		}
+		return members;
+	}
 
-		return false;
+	bool IsPlayerInGroup(const FString& eos_id, const FString& group)
+	{
+		static auto& stat = Stats::Timer("IsPlayerInGroup");
+		Stats::ScopedTimer timer(stat);
+		return WithResolvedPlayer(eos_id, [&group](const ResolvedPlayer& resolved) {
+			return resolved.hasGroup(group);
+		});
 	}
 	
 	bool IsTribeInGroup(int tribeId, const FString& group)
 	{
-		TArray<FString> groups = GetTribeGroups(tribeId);
+		static auto& stat = Stats::Timer("IsTribeInGroup");
+		Stats::ScopedTimer timer(stat);
+		const long long nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		Scratch<GroupSet> groups;
+		groups->Reset();
+		database->AddTribeGroupIds(tribeId, nowSecs, *groups);
+		return groups->Contains(group);
+	}
 
-		for (const auto& current_group : groups)
-		{
-			if (current_group == group)
-				return true;
-		}
+	/// <summary>
+	/// Lazy mode, a change to a player that isn't loaded waits for the background load and is made on the game thread
+	/// once the row is in, so the caller never waits on the database. The group is checked up front, what can only be
+	/// checked against the player's row fails later and is reported to the write failed subscribers.
+	/// </summary>
+	template <typename Fn>
+	bool DeferPlayerChange(const FString& eos_id, const FString& group, Fn&& change)
+	{
+		return database->DeferPlayerChange(eos_id, [eos_id, group, change = std::forward<Fn>(change)]()
+			{
+				const auto error = change();
+				if (!error)
+					return;
 
-		return false;
+				Log::GetLog()->warn("Deferred change to player {} failed: {}", eos_id.ToString(), *error);
+				const auto subscribers = permissionWriteFailedSubscribers;
+				for (const auto& subscriber : subscribers)
+					subscriber->callback(eos_id, 0, group, *error);
+			});
 	}
 
 	std::optional<std::string> AddPlayerToGroup(const FString& eos_id, const FString& group)
 	{
+		if (!database->IsPlayerKnown(eos_id) && !database->IsGroupExists(group))
+			return "Group does not exist";
+		if (DeferPlayerChange(eos_id, group, [eos_id, group]() { return AddPlayerToGroup(eos_id, group); }))
+			return {};
+
+		static auto& stat = Stats::Timer("AddPlayerToGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->AddPlayerToGroup(eos_id, group);
-		NotifySubscribers(eos_id, 0);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(eos_id, 0, group, true, false, false);
+			QueueGroupChange(eos_id, 0, group, true, false, false);
 		return returnvalue;
 	}
 
 	std::optional<std::string> RemovePlayerFromGroup(const FString& eos_id, const FString& group)
 	{
+		if (!database->IsPlayerKnown(eos_id) && !database->IsGroupExists(group))
+			return "Player or group does not exist";
+		if (DeferPlayerChange(eos_id, group, [eos_id, group]() { return RemovePlayerFromGroup(eos_id, group); }))
+			return {};
+
+		static auto& stat = Stats::Timer("RemovePlayerFromGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->RemovePlayerFromGroup(eos_id, group);
-		NotifySubscribers(eos_id, 0);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(eos_id, 0, group, false, false, false);
+			QueueGroupChange(eos_id, 0, group, false, false, false);
 		return returnvalue;
 	}
 
 	std::optional<std::string> AddPlayerToTimedGroup(const FString& eos_id, const FString& group, int secs, int delaySecs)
 	{
+		if (!database->IsPlayerKnown(eos_id) && !database->IsGroupExists(group))
+			return "Group does not exist";
+		if (DeferPlayerChange(eos_id, group, [eos_id, group, secs, delaySecs]() { return AddPlayerToTimedGroup(eos_id, group, secs, delaySecs); }))
+			return {};
+
+		static auto& stat = Stats::Timer("AddPlayerToTimedGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->AddPlayerToTimedGroup(eos_id, group, secs, delaySecs);
-		NotifySubscribers(eos_id, 0);
-		if(!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(eos_id, 0, group, true, true, false);
+		if (!returnvalue.has_value()) // no error occured
+			QueueGroupChange(eos_id, 0, group, true, true, false);
 		return returnvalue;
 	}
 
 	std::optional<std::string> RemovePlayerFromTimedGroup(const FString& eos_id, const FString& group)
 	{
+		if (!database->IsPlayerKnown(eos_id) && !database->IsGroupExists(group))
+			return "Player or group does not exist";
+		if (DeferPlayerChange(eos_id, group, [eos_id, group]() { return RemovePlayerFromTimedGroup(eos_id, group); }))
+			return {};
+
+		static auto& stat = Stats::Timer("RemovePlayerFromTimedGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->RemovePlayerFromTimedGroup(eos_id, group);
-		NotifySubscribers(eos_id, 0);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(eos_id, 0, group, false, true, false);
+			QueueGroupChange(eos_id, 0, group, false, true, false);
 		return returnvalue;
 	}
 
 	std::optional<std::string> AddTribeToGroup(int tribeId, const FString& group)
 	{
+		static auto& stat = Stats::Timer("AddTribeToGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->AddTribeToGroup(tribeId, group);
-		NotifySubscribers(L"", tribeId);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(L"", tribeId, group, true, false, true);
+			QueueGroupChange(L"", tribeId, group, true, false, true);
 		return returnvalue;
 	}
 
 	std::optional<std::string> RemoveTribeFromGroup(int tribeId, const FString& group)
 	{
+		static auto& stat = Stats::Timer("RemoveTribeFromGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->RemoveTribeFromGroup(tribeId, group);
-		NotifySubscribers(L"", tribeId);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(L"", tribeId, group, false, false, true);
+			QueueGroupChange(L"", tribeId, group, false, false, true);
 		return returnvalue;
 	}
 
 	std::optional<std::string> AddTribeToTimedGroup(int tribeId, const FString& group, int secs, int delaySecs)
 	{
+		static auto& stat = Stats::Timer("AddTribeToTimedGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->AddTribeToTimedGroup(tribeId, group, secs, delaySecs);
-		NotifySubscribers(L"", tribeId);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(L"", tribeId, group, true, true, true);
+			QueueGroupChange(L"", tribeId, group, true, true, true);
 		return returnvalue;
 	}
 
 	std::optional<std::string> RemoveTribeFromTimedGroup(int tribeId, const FString& group)
 	{
+		static auto& stat = Stats::Timer("RemoveTribeFromTimedGroup");
+		Stats::ScopedTimer timer(stat);
 		auto returnvalue = database->RemoveTribeFromTimedGroup(tribeId, group);
-		NotifySubscribers(L"", tribeId);
 		if (!returnvalue.has_value()) // no error occured
-			NotifySubscribersDetailed(L"", tribeId, group, false, true, true);
+			QueueGroupChange(L"", tribeId, group, false, true, true);
 		return returnvalue;
 	}
 	
 	std::optional<std::string> AddGroup(const FString& group)
 	{
+		static auto& stat = Stats::Timer("AddGroup");
+		Stats::ScopedTimer timer(stat);
 		return database->AddGroup(group);
 	}
 
 	std::optional<std::string> RemoveGroup(const FString& group)
 	{
+		static auto& stat = Stats::Timer("RemoveGroup");
+		Stats::ScopedTimer timer(stat);
 		return database->RemoveGroup(group);
 	}
 
 	bool IsGroupHasPermission(const FString& group, const FString& permission)
 	{
-		if (!database->IsGroupExists(group))
+		static auto& stat = Stats::Timer("IsGroupHasPermission");
+		Stats::ScopedTimer timer(stat);
+		return database->IsGroupHasPermission(group, permission, false);
+	}
+
+	bool IsPlayerHasPermission(const FString& eos_id, const FString& permission)
+	{
+		static auto& stat = Stats::Timer("IsPlayerHasPermission");
+		Stats::ScopedTimer timer(stat);
+		return WithResolvedPlayer(eos_id, [&permission](const ResolvedPlayer& resolved) {
+			for (const auto group : resolved.Groups.Ids())
+			{
+				auto cachedGroup = database->FindGroup(group);
+				if (cachedGroup && cachedGroup->hasPermission(permission, true))
+					return true;
+			}
+
 			return false;
+		});
+	}
 
-		TArray<FString> permissions = GetGroupPermissions(group);
+	uint64 IsPlayerInGroups(const FString& eos_id, const TArray<FString>& groups)
+	{
+		static auto& stat = Stats::Timer("IsPlayerInGroups");
+		Stats::ScopedTimer timer(stat);
+		return WithResolvedPlayer(eos_id, [&groups](const ResolvedPlayer& resolved) {
+			uint64 mask = 0;
+			for (int32 i = 0; i < groups.Num() && i < 64; ++i)
+			{
+				if (resolved.hasGroup(groups[i]))
+					mask |= 1ull << i;
+			}
+			return mask;
+		});
+	}
 
-		for (const auto& current_perm : permissions)
+	// Groups are looked up once per call instead of once per permission
+	uint64 GetPermissionMask(const ResolvedPlayer& resolved, const TArray<FString>& permissions)
+	{
+		Scratch<std::vector<std::shared_ptr<const CachedGroup>>> groups;
+		groups->clear();
+		for (const auto group : resolved.Groups.Ids())
 		{
-			if (current_perm == permission)
-				return true;
+			if (auto cachedGroup = database->FindGroup(group))
+				groups->push_back(std::move(cachedGroup));
 		}
 
-		return false;
+		uint64 mask = 0;
+		for (int32 i = 0; i < permissions.Num() && i < 64; ++i)
+		{
+			for (const auto& cachedGroup : *groups)
+			{
+				if (cachedGroup->hasPermission(permissions[i], true))
+				{
+					mask |= 1ull << i;
+					break;
+				}
+			}
+		}
+		// Doesn't keep removed groups alive until the next call
+		groups->clear();
+		return mask;
 	}
 
-	bool IsPlayerHasPermission(const FString& eos_id, const FString& permission)
+	uint64 IsPlayerHasPermissions(const FString& eos_id, const TArray<FString>& permissions)
 	{
-		TArray<FString> groups = GetPlayerGroups(eos_id);
+		static auto& stat = Stats::Timer("IsPlayerHasPermissions");
+		Stats::ScopedTimer timer(stat);
+		return WithResolvedPlayer(eos_id, [&permissions](const ResolvedPlayer& resolved) {
+			return GetPermissionMask(resolved, permissions);
+		});
+	}
 
-		for (const auto& current_group : groups)
+	TArray<FString> GetOnlinePlayersWithPermission(const FString& permission)
+	{
+		static auto& stat = Stats::Timer("GetOnlinePlayersWithPermission");
+		Stats::ScopedTimer timer(stat);
+		TArray<FString> eos_ids;
+		TArray<int> tribe_ids;
+		GetOnlinePlayers(eos_ids, tribe_ids);
+
+		// Most players share a handful of groups, each group is asked once
+		std::unordered_map<GroupId, bool> groupAnswers;
+		TArray<FString> result;
+		for (const auto& eos_id : eos_ids)
 		{
-			if (IsGroupHasPermission(current_group, permission) || IsGroupHasPermission(current_group, "*"))
-				return true;
-		}
+			const bool hasPermission = WithResolvedPlayer(eos_id, [&](const ResolvedPlayer& resolved) {
+				for (const auto group : resolved.Groups.Ids())
+				{
+					auto iter = groupAnswers.find(group);
+					if (iter == groupAnswers.end())
+					{
+						auto cachedGroup = database->FindGroup(group);
+						iter = groupAnswers.emplace(group, cachedGroup && cachedGroup->hasPermission(permission, true)).first;
+					}
+					if (iter->second)
+						return true;
+				}
+				return false;
+			});
 
-		return false;
+			if (hasPermission)
+				result.Add(eos_id);
+		}
+		return result;
 	}
 	
 		bool IsTribeHasPermission(int tribeId, const FString& permission)
 	{
-		TArray<FString> groups = GetTribeGroups(tribeId);
-
-		for (const auto& current_group : groups)
+		static auto& stat = Stats::Timer("IsTribeHasPermission");
+		Stats::ScopedTimer timer(stat);
+		const long long nowSecs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		Scratch<GroupSet> groups;
+		groups->Reset();
+		database->AddTribeGroupIds(tribeId, nowSecs, *groups);
+
+		for (const auto group : groups->Ids())
 		{
-			if (IsGroupHasPermission(current_group, permission) || IsGroupHasPermission(current_group, "*"))
+			auto cachedGroup = database->FindGroup(group);
+			if (cachedGroup && cachedGroup->hasPermission(permission, true))
 				return true;
 		}
 
@@ -413,11 +928,46 @@ namespace Permissions
 
 	std::optional<std::string> GroupGrantPermission(const FString& group, const FString& permission)
 	{
+		static auto& stat = Stats::Timer("GroupGrantPermission");
+		Stats::ScopedTimer timer(stat);
 		return database->GroupGrantPermission(group, permission);
 	}
 
 	std::optional<std::string> GroupRevokePermission(const FString& group, const FString& permission)
 	{
+		static auto& stat = Stats::Timer("GroupRevokePermission");
+		Stats::ScopedTimer timer(stat);
 		return database->GroupRevokePermission(group, permission);
 	}
-}
\ No newline at end of file
+
+	TArray<FString> GetGroupParents(const FString& group)
+	{
+		static auto& stat = Stats::Timer("GetGroupParents");
+		Stats::ScopedTimer timer(stat);
+		return database->GetGroupParents(group);
+	}
+
+	std::optional<std::string> AddGroupParent(const FString& group, const FString& parent)
+	{
+		static auto& stat = Stats::Timer("AddGroupParent");
+		Stats::ScopedTimer timer(stat);
+		return database->AddGroupParent(group, parent);
+	}
+
+	std::optional<std::string> RemoveGroupParent(const FString& group, const FString& parent)
+	{
+		static auto& stat = Stats::Timer("RemoveGroupParent");
+		Stats::ScopedTimer timer(stat);
+		return database->RemoveGroupParent(group, parent);
+	}
+
+	std::vector<std::string> GetStats()
+	{
+		std::vector<std::string> lines{ fmt::format("Cached: {} players, {} tribes, {} groups, {} resolved players, {} callbacks, {} pending writes",
+			database->GetCachedPlayers(), database->GetCachedTribes(), database->GetCachedGroups(), resolvedPlayers.size(),
+			playerPermissionCallbacks.size(), database->GetPendingWrites()) };
+		for (auto& line : Stats::Format())
+			lines.push_back(std::move(line));
+		return lines;
+	}
+}
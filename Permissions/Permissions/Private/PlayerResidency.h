@@ -0,0 +1,162 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../Public/Permissions.h"
+
+namespace Permissions::Players
+{
+	// Load player rows when they are first needed instead of all of them at startup, read once at startup
+	inline bool Lazy = false;
+	// Offline players kept loaded in lazy mode, online players don't count towards it
+	inline int OfflineCacheSize = 2000;
+}
+
+/// <summary>
+/// Which player rows are loaded in lazy mode. Online players are pinned, offline ones are kept in LRU order and the
+/// least recently used are evicted once there are more than OfflineCacheSize. Players looked up but not in the
+/// database are remembered too, so they don't cost a query on every lookup.
+/// </summary>
+class PlayerResidency {
+public:
+	// Marks the player as just used, present is whether the row exists
+	void touch(const FString& eos_id, bool present)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto& entry = Touch(eos_id);
+		entry.Present = present;
+	}
+
+	// Known not to be in the database
+	bool isAbsent(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto iter = entries.find(eos_id);
+		return iter != entries.end() && iter->second.Loaded && !iter->second.Present;
+	}
+
+	bool isOnline(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto iter = entries.find(eos_id);
+		return iter != entries.end() && iter->second.Online;
+	}
+
+	bool contains(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return entries.find(eos_id) != entries.end();
+	}
+
+	void setOnline(const FString& eos_id, bool online)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto iter = entries.find(eos_id);
+		if (iter == entries.end())
+		{
+			if (!online)
+				return;
+			iter = entries.emplace(eos_id, Entry()).first;
+			iter->second.Loaded = false;
+			iter->second.Position = lru.end();
+		}
+
+		auto& entry = iter->second;
+		if (online && entry.Position != lru.end())
+		{
+			lru.erase(entry.Position);
+			entry.Position = lru.end();
+		}
+		else if (!online && entry.Position == lru.end())
+		{
+			lru.push_front(eos_id);
+			entry.Position = lru.begin();
+		}
+		entry.Online = online;
+	}
+
+	/// <summary>
+	/// Least recently used offline players beyond capacity, they are forgotten here and the caller drops their rows.
+	/// keep(eos_id) can hold a player back (e.g. it has writes pending), it is then moved to the front.
+	/// </summary>
+	template <typename Keep>
+	std::vector<FString> evict(size_t capacity, Keep&& keep)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		std::vector<FString> evicted;
+		size_t kept = 0;
+		while (lru.size() > capacity && kept < lru.size())
+		{
+			const FString eos_id = lru.back();
+			if (keep(eos_id))
+			{
+				lru.splice(lru.begin(), lru, std::prev(lru.end()));
+				entries[eos_id].Position = lru.begin();
+				++kept;
+				continue;
+			}
+
+			lru.pop_back();
+			entries.erase(eos_id);
+			evicted.push_back(eos_id);
+		}
+		return evicted;
+	}
+
+	// Every player being tracked, for a full reload
+	std::unordered_set<std::string> keys()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		std::unordered_set<std::string> result;
+		for (const auto& entry : entries)
+			result.insert(entry.first.ToString());
+		return result;
+	}
+
+	// After a full reload, rows that weren't returned no longer exist
+	template <typename Map>
+	void refresh(const Map& players)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		for (auto& entry : entries)
+		{
+			entry.second.Loaded = true;
+			entry.second.Present = players.find(entry.first) != players.end();
+		}
+	}
+
+private:
+	struct Entry {
+		std::list<FString>::iterator Position;
+		bool Loaded = true;
+		bool Present = false;
+		bool Online = false;
+	};
+
+	// Caller holds mutex
+	Entry& Touch(const FString& eos_id)
+	{
+		auto iter = entries.find(eos_id);
+		if (iter == entries.end())
+		{
+			lru.push_front(eos_id);
+			iter = entries.emplace(eos_id, Entry()).first;
+			iter->second.Position = lru.begin();
+		}
+		else if (!iter->second.Online)
+		{
+			lru.splice(lru.begin(), lru, iter->second.Position);
+		}
+
+		iter->second.Loaded = true;
+		return iter->second;
+	}
+
+	std::mutex mutex;
+	std::unordered_map<FString, Entry, FStringHash, FStringEqual> entries;
+	// Offline players, most recently used first
+	std::list<FString> lru;
+};
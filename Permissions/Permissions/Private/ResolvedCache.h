@@ -0,0 +1,164 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "CachedGroup.h"
+#include "GroupNames.h"
+
+namespace Permissions::Cache
+{
+	// Bumped by every change that can alter a resolved group set (DB mutations, syncs, logins, tribe changes).
+	// Resolved entries remember the generation they were built at and are discarded once it moves on.
+	inline std::atomic<unsigned long long> generation{ 1 };
+
+	// How long a resolved entry may be reused for state we can't observe (external callbacks), 0 disables the cache
+	inline int ResolvedCacheMs = 1000;
+
+	inline void Invalidate()
+	{
+		generation.fetch_add(1, std::memory_order_acq_rel);
+	}
+
+	inline unsigned long long CurrentGeneration()
+	{
+		return generation.load(std::memory_order_acquire);
+	}
+}
+
+struct ResolvedPlayer {
+	unsigned long long Generation = 0;
+	// Epoch seconds of the next timed-group activation/expiry, 0 if none
+	long long ValidUntil = 0;
+	std::chrono::steady_clock::time_point ExpiresAt;
+
+	// Interned in the order they were resolved, only the calls that return names look them up
+	GroupSet Groups;
+	// Callback answers the group table doesn't know, they grant no permissions but count as memberships
+	TArray<FString> CallbackNames;
+
+	bool hasGroup(const FString& group) const
+	{
+		return Groups.Contains(group) || CallbackNames.Contains(group);
+	}
+
+	TArray<FString> ToArray() const
+	{
+		TArray<FString> names = Groups.ToArray();
+		names.Append(CallbackNames);
+		return names;
+	}
+
+	bool isValid(unsigned long long currentGeneration, long long nowSecs, std::chrono::steady_clock::time_point now) const
+	{
+		if (Generation != currentGeneration || now >= ExpiresAt)
+			return false;
+		return ValidUntil == 0 || nowSecs < ValidUntil;
+	}
+};
+
+/// <summary>
+/// Resolved players, published like the database caches so a hit never takes a lock. Holds at most capacity players,
+/// storing one more evicts the player stored longest ago. Hits don't lock, so they don't reorder, but every re-resolve
+/// after an invalidation stores the player again and moves it to the back. Entries gone stale are dropped by sweep().
+/// </summary>
+class ResolvedPlayerCache {
+public:
+	explicit ResolvedPlayerCache(size_t capacity)
+		: capacity(capacity)
+	{
+	}
+
+	std::shared_ptr<const ResolvedPlayer> find(const FString& eos_id) const
+	{
+		return entries.find(eos_id);
+	}
+
+	void store(const FString& eos_id, const ResolvedPlayer& resolved)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto [position, added] = positions.try_emplace(eos_id);
+		if (added)
+			position->second = order.insert(order.end(), eos_id);
+		else
+			order.splice(order.end(), order, position->second);
+
+		if (order.size() > capacity)
+		{
+			entries.erase(order.front());
+			positions.erase(order.front());
+			order.pop_front();
+		}
+		entries.set(eos_id, resolved);
+	}
+
+	// Drops the entries no longer valid at generation and now, returns how many
+	size_t sweep(unsigned long long generation, long long nowSecs, std::chrono::steady_clock::time_point now)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return entries.eraseIf([&](const FString& eos_id, const ResolvedPlayer& entry)
+			{
+				if (entry.isValid(generation, nowSecs, now))
+					return false;
+				auto position = positions.find(eos_id);
+				order.erase(position->second);
+				positions.erase(position);
+				return true;
+			});
+	}
+
+	size_t size() const
+	{
+		return entries.size();
+	}
+
+private:
+	size_t capacity;
+	SnapshotMap<FString, ResolvedPlayer, FStringHash, FStringEqual> entries;
+	// Store order, oldest first, guarded by mutex like positions
+	std::list<FString> order;
+	std::unordered_map<FString, std::list<FString>::iterator, FStringHash, FStringEqual> positions;
+	std::mutex mutex;
+};
+
+/// <summary>
+/// A T per thread reused from one cache miss to the next, so resolving doesn't allocate once its buffers have grown.
+/// Callbacks may check another player while one is being resolved, each nesting level gets its own T.
+/// </summary>
+template <typename T>
+class Scratch {
+public:
+	Scratch()
+	{
+		auto& pool = Pool();
+		if (Depth() == pool.size())
+			pool.push_back(std::make_unique<T>());
+		value = pool[Depth()++].get();
+	}
+
+	~Scratch()
+	{
+		--Depth();
+	}
+
+	Scratch(const Scratch&) = delete;
+	Scratch& operator=(const Scratch&) = delete;
+
+	T& operator*() const { return *value; }
+	T* operator->() const { return value; }
+
+private:
+	static std::vector<std::unique_ptr<T>>& Pool()
+	{
+		thread_local std::vector<std::unique_ptr<T>> pool;
+		return pool;
+	}
+
+	static size_t& Depth()
+	{
+		thread_local size_t depth = 0;
+		return depth;
+	}
+
+	T* value;
+};
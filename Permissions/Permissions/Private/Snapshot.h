@@ -0,0 +1,482 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "../Public/Permissions.h"
+#include "Database/IDatabase.h"
+#include "GroupNames.h"
+#include "Stats.h"
+
+namespace Permissions::Snapshot
+{
+	// Seconds between snapshot writes, 0 turns snapshots off (startup then always loads from the database)
+	inline int IntervalSecs = 300;
+
+	constexpr uint32_t Magic = 0x504E5350; // "PSNP"
+	// Bump whenever the layout changes, older files are then ignored
+	constexpr uint32_t Version = 3;
+
+	// FNV-1a over 8 byte words, the tail byte by byte. Only catches truncated or damaged files, so mixing a word at
+	// a time is plenty and keeps it off the load profile
+	inline uint64_t Checksum(const char* data, size_t size)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+		{
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			hash ^= word;
+			hash *= 1099511628211ULL;
+		}
+		for (; i < size; ++i)
+		{
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	/// <summary>
+	/// Flat little-endian layout: fixed size values are stored as is, strings as a TCHAR count followed by the
+	/// characters, and the file ends with a checksum of everything before it.
+	/// </summary>
+	class Writer {
+	public:
+		template <typename T>
+		void put(T value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			const size_t at = buffer.size();
+			buffer.resize(at + sizeof(T));
+			std::memcpy(buffer.data() + at, &value, sizeof(T));
+		}
+
+		void put(const FString& value)
+		{
+			const uint32_t length = static_cast<uint32_t>(value.Len());
+			put(length);
+			const size_t at = buffer.size();
+			buffer.resize(at + length * sizeof(TCHAR));
+			if (length > 0)
+				std::memcpy(buffer.data() + at, *value, length * sizeof(TCHAR));
+		}
+
+		// Placeholder for a count or offset that is only known after the section is written, filled in with patch()
+		template <typename T = uint32_t>
+		size_t reserve()
+		{
+			const size_t at = buffer.size();
+			put(T(0));
+			return at;
+		}
+
+		template <typename T>
+		void patch(size_t at, T value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			std::memcpy(buffer.data() + at, &value, sizeof(value));
+		}
+
+		size_t size() const
+		{
+			return buffer.size();
+		}
+
+		// Written to a temporary file first, so a crash mid-write leaves the previous snapshot intact
+		void save(const std::string& path)
+		{
+			put(Checksum(buffer.data(), buffer.size()));
+
+			const std::string temp = path + ".tmp";
+			{
+				std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+				if (!file.write(buffer.data(), static_cast<std::streamsize>(buffer.size())))
+					throw std::runtime_error("Can't write " + temp);
+			}
+			std::filesystem::rename(temp, path);
+		}
+
+	private:
+		std::vector<char> buffer;
+	};
+
+	// Reads what Writer wrote, throws on a truncated or corrupt file
+	class Reader {
+	public:
+		// False if the file doesn't exist
+		bool open(const std::string& path)
+		{
+			std::ifstream file(path, std::ios::binary | std::ios::ate);
+			if (!file)
+				return false;
+
+			buffer.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0);
+			if (!file.read(buffer.data(), static_cast<std::streamsize>(buffer.size())))
+				throw std::runtime_error("Can't read " + path);
+
+			uint64_t stored = 0;
+			if (buffer.size() < sizeof(stored))
+				throw std::runtime_error("Snapshot is truncated");
+			end = buffer.size() - sizeof(stored);
+			std::memcpy(&stored, buffer.data() + end, sizeof(stored));
+			if (stored != Checksum(buffer.data(), end))
+				throw std::runtime_error("Snapshot checksum mismatch");
+			return true;
+		}
+
+		template <typename T>
+		T get()
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			T value;
+			std::memcpy(&value, take(sizeof(T)), sizeof(T));
+			return value;
+		}
+
+		// get() without moving past the value
+		template <typename T>
+		T peek()
+		{
+			const size_t at = position;
+			const T value = get<T>();
+			position = at;
+			return value;
+		}
+
+		FString getString()
+		{
+			const uint32_t length = get<uint32_t>();
+			if (length == 0)
+				return FString();
+			const auto* chars = reinterpret_cast<const TCHAR*>(take(length * sizeof(TCHAR)));
+			return FString(std::basic_string<TCHAR>(chars, length).c_str());
+		}
+
+		size_t tell() const
+		{
+			return position;
+		}
+
+		void seek(size_t at)
+		{
+			if (at > end)
+				throw std::runtime_error("Snapshot is truncated");
+			position = at;
+		}
+
+	private:
+		const char* take(size_t size)
+		{
+			if (size > end - position)
+				throw std::runtime_error("Snapshot is truncated");
+			const char* data = buffer.data() + position;
+			position += size;
+			return data;
+		}
+
+		std::vector<char> buffer;
+		size_t position = 0;
+		size_t end = 0;
+	};
+
+	/// <summary>
+	/// Group names of the memberships, written once at the end of the file. Members store an index into it, so
+	/// loading interns each name once instead of decoding and hashing a string per membership.
+	/// </summary>
+	class GroupTable {
+	public:
+		uint32_t index(GroupId group)
+		{
+			const auto [entry, added] = indices.emplace(group, static_cast<uint32_t>(groups.size()));
+			if (added)
+				groups.push_back(group);
+			return entry->second;
+		}
+
+		GroupId group(uint32_t index) const
+		{
+			if (index >= groups.size())
+				throw std::runtime_error("Snapshot group index is out of range");
+			return groups[index];
+		}
+
+		void write(Writer& writer) const
+		{
+			writer.put(static_cast<uint32_t>(groups.size()));
+			for (const GroupId group : groups)
+				writer.put(Permissions::groupNames.name(group));
+		}
+
+		void read(Reader& reader)
+		{
+			const uint32_t count = reader.get<uint32_t>();
+			groups.reserve(count);
+			for (uint32_t i = 0; i < count; ++i)
+				groups.push_back(Permissions::groupNames.intern(reader.getString()));
+		}
+
+	private:
+		std::unordered_map<GroupId, uint32_t> indices;
+		std::vector<GroupId> groups;
+	};
+
+	inline void PutMemberships(Writer& writer, GroupTable& table, const CachedPermission& permission)
+	{
+		writer.put(static_cast<uint32_t>(permission.Groups.Num()));
+		for (const auto group : permission.Groups.Ids())
+			writer.put(table.index(group));
+		writer.put(static_cast<uint32_t>(permission.TimedGroups.Num()));
+		for (const auto& group : permission.TimedGroups)
+		{
+			writer.put(table.index(group.Group));
+			writer.put(static_cast<int64_t>(group.DelayUntilTime));
+			writer.put(static_cast<int64_t>(group.ExpireAtTime));
+		}
+	}
+
+	inline CachedPermission GetMemberships(Reader& reader, const GroupTable& table)
+	{
+		CachedPermission permission;
+		for (uint32_t count = reader.get<uint32_t>(); count > 0; --count)
+			permission.Groups.AddUnique(table.group(reader.get<uint32_t>()));
+		for (uint32_t count = reader.get<uint32_t>(); count > 0; --count)
+		{
+			const GroupId group = table.group(reader.get<uint32_t>());
+			const long long delayUntil = reader.get<int64_t>();
+			const long long expireAt = reader.get<int64_t>();
+			permission.TimedGroups.Add(TimedGroup(group, delayUntil, expireAt));
+		}
+		return permission;
+	}
+
+	/// <summary>
+	/// Writes the caches to path so the next start can serve from them before the database is read. Queued writes
+	/// are flushed first and the copy is taken under syncMutex, so the snapshot matches changeCursor.
+	/// </summary>
+	inline bool Save(IDatabase& database, const std::string& path)
+	{
+		static auto& saveStat = Stats::Timer("Snapshot.Save");
+		Stats::ScopedTimer timer(saveStat);
+
+		const std::string identity = database.GetSnapshotIdentity();
+		Writer writer;
+		try
+		{
+			std::lock_guard<std::mutex> syncLock(database.syncMutex);
+			{
+				std::lock_guard<std::mutex> flushLock(database.flushMutex);
+				database.FlushWritesLocked();
+			}
+
+			writer.put(Magic);
+			writer.put(Version);
+			writer.put(static_cast<uint32_t>(sizeof(TCHAR)));
+			writer.put(Checksum(identity.data(), identity.size()));
+			// Below the ids still missing, the catch-up after loading reads them again
+			writer.put(static_cast<int64_t>(database.changeCursor.ScanFrom()));
+			writer.put(static_cast<int64_t>(std::time(nullptr)));
+			// Lazy mode has only some of the players loaded, they are read on demand after a restart anyway
+			const bool withPlayers = !Permissions::Players::Lazy;
+			writer.put(static_cast<uint8_t>(withPlayers));
+			const size_t tableAt = writer.reserve<uint64_t>();
+			GroupTable table;
+
+			const size_t groupCount = writer.reserve();
+			uint32_t groups = 0;
+			database.permissionGroups.forEach([&writer, &groups](const FString& name, const CachedGroup& group)
+				{
+					writer.put(Permissions::groupNames.canonical(name));
+					writer.put(static_cast<uint32_t>(group.PermissionList.Num()));
+					for (const auto& permission : group.PermissionList)
+						writer.put(permission);
+					writer.put(static_cast<uint32_t>(group.ParentList.Num()));
+					for (const auto& parent : group.ParentList)
+						writer.put(parent);
+					++groups;
+				});
+			writer.patch(groupCount, groups);
+
+			const size_t playerCount = writer.reserve();
+			uint32_t players = 0;
+			if (withPlayers)
+			{
+				database.permissionPlayers.forEach([&writer, &table, &players](const FString& eos_id, const CachedPermission& permission)
+					{
+						writer.put(eos_id);
+						PutMemberships(writer, table, permission);
+						++players;
+					});
+			}
+			writer.patch(playerCount, players);
+
+			const size_t tribeCount = writer.reserve();
+			uint32_t tribes = 0;
+			database.permissionTribes.forEach([&writer, &table, &tribes](int tribeId, const CachedPermission& permission)
+				{
+					writer.put(static_cast<int32_t>(tribeId));
+					PutMemberships(writer, table, permission);
+					++tribes;
+				});
+			writer.patch(tribeCount, tribes);
+
+			writer.patch(tableAt, static_cast<uint64_t>(writer.size()));
+			table.write(writer);
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Unexpected DB error {}", __FILE__, __FUNCTION__, exception.what());
+			return false;
+		}
+
+		try
+		{
+			writer.save(path);
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Can't write snapshot {}", __FILE__, __FUNCTION__, exception.what());
+			return false;
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Fills the caches from a snapshot written by Save. Returns false, leaving the caches alone, if the file
+	/// is missing, damaged, written for another database or older than the change log goes back. Call Reconcile
+	/// afterwards to pick up what changed since it was written.
+	/// </summary>
+	inline bool Load(IDatabase& database, const std::string& path)
+	{
+		static auto& loadStat = Stats::Timer("Snapshot.Load");
+		Stats::ScopedTimer timer(loadStat);
+
+		try
+		{
+			Reader reader;
+			if (!reader.open(path))
+				return false;
+
+			if (reader.get<uint32_t>() != Magic || reader.get<uint32_t>() != Version
+				|| reader.get<uint32_t>() != sizeof(TCHAR))
+			{
+				Log::GetLog()->info("Ignoring snapshot, it was written by another version");
+				return false;
+			}
+
+			const std::string identity = database.GetSnapshotIdentity();
+			if (reader.get<uint64_t>() != Checksum(identity.data(), identity.size()))
+			{
+				Log::GetLog()->info("Ignoring snapshot, it was written for another database");
+				return false;
+			}
+
+			const long long watermark = reader.get<int64_t>();
+			const long long age = std::time(nullptr) - reader.get<int64_t>();
+			if (age > IDatabase::ChangeLogRetentionSecs)
+			{
+				Log::GetLog()->info("Ignoring snapshot, it is older than the change log");
+				return false;
+			}
+
+			const bool withPlayers = reader.get<uint8_t>() != 0;
+			if (!withPlayers && !Permissions::Players::Lazy)
+			{
+				Log::GetLog()->info("Ignoring snapshot, it was written with LazyPlayerLoading");
+				return false;
+			}
+
+			// The group table sits behind the members referring to it
+			GroupTable table;
+			const uint64_t tableAt = reader.get<uint64_t>();
+			const size_t sectionsAt = reader.tell();
+			reader.seek(static_cast<size_t>(tableAt));
+			table.read(reader);
+			reader.seek(sectionsAt);
+
+			IDatabase::GroupRows groups;
+			for (uint32_t count = reader.get<uint32_t>(); count > 0; --count)
+			{
+				FString name = reader.getString();
+				CachedGroup group;
+				for (uint32_t permissions = reader.get<uint32_t>(); permissions > 0; --permissions)
+					group.addPermission(reader.getString());
+				for (uint32_t parents = reader.get<uint32_t>(); parents > 0; --parents)
+					group.ParentList.AddUnique(reader.getString());
+				groups.emplace(std::move(name), std::move(group));
+			}
+
+			IDatabase::PlayerRows players;
+			players.reserve(reader.peek<uint32_t>());
+			for (uint32_t count = reader.get<uint32_t>(); count > 0; --count)
+			{
+				FString eos_id = reader.getString();
+				players.emplace(std::move(eos_id), GetMemberships(reader, table));
+			}
+
+			std::unordered_map<int, CachedPermission> tribes;
+			tribes.reserve(reader.peek<uint32_t>());
+			for (uint32_t count = reader.get<uint32_t>(); count > 0; --count)
+			{
+				const int tribeId = reader.get<int32_t>();
+				tribes.emplace(tribeId, GetMemberships(reader, table));
+			}
+
+			const size_t groupCount = groups.size(), playerCount = players.size(), tribeCount = tribes.size();
+			{
+				std::lock_guard<std::mutex> syncLock(database.syncMutex);
+				database.KeepPendingRows(groups, players, tribes);
+				database.AssignGroups(std::move(groups));
+				// Lazy mode loads players on demand, a snapshot written without it only saves it the queries
+				if (!Permissions::Players::Lazy)
+					database.AssignPlayers(std::move(players));
+				database.permissionTribes.assign(std::move(tribes));
+				database.changeCursor = ChangeCursor(watermark);
+
+				database.RescheduleTimedGroups();
+			}
+			Permissions::Cache::Invalidate();
+
+			Log::GetLog()->info("Loaded snapshot with {} groups, {} players and {} tribes written {} seconds ago", groupCount,
+				Permissions::Players::Lazy ? 0 : playerCount, tribeCount, age);
+			return true;
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->warn("({} {}) Ignoring snapshot {}", __FILE__, __FUNCTION__, exception.what());
+			return false;
+		}
+	}
+
+	/// <summary>
+	/// Brings caches loaded from a snapshot up to date. Replays the change log since the snapshot was written, or
+	/// reloads everything if the database is behind the snapshot (restored from a backup or replaced meanwhile).
+	/// </summary>
+	inline void Reconcile(IDatabase& database)
+	{
+		long long stored, watermark;
+		{
+			std::lock_guard<std::mutex> syncLock(database.syncMutex);
+			std::lock_guard<std::mutex> flushLock(database.flushMutex);
+			stored = database.GetChangeWatermark();
+			watermark = database.changeCursor.Watermark();
+		}
+
+		if (stored < watermark)
+		{
+			Log::GetLog()->warn("Database is behind the snapshot, reloading everything");
+			database.Init();
+		}
+		else
+			database.SyncChanges();
+	}
+}
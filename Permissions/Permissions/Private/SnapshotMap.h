@@ -0,0 +1,435 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// Read-copy-update map. Readers load the current immutable version through an atomic shared_ptr, writers copy what
+/// the change touches and publish a new version. Readers never wait for a writer to finish, though the atomic
+/// shared_ptr itself may use a short internal lock (it does on MSVC and libstdc++).
+///
+/// Versions are hash array mapped tries with 32 slots per node, sharing every node a write didn't touch. Writing one
+/// key copies the nodes on its path, about log32(n) of them, so a write costs the same at 1k or 200k entries. Writes
+/// of many keys go through the *Each methods and assign(), which copy each touched node once and edit the copy in
+/// place for the rest of the batch.
+/// </summary>
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+class SnapshotMap {
+public:
+	SnapshotMap()
+		: current(std::make_shared<const Root>())
+	{
+	}
+
+	std::shared_ptr<const Value> find(const Key& key) const
+	{
+		const auto root = current.load(std::memory_order_acquire);
+		const Entry* entry = Find(root->Top.get(), key);
+		return entry ? entry->StoredValue : nullptr;
+	}
+
+	bool contains(const Key& key) const
+	{
+		return find(key) != nullptr;
+	}
+
+	size_t size() const
+	{
+		return current.load(std::memory_order_acquire)->Size;
+	}
+
+	// Visits one consistent version, fn(const Key&, const Value&)
+	template <typename Fn>
+	void forEach(Fn&& fn) const
+	{
+		const auto root = current.load(std::memory_order_acquire);
+		Visit(root->Top.get(), [&fn](const Entry& entry) { fn(entry.StoredKey, *entry.StoredValue); });
+	}
+
+	// Copies the entry (default constructed if missing), lets fn edit it and publishes the result
+	template <typename Fn>
+	void update(const Key& key, Fn&& fn)
+	{
+		std::lock_guard<std::mutex> lg(writeMutex);
+		Batch batch(*this);
+		const Entry* existing = Find(batch.Top.get(), key);
+		auto value = existing ? std::make_shared<Value>(*existing->StoredValue) : std::make_shared<Value>();
+		fn(*value);
+		batch.set(key, std::move(value));
+		batch.publish();
+	}
+
+	// update() for many keys with a single publish. fn(const Key&, Value&)
+	template <typename Keys, typename Fn>
+	void updateEach(const Keys& keys, Fn&& fn)
+	{
+		updateKeys(keys, std::forward<Fn>(fn), true);
+	}
+
+	// updateEach() that skips keys no longer in the map instead of adding them
+	template <typename Keys, typename Fn>
+	void updateExisting(const Keys& keys, Fn&& fn)
+	{
+		updateKeys(keys, std::forward<Fn>(fn), false);
+	}
+
+	void set(const Key& key, Value value)
+	{
+		std::lock_guard<std::mutex> lg(writeMutex);
+		Batch batch(*this);
+		batch.set(key, std::make_shared<Value>(std::move(value)));
+		batch.publish();
+	}
+
+	/// <summary>
+	/// set() and erase() for many keys with a single publish. entries holds (key, value) pairs, a null value erases
+	/// the key. fn(const Key&, const Value*) runs for each entry in the write lock, with nullptr for an erased one.
+	/// </summary>
+	template <typename Fn>
+	void setEach(std::vector<std::pair<Key, std::shared_ptr<const Value>>>&& entries, Fn&& fn)
+	{
+		std::lock_guard<std::mutex> lg(writeMutex);
+		Batch batch(*this);
+		for (auto& [key, value] : entries) {
+			fn(key, value.get());
+			if (value)
+				batch.set(key, std::move(value));
+			else
+				batch.erase(key);
+		}
+		batch.publish();
+	}
+
+	void setEach(std::vector<std::pair<Key, std::shared_ptr<const Value>>>&& entries)
+	{
+		setEach(std::move(entries), [](const Key&, const Value*) {});
+	}
+
+	void erase(const Key& key)
+	{
+		std::lock_guard<std::mutex> lg(writeMutex);
+		Batch batch(*this);
+		if (batch.erase(key))
+			batch.publish();
+	}
+
+	// Drops every entry matching pred(const Key&, const Value&), one publish for all of them and none if nothing matched
+	template <typename Pred>
+	size_t eraseIf(Pred&& pred)
+	{
+		std::lock_guard<std::mutex> lg(writeMutex);
+		Batch batch(*this);
+		std::vector<Key> matched;
+		Visit(batch.Top.get(), [&](const Entry& entry)
+			{
+				if (pred(entry.StoredKey, *entry.StoredValue))
+					matched.push_back(entry.StoredKey);
+			});
+		for (const auto& key : matched)
+			batch.erase(key);
+		if (!matched.empty())
+			batch.publish();
+		return matched.size();
+	}
+
+	// Replaces the whole map in one swap
+	template <typename Map>
+	void assign(Map&& values)
+	{
+		Batch batch(*this, nullptr);
+		for (auto& entry : values)
+			batch.set(entry.first, std::make_shared<const Value>(std::move(entry.second)));
+
+		std::lock_guard<std::mutex> lg(writeMutex);
+		batch.publish();
+	}
+
+private:
+	static constexpr unsigned Bits = 5;
+	static constexpr size_t HashBits = sizeof(size_t) * 8;
+
+	struct Entry {
+		size_t HashCode;
+		Key StoredKey;
+		std::shared_ptr<const Value> StoredValue;
+	};
+
+	struct Node;
+
+	// An entry, or a node holding the entries whose hashes share the bits so far
+	struct Slot {
+		std::shared_ptr<const Entry> Item;
+		std::shared_ptr<Node> Child;
+	};
+
+	/// <summary>
+	/// Slots for the set bits of Bitmap, in bit order. Below the last hash bits a node lists colliding entries in any
+	/// order and ignores Bitmap. A published node is never changed again: a write edits only the nodes stamped with
+	/// its own Edit, which it copied itself.
+	/// </summary>
+	struct Node {
+		uint64_t Edit = 0;
+		uint32_t Bitmap = 0;
+		std::vector<Slot> Slots;
+	};
+
+	struct Root {
+		std::shared_ptr<Node> Top;
+		size_t Size = 0;
+	};
+
+	// Spreads weak hashes (identity for integers) over the bits the trie indexes with
+	static size_t HashOf(const Key& key)
+	{
+		uint64_t hash = Hash()(key);
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		return static_cast<size_t>(hash);
+	}
+
+	static uint32_t BitOf(size_t hash, unsigned shift)
+	{
+		return 1u << ((hash >> shift) & ((1u << Bits) - 1));
+	}
+
+	static size_t PositionOf(const Node& node, uint32_t bit)
+	{
+		return std::popcount(node.Bitmap & (bit - 1));
+	}
+
+	static const Entry* Find(const Node* node, const Key& key)
+	{
+		const size_t hash = HashOf(key);
+		for (unsigned shift = 0; node; shift += Bits) {
+			if (shift >= HashBits) {
+				for (const auto& slot : node->Slots) {
+					if (Equal()(slot.Item->StoredKey, key))
+						return slot.Item.get();
+				}
+				return nullptr;
+			}
+
+			const uint32_t bit = BitOf(hash, shift);
+			if (!(node->Bitmap & bit))
+				return nullptr;
+
+			const Slot& slot = node->Slots[PositionOf(*node, bit)];
+			if (!slot.Child)
+				return slot.Item->HashCode == hash && Equal()(slot.Item->StoredKey, key) ? slot.Item.get() : nullptr;
+			node = slot.Child.get();
+		}
+		return nullptr;
+	}
+
+	template <typename Fn>
+	static void Visit(const Node* node, Fn&& fn)
+	{
+		if (!node)
+			return;
+		for (const auto& slot : node->Slots) {
+			if (slot.Child)
+				Visit(slot.Child.get(), fn);
+			else
+				fn(*slot.Item);
+		}
+	}
+
+	/// <summary>
+	/// The version a write is building, published at the end. Nodes are copied the first time the write touches them
+	/// and edited in place after that, readers only ever see the nodes of published versions. Caller holds writeMutex,
+	/// except assign() which builds from nothing and takes it only to publish.
+	/// </summary>
+	struct Batch {
+		explicit Batch(SnapshotMap& map)
+			: map(map), edit(++map.edits)
+		{
+			const auto root = map.current.load(std::memory_order_acquire);
+			Top = root->Top;
+			Size = root->Size;
+		}
+
+		// Starts from an empty map, for assign()
+		Batch(SnapshotMap& map, std::nullptr_t)
+			: map(map), edit(map.assigns.fetch_add(1, std::memory_order_relaxed) | AssignEdit)
+		{
+		}
+
+		void set(const Key& key, std::shared_ptr<const Value> value)
+		{
+			const size_t hash = HashOf(key);
+			Top = Set(std::move(Top), 0, std::make_shared<const Entry>(Entry{ hash, key, std::move(value) }));
+		}
+
+		bool erase(const Key& key)
+		{
+			bool erased = false;
+			Top = Erase(Top, 0, HashOf(key), key, erased);
+			return erased;
+		}
+
+		void publish()
+		{
+			auto root = std::make_shared<Root>();
+			root->Top = std::move(Top);
+			root->Size = Size;
+			map.current.store(std::move(root), std::memory_order_release);
+		}
+
+		std::shared_ptr<Node> Top;
+		size_t Size = 0;
+
+	private:
+		std::shared_ptr<Node> Editable(const std::shared_ptr<Node>& node)
+		{
+			if (node->Edit == edit)
+				return node;
+			auto copy = std::make_shared<Node>(*node);
+			copy->Edit = edit;
+			return copy;
+		}
+
+		std::shared_ptr<Node> Leaf(unsigned shift, std::shared_ptr<const Entry> entry)
+		{
+			auto node = std::make_shared<Node>();
+			node->Edit = edit;
+			if (shift < HashBits)
+				node->Bitmap = BitOf(entry->HashCode, shift);
+			node->Slots.push_back(Slot{ std::move(entry), nullptr });
+			return node;
+		}
+
+		std::shared_ptr<Node> Set(std::shared_ptr<Node> node, unsigned shift, std::shared_ptr<const Entry> entry)
+		{
+			if (!node) {
+				++Size;
+				return Leaf(shift, std::move(entry));
+			}
+
+			if (shift >= HashBits) {
+				node = Editable(node);
+				for (auto& slot : node->Slots) {
+					if (Equal()(slot.Item->StoredKey, entry->StoredKey)) {
+						slot.Item = std::move(entry);
+						return node;
+					}
+				}
+				node->Slots.push_back(Slot{ std::move(entry), nullptr });
+				++Size;
+				return node;
+			}
+
+			const uint32_t bit = BitOf(entry->HashCode, shift);
+			const size_t position = PositionOf(*node, bit);
+			node = Editable(node);
+			if (!(node->Bitmap & bit)) {
+				node->Bitmap |= bit;
+				node->Slots.insert(node->Slots.begin() + position, Slot{ std::move(entry), nullptr });
+				++Size;
+				return node;
+			}
+
+			Slot& slot = node->Slots[position];
+			if (slot.Child)
+				slot.Child = Set(std::move(slot.Child), shift + Bits, std::move(entry));
+			else if (slot.Item->HashCode == entry->HashCode && Equal()(slot.Item->StoredKey, entry->StoredKey))
+				slot.Item = std::move(entry);
+			else {
+				// Two entries sharing the bits so far, pushed one level down. The one already here isn't added again
+				auto child = Leaf(shift + Bits, std::move(slot.Item));
+				slot.Item = nullptr;
+				slot.Child = Set(std::move(child), shift + Bits, std::move(entry));
+			}
+			return node;
+		}
+
+		// Returns node itself if key isn't there, nullptr once the node is empty
+		std::shared_ptr<Node> Erase(const std::shared_ptr<Node>& node, unsigned shift, size_t hash, const Key& key, bool& erased)
+		{
+			if (!node)
+				return node;
+
+			if (shift >= HashBits) {
+				for (size_t i = 0; i < node->Slots.size(); ++i) {
+					if (!Equal()(node->Slots[i].Item->StoredKey, key))
+						continue;
+					erased = true;
+					--Size;
+					if (node->Slots.size() == 1)
+						return nullptr;
+					auto edited = Editable(node);
+					edited->Slots.erase(edited->Slots.begin() + i);
+					return edited;
+				}
+				return node;
+			}
+
+			const uint32_t bit = BitOf(hash, shift);
+			if (!(node->Bitmap & bit))
+				return node;
+
+			const size_t position = PositionOf(*node, bit);
+			const Slot& slot = node->Slots[position];
+			std::shared_ptr<Node> child;
+			if (slot.Child) {
+				child = Erase(slot.Child, shift + Bits, hash, key, erased);
+				if (!erased)
+					return node;
+			}
+			else {
+				if (slot.Item->HashCode != hash || !Equal()(slot.Item->StoredKey, key))
+					return node;
+				erased = true;
+				--Size;
+			}
+
+			auto edited = Editable(node);
+			if (child && child->Slots.size() == 1 && !child->Slots[0].Child) {
+				// A lone entry moves back up, so tries don't keep the depth of keys long gone
+				edited->Slots[position] = Slot{ child->Slots[0].Item, nullptr };
+			}
+			else if (child)
+				edited->Slots[position].Child = std::move(child);
+			else {
+				edited->Bitmap &= ~bit;
+				edited->Slots.erase(edited->Slots.begin() + position);
+			}
+			return edited->Slots.empty() ? nullptr : edited;
+		}
+
+		SnapshotMap& map;
+		uint64_t edit;
+	};
+
+	// Shared by updateEach and updateExisting, addMissing default constructs the keys that aren't in the map
+	template <typename Keys, typename Fn>
+	void updateKeys(const Keys& keys, Fn&& fn, bool addMissing)
+	{
+		std::lock_guard<std::mutex> lg(writeMutex);
+		Batch batch(*this);
+		bool changed = false;
+		for (const auto& key : keys) {
+			const Entry* existing = Find(batch.Top.get(), key);
+			if (!existing && !addMissing)
+				continue;
+
+			auto value = existing ? std::make_shared<Value>(*existing->StoredValue) : std::make_shared<Value>();
+			fn(key, *value);
+			batch.set(key, std::move(value));
+			changed = true;
+		}
+		if (changed)
+			batch.publish();
+	}
+
+	// Edit stamps of writes under writeMutex count up from 1, those of assign() have the top bit set so the two never meet
+	static constexpr uint64_t AssignEdit = 1ULL << 63;
+
+	std::atomic<std::shared_ptr<const Root>> current;
+	std::mutex writeMutex;
+	uint64_t edits = 0;
+	std::atomic<uint64_t> assigns{ 0 };
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace Permissions::Stats
+{
+	// How often the stats are written to the log, 0 turns it off
+	inline int LogIntervalSecs = 3600;
+
+	/// <summary>
+	/// Calls and latency of one operation, or a running total for counters (e.g. rows loaded).
+	/// Latencies go into power of two buckets from 256ns up, so percentiles are upper bounds within a factor of two.
+	/// Updated with relaxed atomics, a reader can see a call in one field before the other.
+	/// </summary>
+	class Metric {
+	public:
+		static constexpr size_t Buckets = 24;
+
+		Metric(std::string name, bool timer)
+			: name(std::move(name)), timer(timer)
+		{
+		}
+
+		void record(std::chrono::nanoseconds elapsed)
+		{
+			const uint64_t nanos = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+			count.fetch_add(1, std::memory_order_relaxed);
+			total.fetch_add(nanos, std::memory_order_relaxed);
+			buckets[std::min<size_t>(std::bit_width(nanos >> 8), Buckets - 1)].fetch_add(1, std::memory_order_relaxed);
+
+			uint64_t previous = max.load(std::memory_order_relaxed);
+			while (nanos > previous && !max.compare_exchange_weak(previous, nanos, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		void add(uint64_t value)
+		{
+			count.fetch_add(1, std::memory_order_relaxed);
+			total.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		void reset()
+		{
+			count = 0;
+			total = 0;
+			max = 0;
+			for (auto& bucket : buckets)
+				bucket = 0;
+		}
+
+		const std::string& getName() const
+		{
+			return name;
+		}
+
+		uint64_t getCount() const
+		{
+			return count.load(std::memory_order_relaxed);
+		}
+
+		// One line for the stats command and the log, empty if nothing was recorded
+		std::string format() const
+		{
+			const uint64_t calls = getCount();
+			if (calls == 0)
+				return {};
+
+			if (!timer)
+				return fmt::format("{}: {} in {} runs", name, total.load(std::memory_order_relaxed), calls);
+
+			return fmt::format("{}: {} calls, mean {}, p50 < {}, p99 < {}, max {}", name, calls,
+				FormatNanos(total.load(std::memory_order_relaxed) / calls), FormatNanos(percentile(calls, 0.50)),
+				FormatNanos(percentile(calls, 0.99)), FormatNanos(max.load(std::memory_order_relaxed)));
+		}
+
+	private:
+		// Upper bound of the bucket holding the given share of calls
+		uint64_t percentile(uint64_t calls, double share) const
+		{
+			const uint64_t target = static_cast<uint64_t>(calls * share);
+			uint64_t seen = 0;
+			for (size_t i = 0; i < Buckets; ++i)
+			{
+				seen += buckets[i].load(std::memory_order_relaxed);
+				if (seen > target)
+					return 256ull << i;
+			}
+			return max.load(std::memory_order_relaxed);
+		}
+
+		static std::string FormatNanos(uint64_t nanos)
+		{
+			if (nanos < 10'000)
+				return fmt::format("{}ns", nanos);
+			if (nanos < 10'000'000)
+				return fmt::format("{}us", nanos / 1000);
+			return fmt::format("{}ms", nanos / 1'000'000);
+		}
+
+		std::string name;
+		bool timer;
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<uint64_t> total{ 0 };
+		std::atomic<uint64_t> max{ 0 };
+		std::array<std::atomic<uint64_t>, Buckets> buckets{};
+	};
+
+	// Records the time until the end of the scope
+	class ScopedTimer {
+	public:
+		explicit ScopedTimer(Metric& metric)
+			: metric(metric), start(std::chrono::steady_clock::now())
+		{
+		}
+
+		~ScopedTimer()
+		{
+			metric.record(std::chrono::steady_clock::now() - start);
+		}
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+	private:
+		Metric& metric;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	inline std::mutex registryMutex;
+	// Metrics are never removed, so references handed out stay valid
+	inline std::deque<Metric> registry;
+
+	inline Metric& Register(const std::string& name, bool timer)
+	{
+		std::lock_guard<std::mutex> lg(registryMutex);
+		for (auto& metric : registry)
+		{
+			if (metric.getName() == name)
+				return metric;
+		}
+		return registry.emplace_back(name, timer);
+	}
+
+	// Call sites keep the reference in a function-local static, so the lookup only happens on the first call
+	inline Metric& Timer(const std::string& name)
+	{
+		return Register(name, true);
+	}
+
+	inline Metric& Counter(const std::string& name)
+	{
+		return Register(name, false);
+	}
+
+	inline std::vector<std::string> Format()
+	{
+		std::lock_guard<std::mutex> lg(registryMutex);
+		std::vector<std::string> lines;
+		for (const auto& metric : registry)
+		{
+			auto line = metric.format();
+			if (!line.empty())
+				lines.push_back(std::move(line));
+		}
+		return lines;
+	}
+
+	inline void Reset()
+	{
+		std::lock_guard<std::mutex> lg(registryMutex);
+		for (auto& metric : registry)
+			metric.reset();
+	}
+}
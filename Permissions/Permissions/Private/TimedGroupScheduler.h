@@ -0,0 +1,154 @@
+#pragma once
+#include "CachedPermission.h"
+
+/// <summary>
+/// Min-heap of upcoming timed group activations (DelayUntilTime) and expiries (ExpireAtTime) for every loaded player and tribe.
+/// Rescheduling an owner stamps its entries with a new version, older entries are dropped lazily when they reach the top.
+/// </summary>
+class TimedGroupScheduler {
+public:
+	struct Event {
+		FString EosId;
+		int TribeId;
+		FString GroupName;
+		bool Activated;
+	};
+
+	void SchedulePlayer(const FString& eos_id, const TArray<TimedGroup>& groups, long long now)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		Schedule(playerOwners[eos_id], eos_id, 0, groups, now);
+		if (playerOwners[eos_id].Pending == 0)
+			playerOwners.erase(eos_id);
+	}
+
+	void ScheduleTribe(int tribeId, const TArray<TimedGroup>& groups, long long now)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		Schedule(tribeOwners[tribeId], L"", tribeId, groups, now);
+		if (tribeOwners[tribeId].Pending == 0)
+			tribeOwners.erase(tribeId);
+	}
+
+	void Reset()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		heap.clear();
+		playerOwners.clear();
+		tribeOwners.clear();
+		liveEntries = 0;
+	}
+
+	// Pops every boundary that is due, O(log n) each
+	std::vector<Event> PopDue(long long now)
+	{
+		std::vector<Event> due;
+		std::lock_guard<std::mutex> lg(mutex);
+		while (!heap.empty() && heap.front().At <= now)
+		{
+			std::pop_heap(heap.begin(), heap.end(), Later());
+			Entry entry = std::move(heap.back());
+			heap.pop_back();
+
+			Owner* owner = FindOwner(entry);
+			if (!owner || owner->Version != entry.Version)
+				continue;
+
+			--liveEntries;
+			if (--owner->Pending == 0)
+			{
+				if (entry.EosId.IsEmpty())
+					tribeOwners.erase(entry.TribeId);
+				else
+					playerOwners.erase(entry.EosId);
+			}
+			due.push_back(Event{ entry.EosId, entry.TribeId, Permissions::groupNames.name(entry.Group), entry.Activation });
+		}
+		return due;
+	}
+
+	// Seconds until the next boundary, -1 if nothing is scheduled
+	long long NextDue(long long now)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		if (heap.empty())
+			return -1;
+		return heap.front().At > now ? heap.front().At - now : 0;
+	}
+
+private:
+	struct Entry {
+		long long At;
+		unsigned long long Version;
+		FString EosId;
+		int TribeId;
+		GroupId Group;
+		bool Activation;
+	};
+
+	struct Later {
+		bool operator()(const Entry& a, const Entry& b) const { return a.At > b.At; }
+	};
+
+	struct Owner {
+		unsigned long long Version = 0;
+		size_t Pending = 0;
+	};
+
+	void Schedule(Owner& owner, const FString& eos_id, int tribeId, const TArray<TimedGroup>& groups, long long now)
+	{
+		liveEntries -= owner.Pending;
+		owner.Pending = 0;
+		owner.Version = ++nextVersion;
+
+		for (const auto& group : groups) {
+			if (group.ExpireAtTime <= now)
+				continue;
+			if (group.DelayUntilTime > now)
+				Push(owner, Entry{ group.DelayUntilTime, owner.Version, eos_id, tribeId, group.Group, true });
+			Push(owner, Entry{ group.ExpireAtTime, owner.Version, eos_id, tribeId, group.Group, false });
+		}
+
+		if (heap.size() > liveEntries * 2 + 1024)
+			Compact();
+	}
+
+	void Push(Owner& owner, Entry&& entry)
+	{
+		heap.push_back(std::move(entry));
+		std::push_heap(heap.begin(), heap.end(), Later());
+		++owner.Pending;
+		++liveEntries;
+	}
+
+	Owner* FindOwner(const Entry& entry)
+	{
+		if (entry.EosId.IsEmpty()) {
+			auto iter = tribeOwners.find(entry.TribeId);
+			return iter == tribeOwners.end() ? nullptr : &iter->second;
+		}
+		auto iter = playerOwners.find(entry.EosId);
+		return iter == playerOwners.end() ? nullptr : &iter->second;
+	}
+
+	// Drops superseded entries once they outnumber the live ones
+	void Compact()
+	{
+		std::vector<Entry> live;
+		live.reserve(liveEntries);
+		for (auto& entry : heap) {
+			Owner* owner = FindOwner(entry);
+			if (owner && owner->Version == entry.Version)
+				live.push_back(std::move(entry));
+		}
+		heap = std::move(live);
+		std::make_heap(heap.begin(), heap.end(), Later());
+	}
+
+	std::mutex mutex;
+	std::vector<Entry> heap;
+	std::unordered_map<FString, Owner, FStringHash, FStringEqual> playerOwners;
+	std::unordered_map<int, Owner> tribeOwners;
+	unsigned long long nextVersion = 0;
+	size_t liveEntries = 0;
+};
@@ -0,0 +1,571 @@
+#pragma once
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "json.hpp"
+#include "CachedPermission.h"
+#include "Database/IDatabase.h"
+#include "Stats.h"
+
+// Files written by Permissions.Export and read by Permissions.Import
+namespace Permissions::Transfer
+{
+	// Records written to the database in one transaction while importing
+	inline int ImportChunkRows = 500;
+	// Stored players read from the database at a time while exporting with lazy player loading
+	constexpr size_t ExportPageRows = 1000;
+
+	enum class RecordType
+	{
+		Group,
+		Player,
+		Tribe
+	};
+
+	// A group with its permissions and parents, or a player or tribe with its memberships
+	struct Record {
+		RecordType Type = RecordType::Group;
+		// Group name or EOS id
+		FString Name;
+		int TribeId = 0;
+		TArray<FString> Permissions;
+		TArray<FString> Parents;
+		CachedPermission Memberships;
+	};
+
+	// .csv files hold one membership or permission per row, anything else is read as JSON lines with one record per line
+	inline bool IsCsv(const std::string& path)
+	{
+		const auto extension = std::filesystem::path(path).extension().string();
+		return extension == ".csv" || extension == ".CSV";
+	}
+
+	/// <summary>
+	/// JSON lines:
+	///   {"type":"group","name":"Admins","permissions":["*"],"parents":["Moderators"]}
+	///   {"type":"player","eos_id":"...","groups":["Default"],"timed":[{"group":"Vip","delay_until":0,"expire_at":1767225600}]}
+	///   {"type":"tribe","tribe_id":1234,"groups":[],"timed":[]}
+	/// CSV, header "type,key,value,delay_until,expire_at":
+	///   group,Admins,*,,
+	///   parent,Admins,Moderators,,
+	///   player,<eos id>,Default,,
+	///   player,<eos id>,Vip,0,1767225600
+	/// A CSV row with an empty value names a group without permissions or parents, or a player/tribe without memberships.
+	/// </summary>
+	class Writer {
+	public:
+		explicit Writer(const std::string& path)
+			: path(path), temp(path + ".tmp"), csv(IsCsv(path)), file(temp, std::ios::binary | std::ios::trunc)
+		{
+			if (!file)
+				throw std::runtime_error("Can't write " + temp);
+			if (csv)
+				file << "type,key,value,delay_until,expire_at\n";
+		}
+
+		void writeGroup(const FString& name, const TArray<FString>& permissions, const TArray<FString>& parents)
+		{
+			const std::string key = name.ToString();
+			if (!csv)
+			{
+				nlohmann::json permissionList = nlohmann::json::array();
+				for (const auto& permission : permissions)
+					permissionList.push_back(permission.ToString());
+				nlohmann::json parentList = nlohmann::json::array();
+				for (const auto& parent : parents)
+					parentList.push_back(parent.ToString());
+				writeLine({ { "type", "group" }, { "name", key }, { "permissions", std::move(permissionList) }, { "parents", std::move(parentList) } });
+				return;
+			}
+
+			if (permissions.Num() == 0 && parents.Num() == 0)
+				writeRow("group", key, "", "", "");
+			for (const auto& permission : permissions)
+				writeRow("group", key, permission.ToString(), "", "");
+			for (const auto& parent : parents)
+				writeRow("parent", key, parent.ToString(), "", "");
+		}
+
+		void writePlayer(const FString& eos_id, const CachedPermission& memberships)
+		{
+			writeMemberships("player", eos_id.ToString(), memberships);
+		}
+
+		void writeTribe(int tribeId, const CachedPermission& memberships)
+		{
+			writeMemberships("tribe", std::to_string(tribeId), memberships);
+		}
+
+		// Replaces the file at path, a failed export leaves the previous one intact
+		void finish()
+		{
+			file.close();
+			if (!file)
+				throw std::runtime_error("Can't write " + temp);
+			std::filesystem::rename(temp, path);
+		}
+
+	private:
+		void writeMemberships(const char* type, const std::string& key, const CachedPermission& memberships)
+		{
+			if (!csv)
+			{
+				nlohmann::json groups = nlohmann::json::array();
+				for (const auto& group : memberships.Groups)
+					groups.push_back(group.ToString());
+				nlohmann::json timed = nlohmann::json::array();
+				for (const auto& group : memberships.TimedGroups)
+				{
+					timed.push_back({ { "group", group.GroupName().ToString() }, { "delay_until", group.DelayUntilTime },
+						{ "expire_at", group.ExpireAtTime } });
+				}
+
+				nlohmann::json line = { { "type", type }, { "groups", std::move(groups) }, { "timed", std::move(timed) } };
+				if (std::string(type) == "tribe")
+					line["tribe_id"] = std::stoi(key);
+				else
+					line["eos_id"] = key;
+				writeLine(line);
+				return;
+			}
+
+			if (memberships.Groups.Num() == 0 && memberships.TimedGroups.Num() == 0)
+				writeRow(type, key, "", "", "");
+			for (const auto& group : memberships.Groups)
+				writeRow(type, key, group.ToString(), "", "");
+			for (const auto& group : memberships.TimedGroups)
+				writeRow(type, key, group.GroupName().ToString(), std::to_string(group.DelayUntilTime), std::to_string(group.ExpireAtTime));
+		}
+
+		void writeLine(const nlohmann::json& line)
+		{
+			file << line.dump() << '\n';
+		}
+
+		void writeRow(const char* type, const std::string& key, const std::string& value, const std::string& delayUntil, const std::string& expireAt)
+		{
+			file << type << ',' << Quote(key) << ',' << Quote(value) << ',' << delayUntil << ',' << expireAt << '\n';
+		}
+
+		static std::string Quote(const std::string& field)
+		{
+			if (field.find_first_of(",\"\r\n") == std::string::npos)
+				return field;
+
+			std::string quoted = "\"";
+			for (const char c : field)
+			{
+				if (c == '"')
+					quoted += '"';
+				quoted += c;
+			}
+			return quoted + '"';
+		}
+
+		std::string path, temp;
+		bool csv;
+		std::ofstream file;
+	};
+
+	/// <summary>
+	/// Streams records from a file written by Writer (or by hand in the same format). CSV rows of one group, player
+	/// or tribe have to follow each other, as Writer writes them. A malformed line throws from next() with its line
+	/// number, the caller may skip it and carry on.
+	/// </summary>
+	class Reader {
+	public:
+		explicit Reader(const std::string& path)
+			: csv(IsCsv(path)), file(path, std::ios::binary)
+		{
+			if (!file)
+				throw std::runtime_error("Can't read " + path);
+		}
+
+		// False at the end of the file
+		bool next(Record& record)
+		{
+			return csv ? nextCsv(record) : nextJson(record);
+		}
+
+		int line() const
+		{
+			return lineNumber;
+		}
+
+	private:
+		struct Row {
+			RecordType Type;
+			std::string Key, Value, DelayUntil, ExpireAt;
+			// A "parent" row, it belongs to the group record named by Key
+			bool Parent = false;
+		};
+
+		bool nextJson(Record& record)
+		{
+			std::string text;
+			while (readLine(text))
+			{
+				if (text.find_first_not_of(" \t\r") == std::string::npos)
+					continue;
+
+				try
+				{
+					record = ParseJson(nlohmann::json::parse(text));
+				}
+				catch (const std::exception& exception)
+				{
+					throw std::runtime_error("Line " + std::to_string(lineNumber) + ": " + exception.what());
+				}
+				return true;
+			}
+			return false;
+		}
+
+		static Record ParseJson(const nlohmann::json& line)
+		{
+			Record record;
+			const std::string type = line.at("type").get<std::string>();
+			if (type == "group")
+			{
+				record.Type = RecordType::Group;
+				record.Name = FString(line.at("name").get<std::string>().c_str());
+				for (const auto& permission : line.value("permissions", nlohmann::json::array()))
+					record.Permissions.AddUnique(FString(permission.get<std::string>().c_str()));
+				for (const auto& parent : line.value("parents", nlohmann::json::array()))
+					record.Parents.AddUnique(FString(parent.get<std::string>().c_str()));
+				return record;
+			}
+
+			if (type == "player")
+			{
+				record.Type = RecordType::Player;
+				record.Name = FString(line.at("eos_id").get<std::string>().c_str());
+			}
+			else if (type == "tribe")
+			{
+				record.Type = RecordType::Tribe;
+				record.TribeId = line.at("tribe_id").get<int>();
+			}
+			else
+				throw std::runtime_error("Unknown record type " + type);
+
+			for (const auto& group : line.value("groups", nlohmann::json::array()))
+				record.Memberships.Groups.AddUnique(FString(group.get<std::string>().c_str()));
+			for (const auto& group : line.value("timed", nlohmann::json::array()))
+			{
+				record.Memberships.TimedGroups.AddUnique(TimedGroup(FString(group.at("group").get<std::string>().c_str()),
+					group.value("delay_until", 0LL), group.at("expire_at").get<long long>()));
+			}
+			return record;
+		}
+
+		bool nextCsv(Record& record)
+		{
+			if (deferredError)
+			{
+				const std::string error = std::move(*deferredError);
+				deferredError.reset();
+				throw std::runtime_error(error);
+			}
+			if (!pending && !readRow())
+				return false;
+
+			record = Record();
+			record.Type = pending->Type;
+			const std::string key = pending->Key;
+			if (record.Type == RecordType::Tribe)
+				record.TribeId = ParseInt(key);
+			else
+				record.Name = FString(key.c_str());
+
+			// Rows are added until one for another record comes up, that one is kept for the next call. A bad row
+			// ends the record, the error is reported by the next call so the rows read so far aren't lost
+			AddRow(record, *pending);
+			pending.reset();
+			try
+			{
+				while (readRow() && pending->Type == record.Type && pending->Key == key)
+				{
+					AddRow(record, *pending);
+					pending.reset();
+				}
+			}
+			catch (const std::exception& exception)
+			{
+				pending.reset();
+				deferredError = exception.what();
+			}
+			return true;
+		}
+
+		void AddRow(Record& record, const Row& row)
+		{
+			if (row.Value.empty())
+				return;
+
+			const FString value(row.Value.c_str());
+			if (row.Parent)
+				record.Parents.AddUnique(value);
+			else if (record.Type == RecordType::Group)
+				record.Permissions.AddUnique(value);
+			else if (row.ExpireAt.empty())
+				record.Memberships.Groups.AddUnique(value);
+			else
+				record.Memberships.TimedGroups.AddUnique(TimedGroup(value, row.DelayUntil.empty() ? 0 : ParseInt64(row.DelayUntil), ParseInt64(row.ExpireAt)));
+		}
+
+		// Reads the next row into pending, false at the end of the file
+		bool readRow()
+		{
+			std::string text;
+			while (readLine(text))
+			{
+				if (!text.empty() && text.back() == '\r')
+					text.pop_back();
+				if (text.empty() || (lineNumber == 1 && text.rfind("type,", 0) == 0))
+					continue;
+
+				const auto fields = SplitCsv(text);
+				if (fields.size() != 5)
+					throw std::runtime_error("Line " + std::to_string(lineNumber) + ": expected 5 fields");
+
+				Row row{ RecordType::Group, fields[1], fields[2], fields[3], fields[4] };
+				if (fields[0] == "player")
+					row.Type = RecordType::Player;
+				else if (fields[0] == "tribe")
+					row.Type = RecordType::Tribe;
+				else if (fields[0] == "parent")
+					row.Parent = true;
+				else if (fields[0] != "group")
+					throw std::runtime_error("Line " + std::to_string(lineNumber) + ": unknown record type " + fields[0]);
+
+				pending = std::move(row);
+				return true;
+			}
+			return false;
+		}
+
+		std::vector<std::string> SplitCsv(const std::string& text) const
+		{
+			std::vector<std::string> fields(1);
+			bool quoted = false;
+			for (size_t i = 0; i < text.size(); ++i)
+			{
+				const char c = text[i];
+				if (quoted)
+				{
+					if (c != '"')
+						fields.back() += c;
+					else if (i + 1 < text.size() && text[i + 1] == '"')
+						fields.back() += text[++i];
+					else
+						quoted = false;
+				}
+				else if (c == '"')
+					quoted = true;
+				else if (c == ',')
+					fields.emplace_back();
+				else
+					fields.back() += c;
+			}
+			if (quoted)
+				throw std::runtime_error("Line " + std::to_string(lineNumber) + ": unterminated quote");
+			return fields;
+		}
+
+		int ParseInt(const std::string& value) const
+		{
+			return static_cast<int>(ParseInt64(value));
+		}
+
+		long long ParseInt64(const std::string& value) const
+		{
+			try
+			{
+				size_t used = 0;
+				const long long number = std::stoll(value, &used);
+				if (used == value.size())
+					return number;
+			}
+			catch (const std::exception&)
+			{
+			}
+			throw std::runtime_error("Line " + std::to_string(lineNumber) + ": " + value + " is not a number");
+		}
+
+		bool readLine(std::string& text)
+		{
+			if (!std::getline(file, text))
+				return false;
+			++lineNumber;
+			return true;
+		}
+
+		bool csv;
+		std::ifstream file;
+		int lineNumber = 0;
+		std::optional<Row> pending;
+		std::optional<std::string> deferredError;
+	};
+
+	/// <summary>
+	/// Writes every group, player and tribe to path, see Permissions::Transfer for the formats. Queued writes are
+	/// flushed first. Lazy mode pages through the stored players, only some of them are cached.
+	/// </summary>
+	inline std::optional<std::string> Export(IDatabase& database, const std::string& path, size_t& exported)
+	{
+		static auto& exportStat = Stats::Timer("Transfer.Export");
+		Stats::ScopedTimer timer(exportStat);
+
+		try
+		{
+			Writer writer(path);
+			std::lock_guard<std::mutex> syncLock(database.syncMutex);
+			{
+				std::lock_guard<std::mutex> flushLock(database.flushMutex);
+				database.FlushWritesLocked();
+			}
+
+			database.permissionGroups.forEach([&writer, &exported](const FString& name, const CachedGroup& group)
+				{
+					writer.writeGroup(Permissions::groupNames.canonical(name), group.PermissionList, group.ParentList);
+					++exported;
+				});
+			if (Permissions::Players::Lazy)
+			{
+				// Written a page at a time as they are read, only some of the players are cached
+				std::string after;
+				bool more = true;
+				while (more)
+				{
+					IDatabase::PlayerRows page;
+					{
+						std::lock_guard<std::mutex> flushLock(database.flushMutex);
+						more = database.ReadPlayerPage(after, ExportPageRows, page);
+					}
+					for (const auto& player : page)
+					{
+						writer.writePlayer(player.first, player.second);
+						++exported;
+					}
+				}
+			}
+			else
+			{
+				database.permissionPlayers.forEach([&writer, &exported](const FString& eos_id, const CachedPermission& permission)
+					{
+						writer.writePlayer(eos_id, permission);
+						++exported;
+					});
+			}
+			database.permissionTribes.forEach([&writer, &exported](int tribeId, const CachedPermission& permission)
+				{
+					writer.writeTribe(tribeId, permission);
+					++exported;
+				});
+			writer.finish();
+		}
+		catch (const std::exception& exception)
+		{
+			Log::GetLog()->error("({} {}) Export failed {}", __FILE__, __FUNCTION__, exception.what());
+			return exception.what();
+		}
+
+		return {};
+	}
+
+	// Writes one chunk of an import in a single transaction
+	inline void ImportChunk(IDatabase& database, const std::vector<Record>& chunk)
+	{
+		if (chunk.empty())
+			return;
+
+		std::lock_guard<std::mutex> flushLock(database.flushMutex);
+		database.RunInTransaction([&database, &chunk]()
+			{
+				for (const auto& record : chunk)
+				{
+					switch (record.Type)
+					{
+					case RecordType::Group:
+						database.ImportGroupRow(record.Name, record.Permissions, record.Parents);
+						database.LogChange(ChangeKind::Group, record.Name.ToString());
+						break;
+					case RecordType::Player:
+						database.ImportPlayerRow(record.Name, record.Memberships);
+						database.LogChange(ChangeKind::Player, record.Name.ToString());
+						break;
+					case RecordType::Tribe:
+						database.ImportTribeRow(record.TribeId, record.Memberships);
+						database.LogChange(ChangeKind::Tribe, std::to_string(record.TribeId));
+						break;
+					}
+				}
+			});
+	}
+
+	/// <summary>
+	/// Reads groups, players and tribes from a file written by Export (or by hand in the same format). Each record
+	/// replaces the stored row, rows not in the file are kept. Records are written in transactions of
+	/// ImportChunkRows, malformed lines are skipped and counted. The caches are rebuilt once at the end,
+	/// also when a database error stops the import part way (the chunks before it stay written).
+	/// </summary>
+	inline std::optional<std::string> Import(IDatabase& database, const std::string& path, size_t& imported, size_t& skipped)
+	{
+		static auto& importStat = Stats::Timer("Transfer.Import");
+		Stats::ScopedTimer timer(importStat);
+
+		std::optional<std::string> error;
+		{
+			std::lock_guard<std::mutex> syncLock(database.syncMutex);
+			{
+				std::lock_guard<std::mutex> flushLock(database.flushMutex);
+				database.FlushWritesLocked();
+			}
+
+			try
+			{
+				Reader reader(path);
+				std::vector<Record> chunk;
+				chunk.reserve(ImportChunkRows);
+				Record record;
+				while (true)
+				{
+					try
+					{
+						if (!reader.next(record))
+							break;
+					}
+					catch (const std::runtime_error& exception)
+					{
+						Log::GetLog()->warn("({} {}) Skipping {}", __FILE__, __FUNCTION__, exception.what());
+						++skipped;
+						continue;
+					}
+
+					chunk.push_back(std::move(record));
+					if (chunk.size() >= static_cast<size_t>(ImportChunkRows))
+					{
+						ImportChunk(database, chunk);
+						imported += chunk.size();
+						chunk.clear();
+					}
+				}
+				ImportChunk(database, chunk);
+				imported += chunk.size();
+			}
+			catch (const std::exception& exception)
+			{
+				Log::GetLog()->error("({} {}) Import failed {}", __FILE__, __FUNCTION__, exception.what());
+				error = exception.what();
+			}
+		}
+
+		if (imported > 0)
+			database.Init();
+		return error;
+	}
+}
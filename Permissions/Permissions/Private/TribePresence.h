@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Main.h"
+
+// Online players by EOS id and per tribe, kept up to date from the login, logout and tribe hooks so resolving a
+// player's online context and TribeOnline:N are lookups
+namespace Permissions::Presence
+{
+	inline std::mutex presenceMutex;
+	// EOS id -> controller, linked player id and tribe id (0 when not in a tribe) of every online player
+	inline std::unordered_map<FString, OnlinePlayer, FStringNoCaseHash, FStringNoCaseEqual> onlinePlayers;
+	inline std::unordered_map<int, int> tribeOnline;
+
+	// Caller holds presenceMutex
+	inline void CountTribe(int tribeId, int delta)
+	{
+		if (tribeId != 0 && (tribeOnline[tribeId] += delta) <= 0)
+			tribeOnline.erase(tribeId);
+	}
+
+	// Caller holds presenceMutex
+	inline void SetPlayer(const FString& eos_id, const OnlinePlayer& player)
+	{
+		auto [iter, inserted] = onlinePlayers.try_emplace(eos_id, player);
+		if (inserted)
+		{
+			CountTribe(player.TribeId, 1);
+			return;
+		}
+
+		if (iter->second.TribeId != player.TribeId)
+		{
+			CountTribe(iter->second.TribeId, -1);
+			CountTribe(player.TribeId, 1);
+		}
+		iter->second = player;
+	}
+
+	inline void UpdatePlayer(AShooterPlayerController* playerController)
+	{
+		if (!playerController)
+			return;
+
+		FString eos_id;
+		playerController->GetUniqueNetIdAsString(&eos_id);
+		if (eos_id.IsEmpty())
+			return;
+
+		FTribeData* tribeData = GetTribeData(playerController);
+		const OnlinePlayer player{ playerController, playerController->GetLinkedPlayerID(), tribeData ? tribeData->TribeIDField() : 0 };
+
+		std::lock_guard<std::mutex> lg(presenceMutex);
+		SetPlayer(eos_id, player);
+	}
+
+	inline void RemovePlayer(const FString& eos_id)
+	{
+		std::lock_guard<std::mutex> lg(presenceMutex);
+		auto iter = onlinePlayers.find(eos_id);
+		if (iter == onlinePlayers.end())
+			return;
+
+		CountTribe(iter->second.TribeId, -1);
+		onlinePlayers.erase(iter);
+	}
+
+	inline bool FindPlayer(const FString& eos_id, OnlinePlayer& player)
+	{
+		std::lock_guard<std::mutex> lg(presenceMutex);
+		auto iter = onlinePlayers.find(eos_id);
+		if (iter == onlinePlayers.end())
+			return false;
+
+		player = iter->second;
+		return true;
+	}
+
+	inline int GetTribeOnline(int tribeId)
+	{
+		std::lock_guard<std::mutex> lg(presenceMutex);
+		auto iter = tribeOnline.find(tribeId);
+		return iter == tribeOnline.end() ? 0 : iter->second;
+	}
+
+	// Full scan of the online players, used on load and with each database sync to correct any drift
+	// from tribe changes that don't go through the hooked functions (merges, admin commands)
+	inline void Rebuild()
+	{
+		auto world = AsaApi::GetApiUtils().GetWorld();
+		if (!world)
+			return;
+
+		std::vector<std::pair<FString, OnlinePlayer>> online;
+		const auto& player_controllers = world->PlayerControllerListField();
+		for (TWeakObjectPtr<APlayerController> player_controller : player_controllers)
+		{
+			AShooterPlayerController* pc = static_cast<AShooterPlayerController*>(player_controller.Get());
+			if (!pc)
+				continue;
+
+			FString eos_id;
+			pc->GetUniqueNetIdAsString(&eos_id);
+			if (eos_id.IsEmpty())
+				continue;
+
+			FTribeData* tribeData = GetTribeData(pc);
+			online.emplace_back(eos_id, OnlinePlayer{ pc, pc->GetLinkedPlayerID(), tribeData ? tribeData->TribeIDField() : 0 });
+		}
+
+		std::lock_guard<std::mutex> lg(presenceMutex);
+		onlinePlayers.clear();
+		tribeOnline.clear();
+		for (const auto& player : online)
+			SetPlayer(player.first, player.second);
+	}
+
+	// The tribe hooks only hand us the player state, tribe changes are rare enough to look the controller up
+	inline AShooterPlayerController* FindController(AShooterPlayerState* playerState)
+	{
+		auto world = AsaApi::GetApiUtils().GetWorld();
+		if (!world || !playerState)
+			return nullptr;
+
+		const auto& player_controllers = world->PlayerControllerListField();
+		for (TWeakObjectPtr<APlayerController> player_controller : player_controllers)
+		{
+			APlayerController* pc = player_controller.Get();
+			if (pc && reinterpret_cast<AShooterPlayerState*>(pc->PlayerStateField().Get()) == playerState)
+				return static_cast<AShooterPlayerController*>(pc);
+		}
+
+		return nullptr;
+	}
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace Permissions::Writes
+{
+	// When false every mutation is written before it returns, as before
+	inline bool Async = true;
+	// A write that keeps failing is dropped after this many attempts and its row is reloaded from the database
+	inline int MaxAttempts = 5;
+}
+
+/// <summary>
+/// Database writes waiting to be persisted by the background writer. Each write targets one slot of one row
+/// (e.g. a player's Groups column or a single membership row), a newer write to the same slot replaces the
+/// queued one so bursts of changes to a row end up as a single statement.
+/// </summary>
+class WriteBehindQueue {
+public:
+	struct Write {
+		int Kind;
+		std::string Key;
+		std::string Slot;
+		std::function<void()> Run;
+		int Attempts = 0;
+	};
+
+	struct Failure {
+		int Kind;
+		std::string Key;
+		std::string Error;
+	};
+
+	void push(int kind, const std::string& key, const std::string& slot, std::function<void()> run)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		Push(kind, key, slot, std::move(run));
+	}
+
+	// Queued together, so the same flush picks all of them up and they are stored in one transaction
+	void pushAll(std::vector<Write>&& batch)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		for (auto& write : batch)
+			Push(write.Kind, write.Key, write.Slot, std::move(write.Run));
+	}
+
+	// Everything queued so far, the rows stay pending until complete() is called for them
+	std::vector<Write> take()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		std::vector<Write> batch;
+		batch.reserve(writes.size());
+		for (auto& write : writes)
+			batch.push_back(std::move(write));
+		writes.clear();
+		slots.clear();
+		return batch;
+	}
+
+	void complete(const Write& write)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		Release(write.Kind, write.Key);
+	}
+
+	/// <summary>
+	/// Puts a failed write back unless a newer write to the same slot was queued meanwhile.
+	/// Returns false once it ran out of attempts, the failure is then recorded for the game thread.
+	/// </summary>
+	bool retry(Write&& write, const std::string& error)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		retryAt = std::chrono::steady_clock::now() + std::chrono::seconds(std::min(++write.Attempts, 30));
+
+		const SlotKey slotKey{ write.Kind, write.Key, write.Slot };
+		if (slots.count(slotKey)) {
+			Release(write.Kind, write.Key);
+			return true;
+		}
+
+		if (write.Attempts >= Permissions::Writes::MaxAttempts) {
+			failures.push_back(Failure{ write.Kind, write.Key, error });
+			failedRows.emplace(write.Kind, write.Key);
+			Release(write.Kind, write.Key);
+			return false;
+		}
+
+		// Retried before anything queued after it
+		writes.push_front(std::move(write));
+		slots[slotKey] = writes.begin();
+		return true;
+	}
+
+	bool isPending(int kind, const std::string& key)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		auto iter = pendingRows.find(RowKey{ kind, key });
+		return iter != pendingRows.end() && iter->second > 0;
+	}
+
+	// Keys of the rows of kind with queued or in-flight writes
+	std::vector<std::string> pendingKeys(int kind)
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		std::vector<std::string> keys;
+		for (auto iter = pendingRows.lower_bound(RowKey{ kind, std::string() }); iter != pendingRows.end() && iter->first.first == kind; ++iter)
+		{
+			if (iter->second > 0)
+				keys.push_back(iter->first.second);
+		}
+		return keys;
+	}
+
+	// Something is queued and the backoff of the last failure has passed
+	bool isDue()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return !writes.empty() && std::chrono::steady_clock::now() >= retryAt;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return writes.size();
+	}
+
+	std::vector<Failure> takeFailures()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return std::exchange(failures, {});
+	}
+
+	// Rows whose writes were given up, their cached state no longer matches the database
+	std::set<std::pair<int, std::string>> takeFailedRows()
+	{
+		std::lock_guard<std::mutex> lg(mutex);
+		return std::exchange(failedRows, {});
+	}
+
+private:
+	using SlotKey = std::tuple<int, std::string, std::string>;
+	using RowKey = std::pair<int, std::string>;
+
+	// Caller holds mutex
+	void Push(int kind, const std::string& key, const std::string& slot, std::function<void()> run)
+	{
+		const SlotKey slotKey{ kind, key, slot };
+		auto queued = slots.find(slotKey);
+		if (queued != slots.end()) {
+			// Moved to the back so it still runs after anything queued before the newer write
+			writes.erase(queued->second);
+			--pendingRows[RowKey{ kind, key }];
+		}
+
+		writes.push_back(Write{ kind, key, slot, std::move(run), 0 });
+		slots[slotKey] = std::prev(writes.end());
+		++pendingRows[RowKey{ kind, key }];
+	}
+
+	// Caller holds mutex
+	void Release(int kind, const std::string& key)
+	{
+		auto iter = pendingRows.find(RowKey{ kind, key });
+		if (iter != pendingRows.end() && --iter->second <= 0)
+			pendingRows.erase(iter);
+	}
+
+	std::mutex mutex;
+	std::list<Write> writes;
+	std::map<SlotKey, std::list<Write>::iterator> slots;
+	// Queued and in-flight writes per row, a row with pending writes must not be overwritten by a reload
+	std::map<RowKey, int> pendingRows;
+	std::vector<Failure> failures;
+	std::set<std::pair<int, std::string>> failedRows;
+	std::chrono::steady_clock::time_point retryAt;
+};
@@ -12,6 +12,7 @@ namespace Permissions::DB
 {
 	/**
 	 * \brief Checks if player exists in database
+	 * With LazyPlayerLoading a player that isn't loaded yet reads as missing until the background load brings it in
 	 */
 	PERMISSIONS_API bool IsPlayerExists(const FString& eos_id);
 
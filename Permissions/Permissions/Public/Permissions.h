@@ -10,12 +10,28 @@
 
 namespace Permissions
 {
+	// One group membership that changed, what PermissionGroupUpdatedDetailedCallback gets as separate arguments
+	struct GroupChange
+	{
+		FString EosId;
+		int TribeId;
+		FString Group;
+		bool bAddedGroup;
+		bool bIsTimedGroup;
+		bool bIsTribeGroup;
+	};
+
 	PERMISSIONS_API TArray<FString> GetPlayerGroups(const FString& eos_id);
 	PERMISSIONS_API TArray<FString> GetGroupPermissions(const FString& group);
+	// Never waits on the database. With LazyPlayerLoading players that aren't loaded are listed as of the last background
+	// read of the stored memberships (at most 30 seconds old), the first call for a group lists only loaded players.
+	// Only loaded players are listed for Default, and for every group with the legacy schema
 	PERMISSIONS_API TArray<FString> GetGroupMembers(const FString& group);
 
 	PERMISSIONS_API bool IsPlayerInGroup(const FString& eos_id, const FString& group);
 
+	// With LazyPlayerLoading a change to a player that isn't loaded is made once the row is read in the background. A missing group
+	// is still returned as an error, anything the player's row decides is reported to SubscribePermissionWriteFailedCallback
 	PERMISSIONS_API std::optional<std::string> AddPlayerToGroup(const FString& eos_id, const FString& group);
 	PERMISSIONS_API std::optional<std::string> RemovePlayerFromGroup(const FString& eos_id, const FString& group);
 
@@ -28,9 +44,20 @@ namespace Permissions
 	PERMISSIONS_API bool IsGroupHasPermission(const FString& group, const FString& permission);
 	PERMISSIONS_API bool IsPlayerHasPermission(const FString& eos_id, const FString& permission);
 
+	// Batch checks, the player's groups are resolved once. Bit i of the result is set for groups[i] / permissions[i], at most 64 entries
+	PERMISSIONS_API uint64 IsPlayerInGroups(const FString& eos_id, const TArray<FString>& groups);
+	PERMISSIONS_API uint64 IsPlayerHasPermissions(const FString& eos_id, const TArray<FString>& permissions);
+	// EOS ids of every online player that has the permission
+	PERMISSIONS_API TArray<FString> GetOnlinePlayersWithPermission(const FString& permission);
+
 	PERMISSIONS_API std::optional<std::string> GroupGrantPermission(const FString& group, const FString& permission);
 	PERMISSIONS_API std::optional<std::string> GroupRevokePermission(const FString& group, const FString& permission);
 
+	// A group has every permission of its parents and their parents, GetGroupPermissions lists only its own
+	PERMISSIONS_API TArray<FString> GetGroupParents(const FString& group);
+	PERMISSIONS_API std::optional<std::string> AddGroupParent(const FString& group, const FString& parent);
+	PERMISSIONS_API std::optional<std::string> RemoveGroupParent(const FString& group, const FString& parent);
+
 
 	PERMISSIONS_API std::optional<std::string> AddTribeToGroup(int tribeId, const FString& group);
 	PERMISSIONS_API std::optional<std::string> RemoveTribeFromGroup(int tribeId, const FString& group);
@@ -43,11 +70,30 @@ namespace Permissions
 	PERMISSIONS_API TArray<FString> GetTribeGroups(int tribeId);
 
 	PERMISSIONS_API void AddPlayerPermissionCallback(FString CallbackName, bool onlyCheckOnline, bool cacheBySteamId, bool cacheByTribe, const std::function<TArray<FString>(const FString&, int*)>& callback);
+	// Results are cached per player (or per tribe) for cacheTtlMs, 0 disables caching
+	PERMISSIONS_API void AddPlayerPermissionCallback(FString CallbackName, bool onlyCheckOnline, bool cacheBySteamId, bool cacheByTribe, int cacheTtlMs, const std::function<TArray<FString>(const FString&, int*)>& callback);
+	// Answers for many online players in one call, the result holds one group list per eos id in the same order
+	PERMISSIONS_API void AddPlayerPermissionBulkCallback(FString CallbackName, int cacheTtlMs, const std::function<TArray<TArray<FString>>(const TArray<FString>&, const TArray<int>&)>& callback);
 	PERMISSIONS_API void RemovePlayerPermissionCallback(FString CallbackName);
+	PERMISSIONS_API void InvalidatePlayerPermissionCallback(FString CallbackName);
+	PERMISSIONS_API void InvalidatePlayerPermissionCallback(FString CallbackName, const FString& eos_id, int tribeId);
+	PERMISSIONS_API void RefreshPlayerPermissionCallbacks();
 
 	PERMISSIONS_API void SubscribePermissionGroupUpdatedCallback(FString CallbackName, const std::function<void(const FString&, int)>& callback);
 	PERMISSIONS_API void UnSubscribePermissionGroupUpdatedCallback(FString CallbackName);
 
 	PERMISSIONS_API void SubscribePermissionGroupUpdatedDetailedCallback(FString CallbackName, const std::function<void(const FString&, int, const FString&, bool, bool, bool)>& callback);
 	PERMISSIONS_API void UnSubscribePermissionGroupUpdatedDetailedCallback(FString CallbackName);
+
+	// Group change callbacks run at the end of the game tick the change was made in. Repeated changes to the same
+	// membership within a tick are reported once with the last state, this gets all of them in one call
+	PERMISSIONS_API void SubscribePermissionGroupsChangedCallback(FString CallbackName, const std::function<void(const TArray<GroupChange>&)>& callback);
+	PERMISSIONS_API void UnSubscribePermissionGroupsChangedCallback(FString CallbackName);
+
+	// Changes are stored by a background writer, this reports writes it gave up on (eos_id, tribeId or group of the row, error).
+	// Failed LazyPlayerLoading changes to players that weren't loaded are reported too, with both eos_id and group
+	PERMISSIONS_API void SubscribePermissionWriteFailedCallback(FString CallbackName, const std::function<void(const FString&, int, const FString&, const std::string&)>& callback);
+	PERMISSIONS_API void UnSubscribePermissionWriteFailedCallback(FString CallbackName);
+	// Blocks until every queued change is stored, returns the error if any write failed
+	PERMISSIONS_API std::optional<std::string> FlushPendingWrites();
 }